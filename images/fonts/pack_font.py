@@ -0,0 +1,100 @@
+# Usage: python3 pack_font.py <name> [<pxrange>] [<missing>] [<line height>]
+#  Converts the BMP atlas and CSV metadata produced by msdf-atlas-gen
+#  (<name>.bmp and <name>.csv) into a font pack (<name>.font), which
+#  picoputt can load without any parsing.  See loadFontPack in text.c
+#  for the format.
+#
+#  <pxrange>      Distance field range in pixels.  [Default: 8]
+#  <missing>      Code point of the glyph to use for missing glyphs.
+#                 [Default: 0x3f, ie ?]
+#  <line height>  Line height in em units.  [Default: 1.22]
+#
+#  Only uncompressed 24 and 32 bit BMPs are supported.
+
+import struct
+
+MAGIC = b'PPFT'
+VERSION = 1
+
+
+def read_bmp(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    if data[:2] != b'BM':
+        raise ValueError(f'{path} is not a BMP file')
+
+    offset, = struct.unpack_from('<I', data, 10)
+    width, height, _, bpp, compression = struct.unpack_from('<iiHHI', data, 18)
+    if bpp not in (24, 32) or compression not in (0, 3):
+        raise ValueError(f'{path}: unsupported BMP format ({bpp} bpp, compression {compression})')
+
+    bytes_pp = bpp // 8
+    stride = (width * bytes_pp + 3) // 4 * 4
+    rows = [
+        data[offset + y * stride:offset + y * stride + width * bytes_pp]
+        for y in range(abs(height))
+    ]
+
+    # BMP rows are bottom-up unless the height is negative
+    if height > 0:
+        rows.reverse()
+
+    pixels = bytearray()
+    for row in rows:
+        for x in range(0, len(row), bytes_pp):
+            b, g, r = row[x:x + 3]
+            pixels += bytes((r, g, b))
+
+    return width, abs(height), bytes(pixels)
+
+
+def read_csv(path, atlas_width, atlas_height):
+    glyphs = []
+    with open(path) as f:
+        for line in f:
+            if not line.strip():
+                continue
+            code, advance, left, bot, right, top, a_left, a_bot, a_right, a_top = (
+                float(v) for v in line.split(',')
+            )
+
+            glyphs.append((
+                int(code), advance,
+                left, bot, right - left, top - bot,
+                a_left / atlas_width, 1. - a_bot / atlas_height,
+                (a_right - a_left) / atlas_width, -(a_top - a_bot) / atlas_height
+            ))
+
+    glyphs.sort()
+    return glyphs
+
+
+if __name__ == '__main__':
+    import sys
+
+    if not 2 <= len(sys.argv) <= 5:
+        sys.exit(f'Usage: python3 {sys.argv[0]} <name> [<pxrange>] [<missing>] [<line height>]')
+
+    name = sys.argv[1]
+    pxrange = float((sys.argv[2:] or ['8'])[0])
+    missing = int((sys.argv[3:] or ['0x3f'])[0], 0)
+    line_height = float((sys.argv[4:] or ['1.22'])[0])
+
+    width, height, pixels = read_bmp(f'{name}.bmp')
+    glyphs = read_csv(f'{name}.csv', width, height)
+    codes = [glyph[0] for glyph in glyphs]
+    if missing not in codes:
+        sys.exit(f'{name}.csv has no glyph for missing code point {missing:#x}')
+
+    with open(f'{name}.font', 'wb') as f:
+        f.write(MAGIC)
+        f.write(struct.pack(
+            '<IffIIII', VERSION, pxrange, line_height,
+            len(glyphs), codes.index(missing), width, height
+        ))
+
+        for glyph in glyphs:
+            f.write(struct.pack('<If4f4f', *glyph))
+
+        f.write(pixels)
@@ -0,0 +1,21 @@
+// Lets a compute shader run either on a single simulation (image2D), or
+// on a batch of independent simulations stored in the layers ("lanes")
+// of 2D array images, with one lane per z workgroup.  The lane variants
+// are compiled with LANES defined (see lanes.c).
+//
+// Shaders declare their per-lane images as LANE_IMAGE, and access them
+// with laneLoad, laneStore and laneSize instead of imageLoad, imageStore
+// and imageSize.  LANE is the lane index (always 0 without LANES).
+#ifdef LANES
+#define LANE_IMAGE image2DArray
+#define LANE int(gl_WorkGroupID.z)
+#define laneLoad(img, pos) imageLoad(img, ivec3(pos, LANE))
+#define laneStore(img, pos, value) imageStore(img, ivec3(pos, LANE), value)
+#define laneSize(img) imageSize(img).xy
+#else
+#define LANE_IMAGE image2D
+#define LANE 0
+#define laneLoad(img, pos) imageLoad(img, pos)
+#define laneStore(img, pos, value) imageStore(img, pos, value)
+#define laneSize(img) imageSize(img)
+#endif
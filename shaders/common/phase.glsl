@@ -0,0 +1,22 @@
+// Helpers for phases of complex numbers stored as vec2
+
+float ieee754Atan2(float y, float x) {
+    // Follows IEEE 754 rules for the case where x and y are both 0.
+
+    // GLSL atan(y, x): "Results are undefined if x and y are both 0"
+    // IEEE 754 atan2(y, x): "atan2(±0, −0) is ±π, atan2(±0, +0) is ±0"
+    // The function name "ieee754Atan2" is really only accurate under
+    // the (unsafe) assumption that for all other cases GLSL atan will
+    // behave like IEEE 754 atan2.
+    // But really all I care about is ieee754Atan2(0., 0.) == 0.
+    // For that not to work, infinities would need to be handled very
+    // strangely.
+
+    if (x == 0. && y == 0.) x = 1./x; // ±∞
+    return atan(y, x);
+}
+
+float phaseDiff(vec2 a, vec2 b) {
+    // conceptually similar to angle(b) - angle(a)
+    return ieee754Atan2(a.r*b.g - a.g*b.r, a.r*b.r + a.g*b.g);
+}
@@ -0,0 +1,16 @@
+// Conventions for the staggered wavefunction produced by qturn.frag.
+// Following Visscher, the real and imaginary components are stored at
+// staggered times.  If the current state is cur = R(t) + I(t+dt/2)i,
+// then due to the rotation done by each qturn, the previous state is
+// prev = I(t-dt/2) - R(t)i.
+
+// Undoes the rotation of the previous state, giving R(t) + I(t-dt/2)i
+vec2 unrotatePrev(vec2 prev) {
+    return prev.gr * vec2(-1., 1.);
+}
+
+// Probability density |psi|^2, which (since psi is staggered) we define
+// as R(t)^2 + I(t+dt/2)I(t-dt/2).  prev must already be unrotated.
+float staggeredPDF(vec2 cur, vec2 prev) {
+    return abs(dot(cur, prev));
+}
@@ -0,0 +1,18 @@
+// The putt-wave, shared by putt.comp, lanes/putt.comp and the preview in
+// graphics/renderer.frag.  Near the origin, it is approximately a plane
+// wave with the given momentum.  Away from the origin (r >> clubRadius),
+// the wavelength increases proportional to r (and so local momentum
+// decreases ~1/r).  pos is relative to the origin.
+vec2 puttWave(vec2 pos, vec2 momentum, float clubRadius, float phase) {
+    float magMomentum = length(momentum);
+    float pinch = clubRadius * magMomentum;
+    float angle = (magMomentum == 0.? 0. : pinch * atan(
+        dot(momentum, pos) /
+        length(vec2(pinch, dot(momentum, vec2(pos.y, -pos.x))))
+    )) - phase;
+
+    // uncomment for plane wave
+    // angle = dot(momentum, pos) - phase;
+
+    return vec2(cos(angle), sin(angle));
+}
@@ -0,0 +1,47 @@
+// The qturn update itself, shared by qturn.frag, lanes/qturn.comp and putt.comp.
+// See qturn.frag for what a qturn is.
+//
+// With STENCIL_ORDER 2 (the default), stencil is the sum of the
+// imaginary components of the 4 direct neighbors plus half the sum of
+// the 4 diagonal ones, so the Laplacian of prevPsi.g is
+// stencil/2 - 3*prevPsi.g.  Call this sum s1, and s2 the same sum of the
+// texels at twice the distance.
+//
+// With STENCIL_ORDER 4, the Laplacian is the Richardson extrapolation
+// (4*L(dx) - L(2*dx))/3 of the 9-point one, giving a 17-point stencil
+// which is 4th order accurate and still isotropic to 4th order.  Callers
+// then pass COMBINE_STENCIL(s1, s2) as the stencil, and need
+// STENCIL_RADIUS texels around each one.  Its kinetic term lies in
+// [0, 32/3 / FOUR_M_DX2] instead of [0, 8 / FOUR_M_DX2], which is what
+// limits dt (see kineticRange in loop.c), but its phase velocity error
+// at a given dx is much smaller (about 1% rather than 8% at 1 radian per
+// texel), so the same accuracy needs far fewer texels.
+//
+// For either order, stencil - STENCIL_CENTER*prevPsi.g is 2*dx^2 times
+// the Laplacian.
+//
+// FOUR_M_DX2, V_SHIFT and STENCIL_ORDER are injected by the host, see
+// ShaderConstants.
+#if STENCIL_ORDER == 4
+#define STENCIL_RADIUS 2
+#define STENCIL_CENTER 7.5
+#define COMBINE_STENCIL(s1, s2) ((4. / 3.) * (s1) - (1. / 12.) * (s2))
+#else
+#define STENCIL_RADIUS 1
+#define STENCIL_CENTER 6.
+#define COMBINE_STENCIL(s1, s2) (s1)
+#endif
+
+// Near the boundary, s2 needs texels beyond the texels which psi is
+// pinned to 0 at (walls and just outside the sim).  Those are reflected
+// oddly about the pinned texel, so the far tap through a pinned texel is
+// -prevPsi.g, which keeps the stencil 4th order up to the boundary.
+// Treating them as 0 instead would make the Laplacian discontinuous
+// there.
+
+vec2 qturnStep(vec2 prevPsi, float stencil, float V, float dt) {
+    // 9-point stencil is needed to get Visscher's stability conditions.
+    // With 5-point stencil, stability region of dt is halved!
+    float H_g = (V - V_SHIFT) * prevPsi.g - (stencil - STENCIL_CENTER * prevPsi.g) / FOUR_M_DX2;
+    return vec2(-prevPsi.g, prevPsi.r + dt * H_g);
+}
@@ -1,5 +1,5 @@
 #version 430
-// Draws a glowing circle to visualize putt.frag's u_clubRadius.
+// Draws a glowing circle to visualize the putt-wave's club radius.
 
 out vec4 o_color;
 
@@ -1,20 +1,32 @@
 #version 430
 // Produces a visualization of the wavefunction.
+// This is the display resolution pass, the surface itself is computed
+// at simulation resolution by surface_pass.frag, so this only samples
+// it and does the view dependent lighting.
 // In case you find my fancy graphics scientifically uncouth (or if they
 // run too slow), you can disable them by setting FANCY to 0 to get a
 // simple colormapped visualization of |psi| (colorbars not included).
+// g_rendererSimple is built with FANCY 0, which the render scale
+// governor falls back to if lowering the resolution isn't enough.
+#ifndef FANCY
 #define FANCY 1
+#endif
+
+#include "../common/putt.glsl"
 
 out vec4 o_color;
 
-uniform sampler2D u_cur;
-uniform sampler2D u_pdf;
-uniform sampler2D u_totalProb;  // 1x1 texture, sum of u_pdf
-uniform sampler2D u_potential;
+uniform sampler2D u_surface;  // Output of surface_pass.frag
 uniform sampler2D u_wall;
-uniform vec2 u_simSize;  // can't use textureSize(u_pdf, 0) because it may be padded.
+uniform vec2 u_simSize;
+// The putt being aimed is previewed by rotating colors by its phase,
+// which is evaluated here rather than drawn into a buffer first.
 uniform bool u_puttActive;
-uniform sampler2D u_putt;
+uniform vec2 u_puttOrigin;      // In sim grid units
+uniform vec2 u_puttMomentum;
+uniform float u_puttClubRadius; // In physical units
+uniform float u_puttPhase;
+uniform float u_dx;
 uniform sampler2D u_colormap;
 uniform samplerCube u_skybox;
 uniform vec2 u_mouse;
@@ -23,26 +35,20 @@ uniform float u_contourProgress;// = 0.;
 uniform float u_contourSep;// = 0.01;
 in vec2 v_pos;  // texture uv coordinates provided by surface.vert
 
+vec2 puttPreview() {
+    return puttWave(u_dx * (v_pos * u_simSize - u_puttOrigin), u_puttMomentum, u_puttClubRadius, u_puttPhase);
+}
+
 void main() {
     if (textureLod(u_wall, v_pos, 0).r > 0.5) {
         discard;
     }
 
-    float totalProb = texelFetch(u_totalProb, ivec2(0, 0), 0).r;
-
-    // Height map from |psi|^2, rescaled to have a fixed average height
-    float avgVal = 0.08;
-    float scale = avgVal * u_simSize.x * u_simSize.y / totalProb;
-    float height = scale * textureLod(u_pdf, v_pos, 0).r;
+    vec4 surface = textureLod(u_surface, v_pos, 0);
+    float height = surface.r;
 
 #if FANCY
-    // gradient has units of height/pixel of the wavefunction texture
-    vec2 d = 1./u_simSize;
-    vec2 grad = scale * vec2(
-        (textureLod(u_pdf, v_pos + vec2(d.x, 0.), 0).r - textureLod(u_pdf, v_pos + vec2(-d.x, 0.), 0).r) / 2.,
-        (textureLod(u_pdf, v_pos + vec2(0., d.y), 0).r - textureLod(u_pdf, v_pos + vec2(0., -d.y), 0).r) / 2.
-    );
-
+    vec2 grad = surface.gb;
     vec3 norm = normalize(vec3(-grad, 50./(u_simSize.x+u_simSize.y)));
 
     // Direction from eye to fragment
@@ -74,7 +80,7 @@ void main() {
         1.
     );
 
-    float V = textureLod(u_potential, v_pos, 0).r;
+    float V = surface.a;
     vec3 Vcolor = o_color.rgb;
 
     float dV = length(vec2(dFdx(V), dFdy(V)));
@@ -87,7 +93,7 @@ void main() {
 
 
     if (u_puttActive) {
-        vec2 putt = textureLod(u_putt, v_pos, 0).rg;
+        vec2 putt = puttPreview();
         float c = putt.r;
         float s = putt.g;
         vec3 ax = normalize(vec3(1., 1., 1.));
@@ -103,7 +109,7 @@ void main() {
 #else
     o_color = texture(u_colormap, vec2(0.3 * sqrt(height), 0.));
     if (u_puttActive) {
-        float putt = textureLod(u_putt, v_pos, 0).r;
+        float putt = puttPreview().r;
         o_color.rgb *= putt * 0.1 + 0.9;
     }
 #endif
@@ -0,0 +1,34 @@
+#version 430
+// First pass of the renderer, run at simulation resolution.  Computes
+// everything about the surface that doesn't depend on the view, so that
+// renderer.frag (which runs per display pixel) only needs to sample it.
+
+out vec4 o_surface;  // height, gradient of height (per sim pixel), potential
+
+uniform sampler2D u_pdf;
+uniform sampler2D u_totalProb;  // 1x1 texture, sum of u_pdf
+uniform sampler2D u_potential;
+
+float pdfAt(ivec2 pos) {
+    // u_pdf may be padded, so clamp to the simulation rather than
+    // relying on the texture's wrap mode.
+    return texelFetch(u_pdf, clamp(pos, ivec2(0), SIM_SIZE - 1), 0).r;
+}
+
+void main() {
+    ivec2 pos = ivec2(gl_FragCoord.xy);
+    float totalProb = texelFetch(u_totalProb, ivec2(0, 0), 0).r;
+
+    // Height map from |psi|^2, rescaled to have a fixed average height
+    float avgVal = 0.08;
+    float scale = avgVal * float(SIM_SIZE.x * SIM_SIZE.y) / totalProb;
+    float height = scale * pdfAt(pos);
+
+    // gradient has units of height/pixel of the wavefunction texture
+    vec2 grad = scale * vec2(
+        (pdfAt(pos + ivec2(1, 0)) - pdfAt(pos - ivec2(1, 0))) / 2.,
+        (pdfAt(pos + ivec2(0, 1)) - pdfAt(pos - ivec2(0, 1))) / 2.
+    );
+
+    o_surface = vec4(height, grad, texelFetch(u_potential, pos, 0).r);
+}
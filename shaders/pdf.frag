@@ -1,9 +1,7 @@
 #version 430
-// Outputs probability density, |psi|^2.  Following Visscher, since psi
-// is staggered, we define |psi|^2 as R(t)^2 + I(t+dt/2)I(t-dt/2).
-// If u_cur = R(t) + I(t+dt/2)i, then due to the rotation of qturn.frag,
-// u_prev = I(t-dt/2) - R(t)i.  So we undo the rotation and dot them
-// together to get the probability density.
+// Outputs probability density, |psi|^2.  See common/psi.glsl for how
+// this is defined for the staggered wavefunction.
+#include "common/psi.glsl"
 
 out float o_psi2;
 
@@ -14,6 +12,6 @@ uniform sampler2D u_prev;
 void main() {
     ivec2 pos = ivec2(gl_FragCoord.xy);
     vec2 psi = texelFetch(u_cur, pos, 0).rg;
-    vec2 psiPrev = texelFetch(u_prev, pos, 0).gr * vec2(-1., 1.);
-    o_psi2 = abs(dot(psi, psiPrev));
+    vec2 psiPrev = unrotatePrev(texelFetch(u_prev, pos, 0).rg);
+    o_psi2 = staggeredPDF(psi, psiPrev);
 }
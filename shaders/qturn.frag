@@ -8,28 +8,73 @@
 //   staggered-time method.
 //   See Visscher 1991: "A fast explicit algorithm for the time‐dependent Schrödinger equation"
 
+#include "common/qturn.glsl"
+
 out vec2 o_psi;
 
-uniform float u_4m_dx2;           // 4*m*dx^2, where dx is texel size and m is mass
+// FOUR_M_DX2 (4*m*dx^2, where dx is texel size and m is mass) and
+// SIM_SIZE are injected by the host, see ShaderConstants.  Being
+// constants lets the compiler fold the stencil coefficients and bounds.
 uniform float u_dt;               // Timestep
+#ifdef QTURN_IMAGE
+layout(rg32f) uniform readonly image2D u_prev;  // Previous wavefunction state
+#else
 uniform sampler2D u_prev;         // Previous wavefunction state
+#endif
 uniform sampler2D u_potential;    // Potential function at current time
 uniform sampler2D u_wall;
 uniform sampler2D u_dragPot;
 
 
-#define FETCH_G(coord, cond) ((cond)? texelFetch(u_prev, (coord), 0).g : 0.)
-// This is consistently a bit faster than the ternary on my machine:
-// #define FETCH_G(coord, cond) (float(cond)*texelFetch(u_prev, (coord), 0).g)
-// However, I don't think it's safe because we could get infinity or NaN
+// Neighbors outside of the grid need to be treated as 0.  There are a
+// few ways of doing that, and which is fastest depends on the GPU, so
+// the variant is chosen at startup by the autotuner in tuning.c, which
+// compiles this shader with one of these defined:
+//  * QTURN_TERNARY: bounds check with a ternary (the reference variant)
+//  * QTURN_MULTIPLY: multiply by the bounds check.  This is consistently
+//    a bit faster than the ternary on my machine.  However, I don't
+//    think it's safe because we could get infinity or NaN, so the
+//    autotuner only uses it if its results match QTURN_TERNARY.
+//  * QTURN_IMAGE: image2D, where out of bounds imageLoad gives 0
+//  * QTURN_ROBUST: robust buffer access, where out of bounds texelFetch
+//    gives 0 (only compiled if the context has robust access)
+//  * QTURN_BORDER: texture() with GL_CLAMP_TO_BORDER, doing 4
+//    interpolated calls to texture() in place of 8 calls to texelFetch()
+//    u_prev must have a sampler object with a zero border bound.
+// Another option would be adding a 1 pixel boundary to the buffers, but
+// everything else that uses the buffers would need to know about it.
+// The far taps of STENCIL_ORDER 4 are always bounds checked like
+// QTURN_TERNARY, since they also need to check for walls.
+
+#ifdef QTURN_IMAGE
+#define LOAD(coord) imageLoad(u_prev, (coord))
+#else
+#define LOAD(coord) texelFetch(u_prev, (coord), 0)
+#endif
+
+#if defined(QTURN_IMAGE) || defined(QTURN_ROBUST)
+#define FETCH_G(coord, cond) (LOAD(coord).g)
+#elif defined(QTURN_MULTIPLY)
+#define FETCH_G(coord, cond) (float(cond)*LOAD(coord).g)
+#else
+#define FETCH_G(coord, cond) ((cond)? LOAD(coord).g : 0.)
+#endif
 
-// Some other options to get 0 when out of bounds without needing to do
-// the bounds check myself (which may or may not be faster) would be:
-//  * image2D
-//  * robust buffer access
-//  * adding a 1 pixel boundary to the buffers
-//  * texture() with GL_CLAMP_TO_BORDER (could do 4 interpolated calls
-//    to texture() in place of 8 calls to texelFetch())
+#if STENCIL_ORDER == 4
+bool pinned(ivec2 coord) {
+    bool inside = all(greaterThanEqual(coord, ivec2(0))) && all(lessThan(coord, SIM_SIZE));
+    return !inside || texelFetch(u_wall, coord, 0).r > 0.5;
+}
+
+// The texel at pos + 2*d, reflected about pos + d if that's pinned (see
+// qturn.glsl)
+float farTap(ivec2 pos, ivec2 d, float g) {
+    if (pinned(pos + d)) return -g;
+    ivec2 coord = pos + 2 * d;
+    bool inside = all(greaterThanEqual(coord, ivec2(0))) && all(lessThan(coord, SIM_SIZE));
+    return inside? LOAD(coord).g : 0.;
+}
+#endif
 
 void main() {
     ivec2 pos = ivec2(gl_FragCoord.xy);
@@ -38,9 +83,22 @@ void main() {
         return;
     }
 
-    ivec2 edge = textureSize(u_prev, 0) - 1;
+    vec2 prevPsi = LOAD(pos).rg;  // redal and gremaginary components
+
+#ifdef QTURN_BORDER
+    // Sampling at a texel corner averages the 4 texels around it, so the
+    // 4 corners of this texel sum to prevPsi.g + neigh/2 + corn/4
+    vec2 size = vec2(SIM_SIZE);
+    float taps = (
+        texture(u_prev, (vec2(pos) + vec2(0., 0.)) / size).g +
+        texture(u_prev, (vec2(pos) + vec2(1., 0.)) / size).g +
+        texture(u_prev, (vec2(pos) + vec2(0., 1.)) / size).g +
+        texture(u_prev, (vec2(pos) + vec2(1., 1.)) / size).g
+    );
+    float stencil = 2. * (taps - prevPsi.g);
+#else
+    ivec2 edge = SIM_SIZE - 1;
     ivec2 flip = ivec2(pos.x, edge.y - pos.y);
-    vec2 prevPsi = texelFetch(u_prev, pos, 0).rg;  // redal and gremaginary components
 
     float neigh = (
         FETCH_G(pos + ivec2( 1,  0),    pos.x < edge.x) +
@@ -58,10 +116,22 @@ void main() {
         FETCH_G(pos + ivec2(-1,  1),    all(greaterThan(flip, ivec2(0))))
     );
 
+    float stencil = neigh + 0.5 * corn;
+#endif
+
+#if STENCIL_ORDER == 4
+    float g = prevPsi.g;
+    float stencil2 = (
+        farTap(pos, ivec2( 1,  0), g) + farTap(pos, ivec2( 0,  1), g) +
+        farTap(pos, ivec2(-1,  0), g) + farTap(pos, ivec2( 0, -1), g) +
+        0.5 * (
+            farTap(pos, ivec2( 1,  1), g) + farTap(pos, ivec2( 1, -1), g) +
+            farTap(pos, ivec2(-1, -1), g) + farTap(pos, ivec2(-1,  1), g)
+        )
+    );
+    stencil = COMBINE_STENCIL(stencil, stencil2);
+#endif
+
     float V = texelFetch(u_potential, pos, 0).r + texelFetch(u_dragPot, pos, 0).r;
-    // Laplacian of prevPsi.g is neigh/2 + corn/4 - 3*prevPsi.g
-    // 9-point stencil is needed to get Visscher's stability conditions.
-    // With 5-point stencil, stability region of dt is halved!
-    float H_g = V * prevPsi.g - (neigh + 0.5 * corn - 6. * prevPsi.g) / u_4m_dx2;
-    o_psi = vec2(-prevPsi.g, prevPsi.r + u_dt * H_g);
+    o_psi = qturnStep(prevPsi, stencil, V, u_dt);
 }
@@ -2,6 +2,10 @@
 
 out float o_potential;
 uniform vec2 u_simSize;
+// Time (in the same units as dt) at the middle of the turn the potential
+// is used for.  Courses which use u_time are animated, and re-evaluated
+// every turn, otherwise they're only evaluated once.
+uniform float u_time;
 
 #define PI 3.141592653589793
 float cosWell(vec2 pos) {
@@ -15,4 +19,7 @@ void main() {
     o_potential += 0.05*cosWell(
         (vec2(fromBack.x, abs(fromBack.y - 0.5)) - vec2(0.2, 0.3))/0.2
     );
+
+    // Oscillating well:
+    // o_potential += 0.05*sin(2.*PI*u_time/3000.)*cosWell((fromBack - vec2(0.8, 0.5))/0.15);
 }
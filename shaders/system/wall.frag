@@ -2,6 +2,7 @@
 
 out float o_wall;
 uniform vec2 u_simSize;
+uniform float u_time;  // See potential.frag
 
 void main() {
     bool wall = abs(gl_FragCoord.x - 0.4 * u_simSize.x) < 2.;
@@ -11,4 +12,9 @@ void main() {
 
     // Wall as SDF:
     // o_wall = 0.05*u_simSize.y - length(gl_FragCoord.xy - vec2(0.4, 0.5)*u_simSize);
+
+    // Rotating paddle:
+    // vec2 rel = gl_FragCoord.xy - vec2(0.6, 0.5)*u_simSize;
+    // vec2 along = vec2(cos(2.*3.14159265*u_time/6000.), sin(2.*3.14159265*u_time/6000.));
+    // o_wall = max(o_wall, float(abs(dot(rel, vec2(-along.y, along.x))) < 2. && abs(dot(rel, along)) < 0.15*u_simSize.y));
 }
@@ -1,14 +1,22 @@
 #version 430
 
 out vec2 v_pos;
-in vec2 a_uv;
+out vec4 v_color;
 
-uniform vec2 u_ndcPos;
-uniform vec2 u_ndcSize;
-uniform vec2 u_atlasPos;
-uniform vec2 u_atlasSize;
+// Per-instance attributes, see GlyphInstance in text.c
+in vec4 a_ndcRect;    // NDC position (xy) and size (zw)
+in vec4 a_atlasRect;  // Atlas position (xy) and size (zw)
+in vec4 a_color;
+
+// Same triangles as the quad in utils.c
+const vec2 corners[6] = vec2[](
+    vec2(0., 0.), vec2(1., 0.), vec2(1., 1.),
+    vec2(0., 0.), vec2(1., 1.), vec2(0., 1.)
+);
 
 void main() {
-    v_pos = u_atlasSize * a_uv + u_atlasPos;
-    gl_Position = vec4(u_ndcSize * a_uv + u_ndcPos, 0., 1.);
+    vec2 uv = corners[gl_VertexID];
+    v_pos = a_atlasRect.zw * uv + a_atlasRect.xy;
+    v_color = a_color;
+    gl_Position = vec4(a_ndcRect.zw * uv + a_ndcRect.xy, 0., 1.);
 }
@@ -5,10 +5,10 @@
 
 out vec4 o_color;
 in vec2 v_pos;
+in vec4 v_color;
 
 uniform sampler2D u_atlas;
 uniform float u_pxrange;
-uniform vec4 u_color;
 
 void main() {
     vec3 msdf = texture(u_atlas, v_pos).rgb;
@@ -19,6 +19,6 @@ void main() {
     float drPxRange = max(0.5*dot(unitRange, drTexSize), 1.);
 
     float pxSDF = drPxRange * (median - 0.5);
-    o_color = u_color;
+    o_color = v_color;
     o_color.a *= clamp(pxSDF+0.5, 0., 1.);
 }
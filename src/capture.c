@@ -0,0 +1,389 @@
+#include "capture.h"
+#include <GL/glew.h>
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "game.h"
+#include "resources.h"
+
+// Readbacks which can be in flight on the GPU per stream
+#define CAPTURE_PBOS 3
+// Frames which can be waiting for the writer thread per stream
+#define CAPTURE_BUFFERS 8
+// Y4M needs a fixed frame rate, but frames are captured as they're
+// presented, so this is only nominal.
+#define CAPTURE_FPS 60
+// How long finishCapture waits for a readback before giving up on it
+#define CAPTURE_FINISH_TIMEOUT_NS 1000000000ull
+
+typedef enum {
+    CAPTURE_WINDOW,
+    CAPTURE_PSI,
+    CAPTURE_PDF,
+    NUM_CAPTURE_STREAMS
+} CaptureSource;
+
+typedef struct {
+    const char *envVar;
+    const char *name;
+    char *path;
+    FILE *file;
+    int y4m;
+    GLsizei width;
+    GLsizei height;
+    GLenum format;
+    GLenum type;
+    size_t frameSize;
+
+    // Readbacks from head to tail are in flight
+    GLuint pbos[CAPTURE_PBOS];
+    GLsync fences[CAPTURE_PBOS];
+    unsigned head, tail;
+    unsigned long dropped;
+
+    // Free frame buffers, protected by writerMutex
+    void *buffers[CAPTURE_BUFFERS];
+    int numFree;
+
+    // Only used by the writer thread
+    unsigned char *planes;  // Y4M conversion scratch
+    unsigned long written;
+    int failed;
+} CaptureStream;
+
+typedef struct {
+    CaptureStream *stream;
+    void *data;
+} CaptureFrame;
+
+int g_capturing = 0;
+static CaptureStream streams[NUM_CAPTURE_STREAMS] = {
+    [CAPTURE_WINDOW] = {.envVar = "PICOPUTT_CAPTURE", .name = "window"},
+    [CAPTURE_PSI] = {.envVar = "PICOPUTT_CAPTURE_PSI", .name = "psi"},
+    [CAPTURE_PDF] = {.envVar = "PICOPUTT_CAPTURE_PDF", .name = "pdf"},
+};
+
+// Used to read back textures which don't have an FBO of our own
+static GLuint readFBO = 0;
+
+#define WRITE_QUEUE_SIZE (NUM_CAPTURE_STREAMS * CAPTURE_BUFFERS)
+static SDL_Thread *writer = NULL;
+static SDL_mutex *writerMutex = NULL;
+static SDL_cond *queuedCond = NULL;  // Frame queued, or writerQuit set
+static SDL_cond *freedCond = NULL;   // Frame buffer freed
+// Protected by writerMutex.  There are never more frames queued than
+// there are frame buffers, so the queue can't overflow.
+static CaptureFrame writeQueue[WRITE_QUEUE_SIZE];
+static unsigned writeHead = 0;
+static unsigned writeTail = 0;
+static int writerQuit = 0;
+
+
+// Converts bottom-up RGBA to top-down planar BT.601 (limited range) YUV
+static void rgbaToYUV444(CaptureStream *stream, const unsigned char *rgba) {
+    size_t planeSize = (size_t)stream->width * (size_t)stream->height;
+    unsigned char *yPlane = stream->planes;
+    unsigned char *uPlane = yPlane + planeSize;
+    unsigned char *vPlane = uPlane + planeSize;
+
+    for (GLsizei y = 0; y < stream->height; y++) {
+        const unsigned char *row = rgba + 4 * (size_t)(stream->height - 1 - y) * (size_t)stream->width;
+        size_t out = (size_t)y * (size_t)stream->width;
+        for (GLsizei x = 0; x < stream->width; x++, out++) {
+            int r = row[4*x], g = row[4*x + 1], b = row[4*x + 2];
+            yPlane[out] = (unsigned char) (((66*r + 129*g + 25*b + 128) >> 8) + 16);
+            uPlane[out] = (unsigned char) (((-38*r - 74*g + 112*b + 128) >> 8) + 128);
+            vPlane[out] = (unsigned char) (((112*r - 94*g - 18*b + 128) >> 8) + 128);
+        }
+    }
+}
+
+static void writeFrame(CaptureStream *stream, const void *data) {
+    if (stream->failed) return;
+
+    int ok;
+    if (stream->y4m) {
+        rgbaToYUV444(stream, data);
+        size_t size = 3 * (size_t)stream->width * (size_t)stream->height;
+        ok = fputs("FRAME\n", stream->file) >= 0 &&
+            fwrite(stream->planes, 1, size, stream->file) == size;
+    } else {
+        // Fields are written in sim coordinates (first row is y = 0)
+        ok = fwrite(data, 1, stream->frameSize, stream->file) == stream->frameSize;
+    }
+
+    if (!ok) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to write capture to %s, stopping", stream->path);
+        stream->failed = 1;
+        return;
+    }
+
+    stream->written++;
+}
+
+static int writerMain(void *data) {
+    (void) data;
+    SDL_LockMutex(writerMutex);
+    while (1) {
+        if (writeHead == writeTail) {
+            if (writerQuit) break;
+            SDL_CondWait(queuedCond, writerMutex);
+            continue;
+        }
+
+        CaptureFrame frame = writeQueue[writeHead++ % WRITE_QUEUE_SIZE];
+        SDL_UnlockMutex(writerMutex);
+        writeFrame(frame.stream, frame.data);
+        SDL_LockMutex(writerMutex);
+
+        frame.stream->buffers[frame.stream->numFree++] = frame.data;
+        SDL_CondSignal(freedCond);
+    }
+    SDL_UnlockMutex(writerMutex);
+    return 0;
+}
+
+
+static void closeStream(CaptureStream *stream) {
+    if (stream->pbos[0]) glDeleteBuffers(CAPTURE_PBOS, stream->pbos);
+    for (int i = 0; i < stream->numFree; i++) free(stream->buffers[i]);
+    free(stream->planes);
+    if (stream->file) fclose(stream->file);
+    SDL_free(stream->path);
+
+    CaptureStream reset = {.envVar = stream->envVar, .name = stream->name};
+    *stream = reset;
+}
+
+static int openStream(CaptureStream *stream, const char *path) {
+    if ((stream->path = SDL_strdup(path)) == NULL) return 1;
+    if ((stream->file = fopen(path, "wb")) == NULL) {
+        SDL_SetError("Couldn't open %s", path);
+        return 1;
+    }
+
+    size_t pixelSize;
+    if (stream == &streams[CAPTURE_WINDOW]) {
+        stream->y4m = 1;
+        stream->width = g_drWidth;
+        stream->height = g_drHeight;
+        stream->format = GL_RGBA;
+        stream->type = GL_UNSIGNED_BYTE;
+        pixelSize = 4;
+    } else {
+        stream->width = g_simBuffers[0].width;
+        stream->height = g_simBuffers[0].height;
+        stream->format = stream == &streams[CAPTURE_PSI]? GL_RG : GL_RED;
+        stream->type = GL_FLOAT;
+        pixelSize = stream == &streams[CAPTURE_PSI]? 2 * sizeof(float) : sizeof(float);
+    }
+
+    stream->frameSize = pixelSize * (size_t)stream->width * (size_t)stream->height;
+    for (int i = 0; i < CAPTURE_BUFFERS; i++) {
+        if ((stream->buffers[i] = malloc(stream->frameSize)) == NULL) {
+            SDL_OutOfMemory();
+            return 1;
+        }
+        stream->numFree++;
+    }
+
+    if (stream->y4m) {
+        if ((stream->planes = malloc(3 * (size_t)stream->width * (size_t)stream->height)) == NULL) {
+            SDL_OutOfMemory();
+            return 1;
+        }
+
+        int written = fprintf(
+            stream->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+            stream->width, stream->height, CAPTURE_FPS
+        );
+        if (written < 0) {
+            SDL_SetError("Couldn't write Y4M header to %s", stream->path);
+            return 1;
+        }
+    }
+
+    glGenBuffers(CAPTURE_PBOS, stream->pbos);
+    for (int i = 0; i < CAPTURE_PBOS; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, stream->pbos[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)stream->frameSize, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    return 0;
+}
+
+void initCapture() {
+    for (int i = 0; i < NUM_CAPTURE_STREAMS; i++) {
+        const char *path = getenv(streams[i].envVar);
+        if (path == NULL || path[0] == '\0') continue;
+
+        if (openStream(&streams[i], path)) {
+            SDL_LogError(
+                SDL_LOG_CATEGORY_APPLICATION, "Not capturing %s: %s",
+                streams[i].name, SDL_GetError()
+            );
+            closeStream(&streams[i]);
+            continue;
+        }
+
+        SDL_Log(
+            "Capturing %s (%dx%d %s) to %s set by $%s",
+            streams[i].name, streams[i].width, streams[i].height,
+            streams[i].y4m? "Y4M" : streams[i].format == GL_RG? "raw float32 RG" : "raw float32 R",
+            streams[i].path, streams[i].envVar
+        );
+        g_capturing = 1;
+    }
+
+    if (!g_capturing) return;
+    glGenFramebuffers(1, &readFBO);
+    writerMutex = SDL_CreateMutex();
+    queuedCond = SDL_CreateCond();
+    freedCond = SDL_CreateCond();
+    writer = SDL_CreateThread(writerMain, "capture writer", NULL);
+    if (writer == NULL) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to start capture writer: %s", SDL_GetError());
+        finishCapture();
+    }
+}
+
+
+// Hands off the readbacks which are done to the writer thread.  If wait
+// is set, this waits for all of them (and for free frame buffers).
+static void collectReadbacks(CaptureStream *stream, int wait) {
+    for (; stream->head != stream->tail; stream->head++) {
+        GLsync fence = stream->fences[stream->head % CAPTURE_PBOS];
+        GLenum status = glClientWaitSync(
+            fence, wait? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+            wait? CAPTURE_FINISH_TIMEOUT_NS : 0
+        );
+        if (status == GL_TIMEOUT_EXPIRED && !wait) break;
+        glDeleteSync(fence);
+
+        void *data = NULL;
+        SDL_LockMutex(writerMutex);
+        while (wait && stream->numFree == 0) SDL_CondWait(freedCond, writerMutex);
+        if (stream->numFree > 0) data = stream->buffers[--stream->numFree];
+        SDL_UnlockMutex(writerMutex);
+
+        if (data == NULL || status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) {
+            // The writer is behind (or the readback was lost)
+            stream->dropped++;
+            if (data == NULL) continue;
+
+            SDL_LockMutex(writerMutex);
+            stream->buffers[stream->numFree++] = data;
+            SDL_UnlockMutex(writerMutex);
+            continue;
+        }
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, stream->pbos[stream->head % CAPTURE_PBOS]);
+        const void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)stream->frameSize, GL_MAP_READ_BIT);
+        if (mapped) SDL_memcpy(data, mapped, stream->frameSize);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        SDL_LockMutex(writerMutex);
+        if (mapped) {
+            writeQueue[writeTail++ % WRITE_QUEUE_SIZE] = (CaptureFrame) {.stream = stream, .data = data};
+            SDL_CondSignal(queuedCond);
+        } else {
+            stream->dropped++;
+            stream->buffers[stream->numFree++] = data;
+        }
+        SDL_UnlockMutex(writerMutex);
+    }
+}
+
+// Starts reading back the window (if texture is 0) or a texture into
+// the next PBO.
+static void startReadback(CaptureStream *stream, GLuint texture) {
+    if (stream->tail - stream->head == CAPTURE_PBOS) {
+        stream->dropped++;
+        return;
+    }
+
+    if (stream == &streams[CAPTURE_WINDOW]) {
+        // Y4M can't change size mid-stream
+        if (g_drWidth != stream->width || g_drHeight != stream->height) {
+            stream->dropped++;
+            return;
+        }
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glReadBuffer(GL_BACK);
+    } else {
+        if (texture == 0) return;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, readFBO);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+    }
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_PACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_PACK_SKIP_ROWS, 0);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, stream->pbos[stream->tail % CAPTURE_PBOS]);
+    glReadPixels(0, 0, stream->width, stream->height, stream->format, stream->type, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    stream->fences[stream->tail++ % CAPTURE_PBOS] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void captureFrame(GLuint psi, GLuint pdf) {
+    if (!g_capturing) return;
+    GLuint textures[NUM_CAPTURE_STREAMS] = {[CAPTURE_PSI] = psi, [CAPTURE_PDF] = pdf};
+    for (int i = 0; i < NUM_CAPTURE_STREAMS; i++) {
+        if (streams[i].file == NULL) continue;
+        collectReadbacks(&streams[i], 0);
+        startReadback(&streams[i], textures[i]);
+    }
+}
+
+
+void finishCapture() {
+    if (!g_capturing) return;
+    g_capturing = 0;
+
+    for (int i = 0; i < NUM_CAPTURE_STREAMS; i++) {
+        if (streams[i].file == NULL) continue;
+        if (writer != NULL) collectReadbacks(&streams[i], 1);
+    }
+
+    if (writer != NULL) {
+        SDL_LockMutex(writerMutex);
+        writerQuit = 1;
+        SDL_CondSignal(queuedCond);
+        SDL_UnlockMutex(writerMutex);
+        SDL_WaitThread(writer, NULL);
+        writer = NULL;
+    }
+
+    for (int i = 0; i < NUM_CAPTURE_STREAMS; i++) {
+        if (streams[i].file == NULL) continue;
+
+        // Readbacks which were never collected (if the writer failed)
+        for (; streams[i].head != streams[i].tail; streams[i].head++) {
+            glDeleteSync(streams[i].fences[streams[i].head % CAPTURE_PBOS]);
+            streams[i].dropped++;
+        }
+
+        SDL_Log(
+            "Captured %lu %s frames to %s, dropped %lu",
+            streams[i].written, streams[i].name, streams[i].path, streams[i].dropped
+        );
+        closeStream(&streams[i]);
+    }
+
+    glDeleteFramebuffers(1, &readFBO);
+    readFBO = 0;
+    SDL_DestroyCond(freedCond);
+    SDL_DestroyCond(queuedCond);
+    SDL_DestroyMutex(writerMutex);
+    writerMutex = NULL;
+    writerQuit = 0;
+    writeHead = writeTail = 0;
+}
@@ -0,0 +1,29 @@
+#ifndef PICOPUTT_CAPTURE_H
+#define PICOPUTT_CAPTURE_H
+#include <GL/glew.h>
+#include <SDL.h>
+
+// Captures the window and/or simulation fields to disk without stalling
+// the render loop.  Each stream is enabled by setting an environment
+// variable to the path of the file to write:
+//  $PICOPUTT_CAPTURE      Y4M video (4:4:4) of the window
+//  $PICOPUTT_CAPTURE_PSI  raw float32 RG frames of psi (sim size)
+//  $PICOPUTT_CAPTURE_PDF  raw float32 R frames of |psi|^2 (sim size)
+//
+// Frames are read back asynchronously into a ring of PBOs, collected
+// once their fences are signaled, and written out by a background
+// thread.  If the GPU or the disk falls behind, frames are dropped (and
+// counted) rather than waited for.
+
+extern int g_capturing;
+
+// Must be called with the GL context current, after the resources are
+// loaded.
+void initCapture();
+// Called once per presented frame, after everything has been drawn to
+// the default framebuffer.
+void captureFrame(GLuint psi, GLuint pdf);
+// Waits for any frames still in flight and closes the files.  Must be
+// called while the GL context still exists.
+void finishCapture();
+#endif //PICOPUTT_CAPTURE_H
@@ -0,0 +1,429 @@
+#include "checkpoint.h"
+#include <GL/glew.h>
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "game.h"
+#include "utils.h"
+
+#define SAVE_QUEUE_SIZE 4
+
+// Channels of each plane (see checkpoint.h for the order)
+static const int planeChannels[CHECKPOINT_PLANES] = {2, 2, 1};
+
+typedef struct {
+    char *path;
+    CheckpointHeader header;
+    GLuint pbo;
+    GLsync fence;  // Signaled once the readback into pbo is done
+} SaveJob;
+
+static SDL_Thread *worker = NULL;
+static SDL_GLContext workerContext = NULL;
+static SDL_mutex *workerMutex = NULL;
+static SDL_cond *queuedCond = NULL;  // Job queued, or workerQuit set
+static SDL_cond *doneCond = NULL;    // Job done, or workerStarted changed
+
+// Protected by workerMutex.  Jobs stay in the queue until they're done.
+static SaveJob saveQueue[SAVE_QUEUE_SIZE];
+static unsigned saveHead = 0;
+static unsigned saveTail = 0;
+static int workerQuit = 0;
+static int workerStarted = 0;  // 1 once the worker is set up, -1 if setup failed
+
+
+static size_t planeSize(int plane, GLsizei width, GLsizei height) {
+    return (size_t)planeChannels[plane] * sizeof(float) * (size_t)width * (size_t)height;
+}
+
+// Worst case size of packBits output
+static size_t packBitsBound(size_t size) {
+    return size + size / 128 + 1;
+}
+
+// PackBits run length encoding: a control byte c < 128 is followed by
+// c + 1 literal bytes, and c > 128 by a byte to repeat 257 - c times.
+static size_t packBits(const unsigned char *src, size_t size, unsigned char *dst) {
+    size_t in = 0;
+    size_t out = 0;
+    while (in < size) {
+        size_t run = 1;
+        while (in + run < size && run < 128 && src[in + run] == src[in]) run++;
+        if (run >= 2) {
+            dst[out++] = (unsigned char)(257 - run);
+            dst[out++] = src[in];
+            in += run;
+            continue;
+        }
+
+        // Literals continue until the next run of at least 3
+        size_t lit = 1;
+        while (in + lit < size && lit < 128) {
+            const unsigned char *next = src + in + lit;
+            if (in + lit + 2 < size && next[0] == next[1] && next[0] == next[2]) break;
+            lit++;
+        }
+
+        dst[out++] = (unsigned char)(lit - 1);
+        SDL_memcpy(dst + out, src + in, lit);
+        out += lit;
+        in += lit;
+    }
+
+    return out;
+}
+
+static int unpackBits(const unsigned char *src, size_t size, unsigned char *dst, size_t dstSize) {
+    size_t in = 0;
+    size_t out = 0;
+    while (in < size) {
+        unsigned c = src[in++];
+        if (c < 128) {
+            size_t lit = c + 1;
+            if (SET_ERR_IF_TRUE(in + lit > size || out + lit > dstSize)) return 1;
+            SDL_memcpy(dst + out, src + in, lit);
+            in += lit;
+            out += lit;
+        } else if (c > 128) {
+            size_t run = 257 - c;
+            if (SET_ERR_IF_TRUE(in >= size || out + run > dstSize)) return 1;
+            SDL_memset(dst + out, src[in++], run);
+            out += run;
+        }
+    }
+
+    if (SET_ERR_IF_TRUE(out != dstSize)) return 1;
+    return 0;
+}
+
+// Moves byte k of every float into the k-th quarter of dst
+static void shuffleBytes(const unsigned char *src, size_t size, unsigned char *dst) {
+    size_t count = size / sizeof(float);
+    for (size_t i = 0; i < count; i++) {
+        for (size_t k = 0; k < sizeof(float); k++) {
+            dst[k * count + i] = src[sizeof(float) * i + k];
+        }
+    }
+}
+
+static void unshuffleBytes(const unsigned char *src, size_t size, unsigned char *dst) {
+    size_t count = size / sizeof(float);
+    for (size_t i = 0; i < count; i++) {
+        for (size_t k = 0; k < sizeof(float); k++) {
+            dst[sizeof(float) * i + k] = src[k * count + i];
+        }
+    }
+}
+
+
+// Runs on the worker thread
+static int writeCheckpoint(SaveJob *job) {
+    CheckpointHeader *header = &job->header;
+    GLsizei width = (GLsizei)header->width;
+    GLsizei height = (GLsizei)header->height;
+    size_t totalSize = 0;
+    for (int i = 0; i < CHECKPOINT_PLANES; i++) totalSize += planeSize(i, width, height);
+
+    // The saving thread flushed after the fence, so it will be signaled
+    glClientWaitSync(job->fence, 0, GL_TIMEOUT_IGNORED);
+    unsigned char *data = malloc(totalSize);
+    if (data != NULL) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, job->pbo);
+        const void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)totalSize, GL_MAP_READ_BIT);
+        if (mapped != NULL) SDL_memcpy(data, mapped, totalSize);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (SET_ERR_IF_TRUE(mapped == NULL)) {
+            free(data);
+            data = NULL;
+        }
+    } else {
+        SDL_OutOfMemory();
+    }
+
+    glDeleteSync(job->fence);
+    glDeleteBuffers(1, &job->pbo);
+    if (data == NULL) return 1;
+
+    const unsigned char *encoded = data;
+    unsigned char *packed = NULL;
+    if (header->compression == CHECKPOINT_SHUFFLE_RLE) {
+        unsigned char *shuffled = malloc(totalSize);
+        packed = malloc(packBitsBound(totalSize) + CHECKPOINT_PLANES);
+        if (shuffled == NULL || packed == NULL) {
+            free(shuffled);
+            free(packed);
+            free(data);
+            SDL_OutOfMemory();
+            return 1;
+        }
+
+        size_t in = 0;
+        size_t out = 0;
+        for (int i = 0; i < CHECKPOINT_PLANES; i++) {
+            size_t size = planeSize(i, width, height);
+            shuffleBytes(data + in, size, shuffled + in);
+            header->planeSizes[i] = (Uint32)packBits(shuffled + in, size, packed + out);
+            in += size;
+            out += header->planeSizes[i];
+        }
+
+        free(shuffled);
+        encoded = packed;
+    } else {
+        for (int i = 0; i < CHECKPOINT_PLANES; i++) header->planeSizes[i] = (Uint32)planeSize(i, width, height);
+    }
+
+    size_t encodedSize = 0;
+    for (int i = 0; i < CHECKPOINT_PLANES; i++) encodedSize += header->planeSizes[i];
+
+    FILE *file = fopen(job->path, "wb");
+    int err = file == NULL;
+    if (err) SDL_SetError("Couldn't open %s", job->path);
+    else {
+        err = SET_ERR_IF_TRUE(fwrite(header, sizeof *header, 1, file) != 1) ||
+            SET_ERR_IF_TRUE(fwrite(encoded, 1, encodedSize, file) != encodedSize);
+        err = SET_ERR_IF_TRUE(fclose(file) != 0) || err;
+    }
+
+    free(packed);
+    free(data);
+    if (!err) {
+        SDL_Log(
+            "Saved checkpoint to %s (%zu bytes, %.1f%% of raw)", job->path,
+            sizeof *header + encodedSize, 100. * (double)encodedSize / (double)totalSize
+        );
+    }
+
+    return err;
+}
+
+static int workerMain(void *data) {
+    (void) data;
+    int err = SDL_GL_MakeCurrent(g_window, workerContext) != 0;
+
+    SDL_LockMutex(workerMutex);
+    workerStarted = err? -1 : 1;
+    SDL_CondBroadcast(doneCond);
+    while (!err) {
+        if (saveHead == saveTail) {
+            if (workerQuit) break;
+            SDL_CondWait(queuedCond, workerMutex);
+            continue;
+        }
+
+        SaveJob *job = &saveQueue[saveHead % SAVE_QUEUE_SIZE];
+        SDL_UnlockMutex(workerMutex);
+        if (writeCheckpoint(job)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to save checkpoint to %s: %s", job->path, SDL_GetError());
+        }
+        SDL_free(job->path);
+        SDL_LockMutex(workerMutex);
+
+        saveHead++;
+        SDL_CondBroadcast(doneCond);
+    }
+    SDL_UnlockMutex(workerMutex);
+
+    if (err) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Checkpoint worker failed to start: %s", SDL_GetError());
+        return err;
+    }
+
+    SDL_GL_MakeCurrent(g_window, NULL);
+    return 0;
+}
+
+
+void initCheckpoints() {
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+    workerContext = SDL_GL_CreateContext(g_window);
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+    // Creating a context makes it current
+    SDL_GL_MakeCurrent(g_window, g_GLContext);
+    if (workerContext == NULL) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create checkpoint context, saving is disabled: %s", SDL_GetError());
+        return;
+    }
+
+    workerMutex = SDL_CreateMutex();
+    queuedCond = SDL_CreateCond();
+    doneCond = SDL_CreateCond();
+    saveHead = saveTail = 0;
+    workerQuit = workerStarted = 0;
+    worker = SDL_CreateThread(workerMain, "checkpoint", NULL);
+
+    int started = worker != NULL;
+    if (started) {
+        SDL_LockMutex(workerMutex);
+        while (workerStarted == 0) SDL_CondWait(doneCond, workerMutex);
+        started = workerStarted == 1;
+        SDL_UnlockMutex(workerMutex);
+    }
+
+    if (!started) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Couldn't start checkpoint worker, saving is disabled");
+        finishCheckpoints();
+    }
+}
+
+int saveCheckpoint(const char *path, CheckpointHeader header, TexturedFrameBuffer *const planes[CHECKPOINT_PLANES]) {
+    if (SET_ERR_IF_TRUE(worker == NULL)) return 1;
+
+    GLsizei width = planes[0]->width;
+    GLsizei height = planes[0]->height;
+    size_t totalSize = 0;
+    for (int i = 0; i < CHECKPOINT_PLANES; i++) {
+        if (SET_ERR_IF_TRUE(planes[i]->width != width || planes[i]->height != height)) return 1;
+        totalSize += planeSize(i, width, height);
+    }
+
+    SDL_LockMutex(workerMutex);
+    int full = saveTail - saveHead == SAVE_QUEUE_SIZE;
+    SDL_UnlockMutex(workerMutex);
+    if (full) {
+        SDL_SetError("Too many checkpoint saves in progress");
+        return 1;
+    }
+
+    SDL_memcpy(header.magic, CHECKPOINT_MAGIC, sizeof header.magic);
+    header.version = CHECKPOINT_VERSION;
+    header.width = (Uint32)width;
+    header.height = (Uint32)height;
+
+    SaveJob job = {.header = header};
+    if (SET_ERR_IF_TRUE((job.path = SDL_strdup(path)) == NULL)) return 1;
+
+    glGenBuffers(1, &job.pbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, job.pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)totalSize, NULL, GL_STREAM_READ);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    size_t offset = 0;
+    for (int i = 0; i < CHECKPOINT_PLANES; i++) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, planes[i]->fbo);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glReadPixels(
+            0, 0, width, height, planeChannels[i] == 2? GL_RG : GL_RED,
+            GL_FLOAT, (void *)(uintptr_t)offset
+        );
+        offset += planeSize(i, width, height);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    job.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // The worker waits on the fence from its own context, so it must
+    // actually be submitted.
+    glFlush();
+
+    SDL_LockMutex(workerMutex);
+    saveQueue[saveTail++ % SAVE_QUEUE_SIZE] = job;
+    SDL_CondSignal(queuedCond);
+    SDL_UnlockMutex(workerMutex);
+    return 0;
+}
+
+
+int readCheckpoint(const char *path, GLsizei width, GLsizei height, CheckpointHeader *header, void **planeData) {
+    size_t size;
+    const unsigned char *data = mapFile(path, &size);
+    if (data == NULL) return 1;
+
+    if (SET_ERR_IF_TRUE(size < sizeof *header)) {
+        unmapFile(data, size);
+        return 1;
+    }
+
+    SDL_memcpy(header, data, sizeof *header);
+    if (SET_ERR_IF_TRUE(SDL_memcmp(header->magic, CHECKPOINT_MAGIC, 4) != 0) ||
+        SET_ERR_IF_TRUE(header->version != CHECKPOINT_VERSION) ||
+        SET_ERR_IF_TRUE(header->width != (Uint32)width || header->height != (Uint32)height) ||
+        SET_ERR_IF_TRUE(header->compression > CHECKPOINT_SHUFFLE_RLE) ||
+        SET_ERR_IF_TRUE(header->curBuf != 0 && header->curBuf != 1)) {
+        unmapFile(data, size);
+        return 1;
+    }
+
+    size_t totalSize = 0;
+    size_t encodedSize = 0;
+    for (int i = 0; i < CHECKPOINT_PLANES; i++) {
+        totalSize += planeSize(i, width, height);
+        encodedSize += header->planeSizes[i];
+        if (header->compression == CHECKPOINT_RAW &&
+            SET_ERR_IF_TRUE(header->planeSizes[i] != planeSize(i, width, height))) {
+            unmapFile(data, size);
+            return 1;
+        }
+    }
+
+    unsigned char *result = malloc(totalSize);
+    unsigned char *shuffled = header->compression == CHECKPOINT_RAW? NULL : malloc(totalSize);
+    if (SET_ERR_IF_TRUE(size != sizeof *header + encodedSize) ||
+        SET_ERR_IF_TRUE(result == NULL || (header->compression != CHECKPOINT_RAW && shuffled == NULL))) {
+        free(result);
+        free(shuffled);
+        unmapFile(data, size);
+        return 1;
+    }
+
+    const unsigned char *in = data + sizeof *header;
+    size_t out = 0;
+    for (int i = 0; i < CHECKPOINT_PLANES; i++) {
+        size_t planeBytes = planeSize(i, width, height);
+        if (header->compression == CHECKPOINT_RAW) {
+            SDL_memcpy(result + out, in, planeBytes);
+        } else if (unpackBits(in, header->planeSizes[i], shuffled + out, planeBytes)) {
+            free(result);
+            free(shuffled);
+            unmapFile(data, size);
+            return 1;
+        } else {
+            unshuffleBytes(shuffled + out, planeBytes, result + out);
+        }
+
+        in += header->planeSizes[i];
+        out += planeBytes;
+    }
+
+    free(shuffled);
+    unmapFile(data, size);
+    *planeData = result;
+    return 0;
+}
+
+void uploadCheckpoint(void *planeData, TexturedFrameBuffer *const planes[CHECKPOINT_PLANES]) {
+    const unsigned char *data = planeData;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    for (int i = 0; i < CHECKPOINT_PLANES; i++) {
+        glBindTexture(GL_TEXTURE_2D, planes[i]->texture);
+        glTexSubImage2D(
+            GL_TEXTURE_2D, 0, 0, 0, planes[i]->width, planes[i]->height,
+            planeChannels[i] == 2? GL_RG : GL_RED, GL_FLOAT, data
+        );
+        data += planeSize(i, planes[i]->width, planes[i]->height);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    free(planeData);
+}
+
+
+void finishCheckpoints() {
+    if (worker != NULL) {
+        SDL_LockMutex(workerMutex);
+        workerQuit = 1;
+        SDL_CondSignal(queuedCond);
+        SDL_UnlockMutex(workerMutex);
+        SDL_WaitThread(worker, NULL);
+        worker = NULL;
+    }
+
+    if (workerContext != NULL) SDL_GL_DeleteContext(workerContext);
+    workerContext = NULL;
+    SDL_DestroyCond(doneCond);
+    SDL_DestroyCond(queuedCond);
+    SDL_DestroyMutex(workerMutex);
+    doneCond = queuedCond = NULL;
+    workerMutex = NULL;
+}
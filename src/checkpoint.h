@@ -0,0 +1,80 @@
+#ifndef PICOPUTT_CHECKPOINT_H
+#define PICOPUTT_CHECKPOINT_H
+#include <GL/glew.h>
+#include <SDL.h>
+#include "framebuffers.h"
+
+// Checkpoint files store the full simulation state so that a game can be
+// resumed exactly (eg for benchmarks or bug reports).  A checkpoint is a
+// CheckpointHeader followed by CHECKPOINT_PLANES float planes at the sim
+// size, in this order:
+//  g_simBuffers[0]  RG32F
+//  g_simBuffers[1]  RG32F
+//  g_dragPot        R32F
+// Both sim buffers are needed since psi is staggered (curBuf says which
+// is current).  All values are in native byte order.
+//
+// With CHECKPOINT_SHUFFLE_RLE, each plane is stored with its float bytes
+// shuffled into 4 byte planes (so that the exponents line up), and then
+// PackBits run length encoded, which is lossless and shrinks the large
+// flat regions of the wavefunction a lot.
+//
+// Saves are asynchronous: saveCheckpoint only starts reading the planes
+// back into a PBO, and a worker thread (with its own GL context) maps it
+// once it's ready, then compresses and writes the file.
+
+#define CHECKPOINT_MAGIC "PPCK"
+#define CHECKPOINT_VERSION 3
+#define CHECKPOINT_PLANES 3
+// Must match MAX_MEASUREMENTS in loop.c
+#define CHECKPOINT_MAX_MEASUREMENTS 100
+
+typedef enum {
+    CHECKPOINT_RAW,
+    CHECKPOINT_SHUFFLE_RLE
+} CheckpointCompression;
+
+typedef struct {
+    char magic[4];
+    Uint32 version;
+    Uint32 width;
+    Uint32 height;
+    Uint32 compression;
+    Uint32 planeSizes[CHECKPOINT_PLANES];  // Stored size of each plane
+
+    // Game state
+    Sint32 curBuf;
+    float courseTime;
+    Sint32 score;
+    Sint32 gameWon;
+    float initialSigma;
+    float holeX;
+    float holeY;
+    float holeSigma;
+    // The dots of the last measurement, in sim grid units
+    Uint32 activeMeasurements;
+    Sint32 measurements[CHECKPOINT_MAX_MEASUREMENTS][2];
+
+    // Simulation parameters the state was computed with
+    float dt;
+    float dx;
+    float mass;
+    float drag;
+} CheckpointHeader;
+
+// Must be called on the main thread with the GL context current.  If
+// the worker can't be started, checkpoints can still be loaded, but not
+// saved.
+void initCheckpoints();
+// Starts saving the planes to path.  Must be called on the thread which
+// owns the planes' FBOs.  The caller fills in the game state, parameters
+// and compression of the header, and the rest is filled in here.
+int saveCheckpoint(const char *path, CheckpointHeader header, TexturedFrameBuffer *const planes[CHECKPOINT_PLANES]);
+// Reads and decompresses a checkpoint for a sim of the given size.  On
+// success, *planeData must be freed by uploadCheckpoint.
+int readCheckpoint(const char *path, GLsizei width, GLsizei height, CheckpointHeader *header, void **planeData);
+// Uploads (and frees) the plane data from readCheckpoint.
+void uploadCheckpoint(void *planeData, TexturedFrameBuffer *const planes[CHECKPOINT_PLANES]);
+// Waits for saves in progress.  Must be called on the main thread.
+void finishCheckpoints();
+#endif //PICOPUTT_CHECKPOINT_H
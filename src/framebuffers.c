@@ -3,6 +3,7 @@
 #include <SDL.h>
 #include <assert.h>
 #include "utils.h"
+#include "trace.h"
 
 // If uninitialized is 0, it is 0-initialized.  Otherwise, it is uninitialized.
 void emptyTexImage2D(GLenum target, GLint level, GLsizei width, GLsizei height, GLint internalformat, int uninitialized) {
@@ -72,6 +73,7 @@ void emptyTexImage2D(GLenum target, GLint level, GLsizei width, GLsizei height,
 //  Side note: even though I will have many FBOs with same textures of
 //  same width/height, I think there should only ever be one FBO per TFB
 int initTexturedFrameBuffer(TexturedFrameBuffer *tfb, GLsizei width, GLsizei height, GLint internalformat, int uninitialized) {
+    TRACE_BEGIN("initTexturedFrameBuffer");
     glGenTextures(1, &tfb->texture);
     glBindTexture(GL_TEXTURE_2D, tfb->texture);
 
@@ -117,6 +119,7 @@ int initTexturedFrameBuffer(TexturedFrameBuffer *tfb, GLsizei width, GLsizei hei
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glBindTexture(GL_TEXTURE_2D, 0);
+    TRACE_END();
     return err;
 }
 
@@ -130,6 +133,29 @@ void deleteTexturedFrameBuffer(TexturedFrameBuffer *tfb) {
 }
 
 
+void releaseFrameBuffer(TexturedFrameBuffer *tfb) {
+    glDeleteFramebuffers(1, &tfb->fbo);
+    tfb->fbo = 0;
+}
+
+int recreateFrameBuffer(TexturedFrameBuffer *tfb) {
+    glGenFramebuffers(1, &tfb->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, tfb->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tfb->texture, 0);
+
+    int err = 0;
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        SDL_SetError("Incomplete framebuffer, status code: 0x%X", status);
+        err = 1;
+        releaseFrameBuffer(tfb);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return err;
+}
+
+
 int initCeilPyramidBuffer(PaddedPyramidBuffer *pbuf, GLsizei width, GLsizei height, GLint internalformat, int uninitialized) {
     PaddedPyramidLayer layers[32];  // GLsizei is specified to be 32 bits
     size_t numLayers = 0;
@@ -201,6 +227,55 @@ int initRoofPyramidBuffer(PyramidBuffer *pbuf, GLsizei width, GLsizei height, GL
     return 0;
 }
 
+int initArrayTexture(TexturedFrameBuffer *tfb, GLsizei width, GLsizei height, GLsizei lanes, GLint internalformat) {
+    if (SET_ERR_IF_TRUE(width < 1 || height < 1 || lanes < 1)) return 1;
+    glGenTextures(1, &tfb->texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, tfb->texture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, internalformat, width, height, lanes);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    tfb->fbo = 0;
+    tfb->width = width;
+    tfb->height = height;
+
+    GLenum glErr = glGetError();
+    if (glErr != GL_NO_ERROR) {
+        SDL_SetError("Couldn't allocate %dx%dx%d array texture: %s", width, height, lanes, getGlErrorString(glErr));
+        deleteTexturedFrameBuffer(tfb);
+        return 1;
+    }
+    return 0;
+}
+
+int initRoofArrayPyramidBuffer(PyramidBuffer *pbuf, GLsizei width, GLsizei height, GLsizei lanes, GLint internalformat) {
+    TexturedFrameBuffer layers[32];  // Same layer sizes as initRoofPyramidBuffer
+    size_t numLayers = 0;
+
+    if (SET_ERR_IF_TRUE(width < 2 || height < 2)) return 1;
+    while (1) {
+        assert(numLayers < 32);
+
+        int err = initArrayTexture(&layers[numLayers], width, height, lanes, internalformat);
+        if (err) {
+            for (size_t i = 0; i < numLayers; i++) deleteTexturedFrameBuffer(&layers[i]);
+            return err;
+        }
+        numLayers++;
+
+        if (width <= 2 && height <= 2) break;
+        width = width / 2 + 1;
+        height = height / 2 + 1;
+    }
+
+    size_t size = numLayers * sizeof(TexturedFrameBuffer);
+    pbuf->layers = malloc(size);
+    memcpy(pbuf->layers, layers, size);
+    pbuf->numLayers = numLayers;
+    return 0;
+}
+
 void deletePyramidBuffer(PyramidBuffer *pbuf) {
     if (pbuf == NULL || pbuf->layers == NULL) return;
     for (int i = 0; i < pbuf->numLayers; i++) {
@@ -47,10 +47,23 @@ void emptyTexImage2D(GLenum target, GLint level, GLsizei width, GLsizei height,
 int initTexturedFrameBuffer(TexturedFrameBuffer *tfb, GLsizei width, GLsizei height, GLint internalformat, int uninitialized);
 void deleteTexturedFrameBuffer(TexturedFrameBuffer *tfb);
 
+// FBOs, unlike textures, aren't shared between GL contexts.  To use a
+// TexturedFrameBuffer from another context, its FBO must be released on
+// the context which created it, and then recreated (for the same
+// texture) on the context which will use it.
+void releaseFrameBuffer(TexturedFrameBuffer *tfb);
+int recreateFrameBuffer(TexturedFrameBuffer *tfb);
+
 int initCeilPyramidBuffer(PaddedPyramidBuffer *pbuf, GLsizei width, GLsizei height, GLint internalformat, int uninitialized);
 void deletePaddedPyramidBuffer(PaddedPyramidBuffer *pbuf);
 
 int initRoofPyramidBuffer(PyramidBuffer *pbuf, GLsizei width, GLsizei height, GLint internalformat, int uninitialized);
 void deletePyramidBuffer(PyramidBuffer *pbuf);
 
+// Array textures with a layer per lane (see lanes.c), which are only
+// used as images, so they have no FBO (fbo is 0) and aren't filtered.
+// They're deleted with deleteTexturedFrameBuffer/deletePyramidBuffer.
+int initArrayTexture(TexturedFrameBuffer *tfb, GLsizei width, GLsizei height, GLsizei lanes, GLint internalformat);
+int initRoofArrayPyramidBuffer(PyramidBuffer *pbuf, GLsizei width, GLsizei height, GLsizei lanes, GLint internalformat);
+
 #endif //PICOPUTT_FRAMEBUFFERS_H
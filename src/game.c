@@ -6,6 +6,9 @@
 #include "resources.h"
 #include "utils.h"
 #include "config.h"
+#include "trace.h"
+#include "capture.h"
+#include "tuning.h"
 
 char *g_basePath = NULL;
 SDL_Window *g_window = NULL;
@@ -21,10 +24,19 @@ static int loadedGL = 0;
 // them more descriptive.
 int startGame() {
     srand(time(NULL));
+    initTracing();
+#ifdef SDL_HINT_WINDOWS_DPI_AWARENESS
+    // Windows otherwise scales the whole window up on HiDPI displays
+    // rather than giving us a larger drawable (requires SDL 2.24).
+    SDL_SetHint(SDL_HINT_WINDOWS_DPI_AWARENESS, "permonitorv2");
+#endif
+    TRACE_BEGIN("SDL_Init");
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         SDL_SetError("SDL_Init() failed: %s", SDL_GetError());
+        TRACE_END();
         return 1;
     }
+    TRACE_END();
 
 
     if ((g_basePath = getEnvDir("PICOPUTT_BASE_PATH")) != NULL) {
@@ -41,44 +53,62 @@ int startGame() {
 
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
 
+    TRACE_BEGIN("Create window and context");
     g_scWidth = 960;
     g_scHeight = 640;
     g_window = SDL_CreateWindow(
         "picoputt",
         SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
         g_scWidth, g_scHeight,
-        SDL_WINDOW_SHOWN | SDL_WINDOW_OPENGL
+        SDL_WINDOW_SHOWN | SDL_WINDOW_OPENGL | SDL_WINDOW_ALLOW_HIGHDPI
     );
 
-    // For now, I'm not actually using SDL_WINDOW_ALLOW_HIGHDPI, so
-    // draw units and screen units should be the same, but we will try
-    // to correctly distinguish between the two regardless.
-    SDL_GL_GetDrawableSize(g_window, &g_drWidth, &g_drHeight);
-
     if (g_window == NULL) {
         SDL_SetError("SDL_CreateWindow() failed: %s", SDL_GetError());
+        TRACE_END();
         return 1;
     }
 
+    // With SDL_WINDOW_ALLOW_HIGHDPI, draw units may be larger than
+    // screen units (eg 2x on retina displays).
+    updateWindowSize();
+
 
+    // Robust access makes out of bounds texelFetch give 0, which the
+    // QTURN_ROBUST variant relies on.  It's optional, so if the driver
+    // can't do it, we fall back to a regular context (and the contexts
+    // sharing with it follow, since the attribute stays set).
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_ROBUST_ACCESS_FLAG);
     if ((g_GLContext = SDL_GL_CreateContext(g_window)) == NULL) {
+        SDL_Log("Couldn't create a robust access context: %s", SDL_GetError());
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, 0);
+        g_GLContext = SDL_GL_CreateContext(g_window);
+    }
+
+    if (g_GLContext == NULL) {
         SDL_SetError(
             "SDL_GL_CreateContext() failed: %s\n"
             "NOTE: picoputt requires at least OpenGL %d.%d",
             SDL_GetError(), TARGET_GL_MAJOR_VERSION, TARGET_GL_MINOR_VERSION
         );
+        TRACE_END();
         return 1;
     }
+    TRACE_END();
 
+    TRACE_BEGIN("glewInit");
     glewExperimental = GL_TRUE;
     {
         GLenum err = glewInit();
         if (err != GLEW_OK) {
             SDL_SetError("glewInit() failed: %s", glewGetErrorString(err));
+            TRACE_END();
             return 1;
         }
     }
     loadedGL = 1;
+    TRACE_END();
+    initGpuTracing();
 
     SDL_version linked;
     SDL_GetVersion(&linked);
@@ -95,18 +125,35 @@ int startGame() {
     }
 
     initQuad();
-    return loadResources();
+    TRACE_BEGIN("loadResources");
+    int err = loadResources();
+    TRACE_END();
+    if (!err) initCapture();
+    return err;
 }
 
 
 
+// Must be called whenever the window size (or the display it's on)
+// changes.
+void updateWindowSize() {
+    SDL_GetWindowSize(g_window, &g_scWidth, &g_scHeight);
+    SDL_GL_GetDrawableSize(g_window, &g_drWidth, &g_drHeight);
+}
+
+
 void quitGame() {
+    // Needs to happen while the GL context exists to collect GPU scopes
+    finishTracing();
     if (loadedGL) {
+        finishCapture();
         logGlErrors();
         freeResources();
         destroyQuad();
     }
 
+    freeTuning();
+
     if (g_GLContext != NULL) {
         SDL_GL_DeleteContext(g_GLContext);
         g_GLContext = NULL;
@@ -15,6 +15,7 @@ extern int g_drWidth;
 extern int g_drHeight;
 
 int startGame();
+void updateWindowSize();
 void quitGame();
 void showCritError(const char *fmt, ...);
 #endif //PICOPUTT_GAME_H
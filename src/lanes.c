@@ -0,0 +1,252 @@
+#include "lanes.h"
+#include <GL/glew.h>
+#include <SDL.h>
+#include "loop.h"
+#include "resources.h"
+#include "utils.h"
+
+// Workgroup sizes of lanes/qturn.comp (and lanes/putt.comp), and
+// lanes/stats.comp
+#define QTURN_GROUP 8
+#define STATS_GROUP 16
+
+// Image and texture units used while stepping.  0 and 1 are the psi
+// arrays as in doPhysics, and runDrag uses image units 2 and 3.
+#define DRAG_POT_UNIT 5
+#define POTENTIAL_UNIT 2
+#define WALL_UNIT 4
+
+
+int initLaneBatch(LaneBatch *batch, GLsizei lanes) {
+    *batch = (LaneBatch){.lanes = lanes};
+    if (SET_ERR_IF_TRUE(lanes < 1 || lanes > MAX_LANES)) return 1;
+    GLsizei width = g_simBuffers[0].width;
+    GLsizei height = g_simBuffers[0].height;
+
+    int err = initArrayTexture(&batch->psi[0], width, height, lanes, GL_RG32F);
+    if (!err) err = initArrayTexture(&batch->psi[1], width, height, lanes, GL_RG32F);
+    if (!err) err = initArrayTexture(&batch->dragPot, width, height, lanes, GL_R32F);
+    if (!err) err = initRoofArrayPyramidBuffer(&batch->lip, width, height, lanes, GL_RG32F);
+    if (err) {
+        deleteLaneBatch(batch);
+        return err;
+    }
+
+    // glTexStorage3D leaves the contents undefined
+    float zero[2] = {0.f, 0.f};
+    glClearTexImage(batch->psi[0].texture, 0, GL_RG, GL_FLOAT, zero);
+    glClearTexImage(batch->psi[1].texture, 0, GL_RG, GL_FLOAT, zero);
+    glClearTexImage(batch->dragPot.texture, 0, GL_RED, GL_FLOAT, zero);
+
+    glGenBuffers(1, &batch->putts);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batch->putts);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)lanes * 4 * sizeof(float), NULL, GL_DYNAMIC_DRAW);
+
+    // The stats are pairs of vec4s, see lanes/stats.comp
+    batch->numGroups = ((width + STATS_GROUP - 1)/STATS_GROUP) * ((height + STATS_GROUP - 1)/STATS_GROUP);
+    glGenBuffers(1, &batch->partials);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batch->partials);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)lanes * batch->numGroups * 8 * sizeof(float), NULL, GL_DYNAMIC_COPY);
+    glGenBuffers(1, &batch->results);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batch->results);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)lanes * 8 * sizeof(float), NULL, GL_DYNAMIC_READ);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return 0;
+}
+
+void deleteLaneBatch(LaneBatch *batch) {
+    if (batch == NULL) return;
+    deleteTexturedFrameBuffer(&batch->psi[0]);
+    deleteTexturedFrameBuffer(&batch->psi[1]);
+    deleteTexturedFrameBuffer(&batch->dragPot);
+    deletePyramidBuffer(&batch->lip);
+    glDeleteBuffers(1, &batch->putts);
+    glDeleteBuffers(1, &batch->partials);
+    glDeleteBuffers(1, &batch->results);
+    if (batch->statsFence) glDeleteSync(batch->statsFence);
+    *batch = (LaneBatch){0};
+}
+
+
+static void copyToLayer(TexturedFrameBuffer *src, TexturedFrameBuffer *array, GLsizei lane) {
+    glCopyImageSubData(
+        src->texture, GL_TEXTURE_2D, 0, 0, 0, 0,
+        array->texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, lane,
+        src->width, src->height, 1
+    );
+}
+
+static void copyLayer(TexturedFrameBuffer *src, GLsizei srcLane, TexturedFrameBuffer *dst, GLsizei dstLane) {
+    glCopyImageSubData(
+        src->texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, srcLane,
+        dst->texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, dstLane,
+        src->width, src->height, 1
+    );
+}
+
+void setLane(LaneBatch *batch, GLsizei lane, TexturedFrameBuffer *cur, TexturedFrameBuffer *prev, TexturedFrameBuffer *dragPot) {
+    copyToLayer(cur, &batch->psi[batch->cur], lane);
+    copyToLayer(prev, &batch->psi[1 - batch->cur], lane);
+    copyToLayer(dragPot, &batch->dragPot, lane);
+}
+
+void copyLane(LaneBatch *dst, GLsizei dstLane, LaneBatch *src, GLsizei srcLane) {
+    copyLayer(&src->psi[src->cur], srcLane, &dst->psi[dst->cur], dstLane);
+    copyLayer(&src->psi[1 - src->cur], srcLane, &dst->psi[1 - dst->cur], dstLane);
+    copyLayer(&src->dragPot, srcLane, &dst->dragPot, dstLane);
+}
+
+
+// Does count qturns of every lane with timestep qturnDt.  The course
+// must be bound to POTENTIAL_UNIT and WALL_UNIT.
+static void laneQTurns(LaneBatch *batch, int count, float qturnDt) {
+    glBindImageTexture(0, batch->psi[0].texture, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RG32F);
+    glBindImageTexture(1, batch->psi[1].texture, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RG32F);
+    glBindImageTexture(DRAG_POT_UNIT, batch->dragPot.texture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R32F);
+
+    glUseProgram(g_qturnLanes.prog.id);
+    glUniform1f(g_qturnLanes.u_dt, qturnDt);
+    glUniform1i(g_qturnLanes.u_dragPot, DRAG_POT_UNIT);
+    glUniform1i(g_qturnLanes.u_potential, POTENTIAL_UNIT);
+    glUniform1i(g_qturnLanes.u_wall, WALL_UNIT);
+
+    for (int i = 0; i < count; i++) {
+        glUniform1i(g_qturnLanes.u_prev, batch->cur);
+        glUniform1i(g_qturnLanes.u_next, 1 - batch->cur);
+        batch->cur = 1 - batch->cur;
+        glDispatchCompute(
+            (g_simBuffers[0].width + QTURN_GROUP - 1)/QTURN_GROUP,
+            (g_simBuffers[0].height + QTURN_GROUP - 1)/QTURN_GROUP, batch->lanes
+        );
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+}
+
+static void bindCourse() {
+    glActiveTexture(GL_TEXTURE0 + POTENTIAL_UNIT);
+    glBindTexture(GL_TEXTURE_2D, g_potentialBuffer.texture);
+    glActiveTexture(GL_TEXTURE0 + WALL_UNIT);
+    glBindTexture(GL_TEXTURE_2D, g_wallBuffer.texture);
+}
+
+void applyLanePutts(LaneBatch *batch, SDL_FPoint origin, const LanePutt *putts) {
+    float params[4 * MAX_LANES];
+    GLsizei lanes = SDL_min(batch->lanes, MAX_LANES);
+    for (GLsizei i = 0; i < lanes; i++) {
+        params[4*i + 0] = putts[i].px;
+        params[4*i + 1] = putts[i].py;
+        params[4*i + 2] = g_dx * putts[i].clubRadius;
+        params[4*i + 3] = 0.f;  // The global phase of a putt doesn't matter
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batch->putts);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, (GLsizeiptr)lanes * 4 * sizeof(float), params);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // Staggered the same way as applyPutt, but the putt can be applied in
+    // place since the qturn after it only reads the current state.
+    bindCourse();
+    laneQTurns(batch, 1, 0.5f * g_dt);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, batch->putts);
+    glUseProgram(g_puttLanes.prog.id);
+    glUniform1i(g_puttLanes.u_psi, batch->cur);
+    glUniform2f(g_puttLanes.u_origin, g_dx * origin.x, g_dx * origin.y);
+    glUniform1f(g_puttLanes.u_dx, g_dx);
+    glDispatchCompute(
+        (g_simBuffers[0].width + QTURN_GROUP - 1)/QTURN_GROUP,
+        (g_simBuffers[0].height + QTURN_GROUP - 1)/QTURN_GROUP, lanes
+    );
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+
+    laneQTurns(batch, 1, 0.5f * g_dt);
+}
+
+
+void stepLanes(LaneBatch *batch, int turns) {
+    DragPrograms drag = {
+        &g_initLIPLanes, &g_buildLIPLanes, &g_LIPKissLanes, g_integrateLIPLanes, g_laneLIPConfig
+    };
+
+    bindCourse();
+    for (int turn = 0; turn < turns; turn++) {
+        // runDrag rebinds image units 2 and up, so laneQTurns rebinds
+        // the lanes every turn
+        laneQTurns(batch, 4, g_dt);
+        runDrag(&drag, &batch->lip, batch->dragPot.texture, batch->cur, batch->lanes);
+    }
+}
+
+
+void beginLaneStats(LaneBatch *batch) {
+    GLsizei width = g_simBuffers[0].width;
+    GLsizei height = g_simBuffers[0].height;
+
+    glBindImageTexture(0, batch->psi[0].texture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RG32F);
+    glBindImageTexture(1, batch->psi[1].texture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RG32F);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, g_goalState.texture);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, batch->partials);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, batch->results);
+
+    glUseProgram(g_laneStats.prog.id);
+    glUniform1i(g_laneStats.u_cur, batch->cur);
+    glUniform1i(g_laneStats.u_prev, 1 - batch->cur);
+    glUniform1i(g_laneStats.u_goal, 2);
+    glUniform2i(g_laneStats.u_goalOffset, g_goalState.x, g_goalState.y);
+    glDispatchCompute(
+        (width + STATS_GROUP - 1)/STATS_GROUP,
+        (height + STATS_GROUP - 1)/STATS_GROUP, batch->lanes
+    );
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glUseProgram(g_laneStatsSum.prog.id);
+    glUniform1i(g_laneStatsSum.u_numPartials, batch->numGroups);
+    glDispatchCompute(1, 1, batch->lanes);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+
+    if (batch->statsFence) glDeleteSync(batch->statsFence);
+    batch->statsFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+}
+
+int readLaneStats(LaneBatch *batch, LaneStats *out, int wait) {
+    if (SET_ERR_IF_TRUE(!batch->statsFence)) return -1;
+
+    GLenum status = glClientWaitSync(batch->statsFence, 0, wait? GL_TIMEOUT_IGNORED : 0);
+    if (status == GL_TIMEOUT_EXPIRED) return 1;
+    if (status == GL_WAIT_FAILED) {
+        SDL_SetError("Waiting for lane stats failed: %s", getGlErrorString(glGetError()));
+        return -1;
+    }
+    glDeleteSync(batch->statsFence);
+    batch->statsFence = NULL;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batch->results);
+    const float *results = glMapBufferRange(
+        GL_SHADER_STORAGE_BUFFER, 0, (GLsizeiptr)batch->lanes * 8 * sizeof(float), GL_MAP_READ_BIT
+    );
+    if (!results) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        SDL_SetError("Couldn't map lane stats: %s", getGlErrorString(glGetError()));
+        return -1;
+    }
+
+    // Same as updateStats in loop.c
+    for (GLsizei i = 0; i < batch->lanes; i++) {
+        const float *r = results + 8*i;
+        float total = r[0] * g_dx * g_dx;
+        out[i].totalProbability = total;
+        out[i].winProbability = total > 0.f? (r[1]*r[1] + r[2]*r[2]) * g_dx * g_dx / total : 0.f;
+        out[i].centroid = r[0] > 0.f?
+            (SDL_FPoint) {.x = r[4] / r[0], .y = r[5] / r[0]} :
+            (SDL_FPoint) {.x = 0.5f * (float)batch->psi[0].width, .y = 0.5f * (float)batch->psi[0].height};
+    }
+
+    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef PICOPUTT_LANES_H
+#define PICOPUTT_LANES_H
+#include <GL/glew.h>
+#include <SDL.h>
+#include "framebuffers.h"
+
+// A batch of independent simulations ("lanes") on the current course,
+// stored in the layers of array textures so that each step is a handful
+// of dispatches for the whole batch rather than one pass per lane.  This
+// is for analysis (eg evaluating many candidate putts at once), so the
+// lanes run headless: nothing is rendered from them, and the course is
+// shared by all lanes and doesn't advance (as with a static course).
+//
+// Each lane is staggered like the sim buffers, with psi[cur] holding the
+// current state and psi[1 - cur] the previous one.
+
+// Batches can't be bigger than this (which is far more than fit in
+// memory at the usual sim size anyway).
+#define MAX_LANES 256
+
+typedef struct {
+    GLsizei lanes;
+    TexturedFrameBuffer psi[2];  // RG32F arrays
+    TexturedFrameBuffer dragPot; // R32F array
+    PyramidBuffer lip;           // RG32F arrays
+    int cur;
+
+    GLuint putts;  // Per lane putt parameters, see applyLanePutts
+
+    // Per lane stats, see beginLaneStats
+    GLuint partials;
+    GLuint results;
+    GLsizei numGroups;  // Stats workgroups per lane
+    GLsync statsFence;
+} LaneBatch;
+
+typedef struct {
+    float totalProbability;
+    float winProbability;
+    SDL_FPoint centroid;  // Mean position, in sim grid units
+} LaneStats;
+
+// A putt as in applyPutt, with the momentum in physical units and the
+// club radius in sim grid units.
+typedef struct {
+    float px;
+    float py;
+    float clubRadius;
+} LanePutt;
+
+// Allocates a batch of lanes (up to MAX_LANES) at the sim size.  Lanes
+// start out zeroed.
+int initLaneBatch(LaneBatch *batch, GLsizei lanes);
+void deleteLaneBatch(LaneBatch *batch);
+// Copies a single lane simulation state (in the layout of g_simBuffers,
+// with cur the current one) into lane.
+void setLane(LaneBatch *batch, GLsizei lane, TexturedFrameBuffer *cur, TexturedFrameBuffer *prev, TexturedFrameBuffer *dragPot);
+// Copies lane srcLane of src into lane dstLane of dst (which can be the
+// same batch).
+void copyLane(LaneBatch *dst, GLsizei dstLane, LaneBatch *src, GLsizei srcLane);
+// Applies putts[lane] to each lane, like applyPutt in loop.c.  origin is
+// in sim grid units.
+void applyLanePutts(LaneBatch *batch, SDL_FPoint origin, const LanePutt *putts);
+// Advances all lanes by the given number of turns (2 timesteps each).
+void stepLanes(LaneBatch *batch, int turns);
+// Starts computing the total and win probabilities of every lane, which
+// are then collected with readLaneStats.
+void beginLaneStats(LaneBatch *batch);
+// Fills in out[0..lanes-1].  If wait is 0 and the stats aren't ready
+// yet, returns 1 without waiting; wait for them otherwise.  Returns -1
+// on error.
+int readLaneStats(LaneBatch *batch, LaneStats *out, int wait);
+#endif //PICOPUTT_LANES_H
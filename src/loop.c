@@ -6,19 +6,80 @@
 #include "game.h"
 #include "utils.h"
 #include "resources.h"
-
+#include "trace.h"
+#include "capture.h"
+#include "checkpoint.h"
+#include "puttsearch.h"
+#include "observables.h"
+#include "vortices.h"
+#include "tuning.h"
+
+// Turns per second at the default dt.  With $PICOPUTT_AUTO_DT (or if the
+// default dt isn't stable), dt is chosen for the course instead, and
+// turnsPerSecond is scaled so that the game runs at the same speed (see
+// controlTimestep).
 #define PHYS_TURNS_PER_SECOND 300
 
-// This is misleadingly named, FPS can go lower than this.
-// But the number of physics turns per frame is throttled so that the
-// physics computation time doesn't exceed 1/MIN_FPS seconds by more
-// than the cost of 1 physics turn.
+// Putt suggestions (see puttsearch.h) simulate each candidate for this
+// many turns, advancing the search each frame by as many turns as the
+// frame scheduler predicts fit in SEARCH_FRAME_SHARE of the frame after
+// the game's own work (see searchBudget).  Computing par isn't
+// interactive, so it uses fixed, bigger slices.
+#define SEARCH_HORIZON_TURNS ((int)(3. * turnsPerSecond))
+#define SEARCH_FRAME_SHARE 0.5
+#define PAR_SLICE_TURNS 32
+// Par is the number of putts (in half strokes, like the score) the
+// greedy search needs to win, up to this many putts.
+#define PAR_MAX_PUTTS 5
+
+// The goal tile (see GoalTile) extends this many holeSigma from the hole,
+// beyond which the goal state's density is below exp(-16) of its peak.
+#define GOAL_TILE_SIGMAS 4.f
+
+// The number of physics turns per frame is throttled so that the
+// predicted GPU time of the frame doesn't exceed a refresh of the
+// display (see turnBudget and displayFrameTime), although at least 1
+// turn is always allowed.  The scheduler's initial cost guesses assume
+// a full second of turns takes 1/MIN_FPS seconds of GPU time.
 #define MIN_FPS 20
 
+// A putt-wave, see common/putt.glsl (the putt phase only animates the
+// preview, and doesn't matter to the physics).
+typedef struct {
+    SDL_FPoint origin;  // In sim grid units
+    float clubRadius;   // In sim grid units, or INFINITY for a plane wave
+    float px;
+    float py;
+} Putt;
+
 // Simulation parameters
-float dt = 0.2f;
-float dx = 1.f;
-float mass = 1.f;
+float g_dt = 0.2f;
+float g_dx = 1.f;
+float g_mass = 1.f;
+float g_drag = 2e-3f;
+static double turnsPerSecond = PHYS_TURNS_PER_SECOND;
+
+// Visscher's method is stable as long as the spectrum of H (with the
+// potential shifted by V_SHIFT) fits in [-2/dt, 2/dt].  controlTimestep
+// leaves this much margin.
+#define AUTO_DT_SAFETY 0.9f
+// Stability isn't enough though: Visscher's method turns an energy E
+// into a frequency of 2/dt*asin(E*dt/2), which runs fast as |E*dt|
+// grows, so the ball's own energies (measured from V_SHIFT) are kept
+// where that's at most this fraction fast.  asin(x)/x - 1 is about x^2/6.
+#define AUTO_DT_MAX_FREQ_ERROR 5e-3f
+// The ball's kinetic energy is assumed to come from momenta up to this
+// many radians per texel (putts faster than that aren't resolved by the
+// grid anyway).
+#define AUTO_DT_MAX_PUTT_KDX 1.f
+// Animated courses are sampled this many times over this many seconds
+// of game time to find the range of their potential.
+#define AUTO_DT_SAMPLES 32
+#define AUTO_DT_WINDOW 60.f
+// The drag potential is bounded by assuming the phase changes by at
+// most this much between neighboring texels (beyond that, psi isn't
+// resolved by the grid anyway).
+#define DRAG_MAX_PHASE_STEP (0.5f * (float)M_PI)
 
 static float winThreshold = 0.5f;
 
@@ -32,17 +93,111 @@ static int score = 0;
 static int par = 5;
 static int debugViewIdx = 0;
 static SDL_Point puttStart;
+static Putt aimedPutt;  // The putt shown by the preview
 static SDL_Rect drDisplayArea;
 static float displayScale;
+// Seconds per refresh of the display the window is on (assuming
+// DEFAULT_REFRESH_RATE if SDL doesn't know), see updateDisplayInfo
+#define DEFAULT_REFRESH_RATE 60
+static double displayFrameTime = 1. / DEFAULT_REFRESH_RATE;
+
+// Render scale
+// The scene can be drawn into sceneBuffer at a fraction of the display
+// area's resolution and then upscaled.  $PICOPUTT_RENDER_SCALE sets a
+// fixed render scale, otherwise governRenderScale adjusts it (and
+// falls back to g_rendererSimple) to stay within the frame budget.
+// The budget is GOVERNOR_SLACK refreshes of the display, since with
+// vsync a frame can't take less than one, and missing it costs a whole
+// extra one.  Above GOVERNOR_MAX_FPS, the budget is for that rate
+// instead, so fast displays don't force the quality down.
+#define GOVERNOR_SLACK 1.2
+#define GOVERNOR_MAX_FPS 60
+#define GOVERNOR_MIN_SCALE 0.5f
+#define GOVERNOR_STEP 0.125f
+// Seconds within budget before trying a higher quality, and seconds to
+// wait after any change before judging its effect.
+#define GOVERNOR_PATIENCE 3.
+#define GOVERNOR_COOLDOWN 0.5
+static float renderScale = 1.f;
+static int fixedRenderScale = 0;
+static int fancyGraphics = 1;
+static TexturedFrameBuffer sceneBuffer;
+
+// Idle mode
+// While nothing in the scene is changing, the last rendered scene is
+// reused from sceneCache (see beginCachedScene), and while nothing on
+// screen is changing at all, gameLoop waits for events instead of
+// drawing frames.
+#define SCENE_KEY_SIZE 12
+// Upper bound on how long to wait for events while idle, mainly so
+// that snapshots from the physics thread aren't missed for too long.
+#define IDLE_WAIT_MS 250
+static TexturedFrameBuffer sceneCache;
+static int sceneCacheKey[SCENE_KEY_SIZE];
+static int sceneCacheValid = 0;
+// Incremented whenever the physics state shown may have changed
+static unsigned viewVersion = 0;
 static float initialSigma;
+static float holeSigma;
 static SDL_FPoint holePos;
 
-// Note: when we make potential time-dep we will almost certainly want a
-// separate variable to keep track of which potential buffer is current.
 static int curBuf;
 
-static GLuint perfQuery;
-static double perfQueryTurns;  // Number of turns (nominally 4 qturns) recorded in last perfQuery
+// Animated courses (see potential.frag) are re-evaluated every turn.
+// g_potentialBuffer and g_wallBuffer are for the turn starting at
+// courseTime, and are evaluated at the middle of it.
+static int courseAnimated = 0;
+static float courseTime = 0.f;
+
+// Frame scheduler
+// The cost of each stage of the frame is measured with timestamp
+// queries, which are collected (without stalling) some frames later.
+// Each stage's cost is an exponential moving average of the samples,
+// and the number of frames whose queries are still pending tells us
+// how far the GPU is behind.  doPhysics uses these to predict how many
+// turns fit in the frame.
+typedef enum {
+    SCHED_QTURNS,  // Per turn: the 4 qturns
+    SCHED_DRAG,    // Per turn: updateDragPotential
+    SCHED_OTHER,   // Per frame: everything after the turns (stats, rendering)
+    SCHED_SEARCH,  // Per turn of all the putt search's lanes
+    SCHED_NUM_STAGES
+} SchedStage;
+
+// Weight of each new sample in the moving averages
+#define SCHED_EMA_ALPHA 0.1
+// Frames which can be pending without being considered behind, since
+// the driver normally queues up a frame or two.
+#define SCHED_FRAMES_IN_FLIGHT 2
+#define SCHED_QUERY_SETS 8
+
+typedef struct {
+    // Timestamps at the start of the turns, after the first turn's
+    // qturns, after its drag update, after all turns, and at the end of
+    // the frame, and then before and after the putt search's slice
+    // (which is somewhere after the turns, and not counted as part of
+    // SCHED_OTHER).  The per turn stages are sampled from the first turn
+    // only, to keep the number of queries fixed.
+    GLuint queries[7];
+    int turns;
+    int searchTurns;
+    int searchRecorded;
+} SchedQuerySet;
+
+typedef struct {
+    SchedQuerySet sets[SCHED_QUERY_SETS];
+    // Sets from head to tail are waiting for results, and sets[tail] is
+    // being recorded if recording is set.
+    unsigned head, tail;
+    int recording;
+    int measured;
+    double cost[SCHED_NUM_STAGES];  // Seconds
+    unsigned framesBehind;
+    unsigned long droppedTurns;
+} FrameScheduler;
+
+static FrameScheduler sched;
+static double perfQueryTurns;  // Number of turns in the last measured frame
 static double maxTurnsPerSecond = (double)PHYS_TURNS_PER_SECOND;
 static int maxTurnsPerSecondFresh = 1;
 
@@ -50,8 +205,34 @@ static GLuint totalProbBuffer;
 static float totalProbability;
 static GLuint winProbBuffer;
 static float winProbability;
+static int vortexCount = -1;  // -1 until the first scan is collected
 static int needStatsUpdate;
 
+// Physics can optionally run on its own thread (see startPhysicsThread),
+// in which case everything above belongs to the physics thread, and the
+// main thread only sees the snapshots it publishes.
+static int physicsThreaded = 0;
+
+// The physics state shown by the renderer and HUD.  Without the physics
+// thread, this is just the current state, otherwise it's the latest
+// snapshot published by the physics thread.
+typedef struct {
+    GLuint psi;
+    GLuint pdf;        // Layer 0 of g_pdfPyramid
+    GLuint totalProb;  // Top (1x1) layer of g_pdfPyramid
+    GLuint potential;
+    GLuint wall;
+    float totalProbability;
+    float winProbability;
+    int vortexCount;
+    double maxTurnsPerSecond;
+    double perfQueryTurns;
+    int maxTurnsPerSecondFresh;
+    unsigned framesBehind;
+    unsigned long droppedTurns;
+} PhysicsView;
+static PhysicsView view = {.maxTurnsPerSecond = (double)PHYS_TURNS_PER_SECOND, .vortexCount = -1};
+
 void setGaussianWavepacket(TexturedFrameBuffer *tfb, float x0, float y0, float sigma, float dx_) {
     // Initializes the tfb with a normalized gaussian wavepacket
     // psi = A*exp(-0.5((x-x0)^2+(y-y0)^2)/sigma^2)
@@ -71,6 +252,47 @@ void setGaussianWavepacket(TexturedFrameBuffer *tfb, float x0, float y0, float s
     drawQuad();
 }
 
+// Sets the goal tile to the same wavepacket setGaussianWavepacket would
+// draw, cut off GOAL_TILE_SIGMAS*sigma from (x0, y0).  It's small, so it's
+// computed here and uploaded, which needs no FBO on the physics thread.
+static int setGoalState(GoalTile *goal, float x0, float y0, float sigma, float dx_) {
+    float radius = GOAL_TILE_SIGMAS * sigma / dx_;
+    float centerX = x0 / dx_ - 0.5f;
+    float centerY = y0 / dx_ - 0.5f;
+    GLint left = SDL_max((GLint)floorf(centerX - radius), 0);
+    GLint bottom = SDL_max((GLint)floorf(centerY - radius), 0);
+    GLint right = SDL_min((GLint)ceilf(centerX + radius) + 1, g_simBuffers[0].width);
+    GLint top = SDL_min((GLint)ceilf(centerY + radius) + 1, g_simBuffers[0].height);
+    goal->x = left;
+    goal->y = bottom;
+    goal->width = SDL_max(right - left, 0);
+    goal->height = SDL_max(top - bottom, 0);
+
+    size_t size = 2 * sizeof(float) * (size_t)goal->width * (size_t)goal->height;
+    float *data = size? malloc(size) : NULL;
+    if (size && data == NULL) {
+        SDL_OutOfMemory();
+        return 1;
+    }
+
+    float peak = 1.f/(1.7725f*sigma);
+    for (GLint j = 0; j < goal->height; j++) {
+        float y = (dx_ * ((float)(bottom + j) + 0.5f) - y0) / sigma;
+        for (GLint i = 0; i < goal->width; i++) {
+            float x = (dx_ * ((float)(left + i) + 0.5f) - x0) / sigma;
+            float *texel = &data[2 * (j * goal->width + i)];
+            texel[0] = peak * expf(-0.5f * (x*x + y*y));
+            texel[1] = 0.f;
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, goal->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, goal->width, goal->height, 0, GL_RG, GL_FLOAT, data);
+    free(data);
+    return 0;
+}
+
 
 void pyramidReduce(ProgReduce *reduction, PaddedPyramidBuffer *pyramid, GLint texUnit) {
     glUseProgram(reduction->prog.id);
@@ -113,29 +335,28 @@ void beginComputingStats() {
     glReadPixels(0, 0, 1, 1, GL_RED, GL_FLOAT, NULL);
 
 
-    // Begin computation of win probability
-    glViewport(0, 0, g_simBuffers[0].width, g_simBuffers[0].height);
-    glUseProgram(g_cmul.prog.id);
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, g_goalState.texture);
-    glUniform1i(g_cmul.u_left, 2);
-    glUniform1i(g_cmul.u_right, 0 + curBuf);
-    glBindFramebuffer(GL_FRAMEBUFFER, g_goalPyramid.layers[0].buf.fbo);
-    drawQuad();
-    pyramidReduce(&g_rgsumReduce, &g_goalPyramid, 2);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
+    // Begin computation of win probability, which only needs the goal's
+    // tile (see GoalTile)
     if (!winProbBuffer) {
         glGenBuffers(1, &winProbBuffer);
-        glBindBuffer(GL_PIXEL_PACK_BUFFER, winProbBuffer);
-        glBufferData(GL_PIXEL_PACK_BUFFER, 3 * sizeof(float), NULL, GL_DYNAMIC_READ);
-    } else {
-        glBindBuffer(GL_PIXEL_PACK_BUFFER, winProbBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, winProbBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(float), NULL, GL_DYNAMIC_READ);
     }
 
-    // Already bound: glBindFramebuffer(GL_FRAMEBUFFER, g_goalPyramid.layers[g_goalPyramid.numLayers - 1].buf.fbo);
-    glReadPixels(0, 0, 1, 1, GL_RGB, GL_FLOAT, NULL);
-
-    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glUseProgram(g_goalOverlap.prog.id);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, g_goalState.texture);
+    glUniform1i(g_goalOverlap.u_cur, 0 + curBuf);
+    glUniform1i(g_goalOverlap.u_goal, 2);
+    glUniform2i(g_goalOverlap.u_offset, g_goalState.x, g_goalState.y);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, winProbBuffer);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+
+    beginVortexScan(curBuf, VORTEX_SCAN_STATS);
 }
 
 void updateStats() {
@@ -144,23 +365,216 @@ void updateStats() {
     glBindBuffer(GL_PIXEL_PACK_BUFFER, totalProbBuffer);
     float *sumPDF = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
     if (sumPDF) {
-        totalProbability = sumPDF[0] * dx * dx;
+        totalProbability = sumPDF[0] * g_dx * g_dx;
         glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
     }
 
-    glBindBuffer(GL_PIXEL_PACK_BUFFER, winProbBuffer);
-    float *goal = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, winProbBuffer);
+    float *goal = glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
     if (goal) {
-        winProbability = (goal[0]*goal[0] + goal[1]*goal[1]) * dx * dx / totalProbability;
-        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        winProbability = (goal[0]*goal[0] + goal[1]*goal[1]) * g_dx * g_dx / totalProbability;
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
     }
 
-    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // Unlike the probabilities, this doesn't wait (it's only for hints)
+    collectVortexScans();
+    const VortexScan *scan = latestVortexScan();
+    if (scan) vortexCount = scan->count;
+}
+
+
+// In addition to texture units 0 and 1, the selected qturn variant may
+// read u_prev through image units or need a sampler with a zero border.
+// Sampler objects affect everything using those texture units, so they
+// need to be unbound with unbindQTurnSamplers once the qturns are done.
+static void bindQTurnInputs() {
+    glBindImageTexture(0, g_simBuffers[0].texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
+    glBindImageTexture(1, g_simBuffers[1].texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
+
+    GLuint sampler = g_qturnVariant == QTURN_BORDER? g_borderSampler : 0;
+    glBindSampler(0, sampler);
+    glBindSampler(1, sampler);
 }
 
+static void unbindQTurnSamplers() {
+    glBindSampler(0, 0);
+    glBindSampler(1, 0);
+}
+
+
+// Evaluates the course for the turn starting at time.  A turn is 2
+// timesteps, so the middle of it is 1 timestep in.
+static void evaluateCourse(TexturedFrameBuffer *potential, TexturedFrameBuffer *wall, float time) {
+    glViewport(0, 0, potential->width, potential->height);
+    glBindFramebuffer(GL_FRAMEBUFFER, potential->fbo);
+    glUseProgram(g_coursePotential.prog.id);
+    glUniform2f(g_coursePotential.u_simSize, (float)potential->width, (float)potential->height);
+    glUniform1f(g_coursePotential.u_time, time + g_dt);
+    drawQuad();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, wall->fbo);
+    glUseProgram(g_courseWall.prog.id);
+    glUniform2f(g_courseWall.u_simSize, (float)wall->width, (float)wall->height);
+    glUniform1f(g_courseWall.u_time, time + g_dt);
+    drawQuad();
+}
+
+// Makes the next course current for the following turn, and binds it to
+// the qturn inputs.
+static void swapCourse() {
+    TexturedFrameBuffer tmp = g_potentialBuffer;
+    g_potentialBuffer = g_nextPotentialBuffer;
+    g_nextPotentialBuffer = tmp;
+
+    tmp = g_wallBuffer;
+    g_wallBuffer = g_nextWallBuffer;
+    g_nextWallBuffer = tmp;
+
+    courseTime += 2.f * g_dt;
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, g_potentialBuffer.texture);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, g_wallBuffer.texture);
+}
+
+// Finds the range of the course potential in potential (ignoring walls)
+static void measurePotentialRange(TexturedFrameBuffer *potential, TexturedFrameBuffer *wall, float *vmin, float *vmax) {
+    GLsizei groupsX = (potential->width + 15) / 16;
+    GLsizei groupsY = (potential->height + 15) / 16;
+    GLsizeiptr size = (GLsizeiptr)groupsX * groupsY * 2 * sizeof(float);
+    GLuint partials;
+    glGenBuffers(1, &partials);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, partials);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, NULL, GL_DYNAMIC_READ);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, partials);
+
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, potential->texture);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, wall->texture);
+    glUseProgram(g_potentialRange.prog.id);
+    glUniform1i(g_potentialRange.u_potential, 2);
+    glUniform1i(g_potentialRange.u_wall, 4);
+    glDispatchCompute((GLuint)groupsX, (GLuint)groupsY, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+
+    const float *ranges = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (ranges) {
+        for (GLsizei i = 0; i < groupsX * groupsY; i++) {
+            *vmin = SDL_min(*vmin, ranges[2*i]);
+            *vmax = SDL_max(*vmax, ranges[2*i + 1]);
+        }
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glDeleteBuffers(1, &partials);
+}
+
+// The range of the eigenvalues of the kinetic term on the grid, see
+// common/qturn.glsl
+static void kineticRange(const ShaderConstants *constants, float *kmin, float *kmax) {
+    *kmin = 0.f;
+    *kmax = (constants->stencilOrder == 4? 32.f / 3.f : 8.f) / constants->fourMDx2;
+}
+
+// $PICOPUTT_STENCIL_ORDER=4 uses the 4th order Laplacian (see
+// common/qturn.glsl) rather than the 9-point one.
+static int getStencilOrder() {
+    const char *env = getenv("PICOPUTT_STENCIL_ORDER");
+    if (env == NULL || env[0] == '\0') return 2;
+    int order = SDL_atoi(env);
+    if (order != 2 && order != 4) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Ignoring $PICOPUTT_STENCIL_ORDER=%s (must be 2 or 4)", env);
+        return 2;
+    }
+
+    SDL_Log("Using order %d stencil set by $PICOPUTT_STENCIL_ORDER", order);
+    return order;
+}
+
+// The spectrum of H lies within [Vmin + Kmin, Vmax + Kmax], where
+// [Kmin, Kmax] is the range of the kinetic term (which depends on the
+// stencil, see kineticRange).  The drag potential isn't known ahead of
+// time, so it's bounded (see DRAG_MAX_PHASE_STEP).
+//
+// With $PICOPUTT_AUTO_DT, this picks the largest dt for the course which
+// is both stable and accurate (see AUTO_DT_MAX_FREQ_ERROR).  The
+// potential is level-shifted by the bottom of the range, so that the
+// slow states which make up the ball stay near 0, where the frequency
+// is nearly linear in the energy (and R and I, sampled half a step
+// apart, hardly rotate between them).  Shifting further, eg to the
+// middle of the range, would widen the stable range of dt, but only by
+// pushing the ball's states out to where the frequency is far off.
+// Otherwise, dt is only reduced if it isn't stable for the unshifted
+// range, which can happen with the wider spectrum of the 4th order
+// stencil.  This rebuilds the programs, so it must come before anything
+// sets their uniforms.
+static int controlTimestep(ShaderConstants *constants) {
+    const char *env = getenv("PICOPUTT_AUTO_DT");
+    int autoDt = env != NULL && env[0] != '\0';
+
+    float vmin = INFINITY;
+    float vmax = -INFINITY;
+    if (!courseAnimated) {
+        measurePotentialRange(&g_potentialBuffer, &g_wallBuffer, &vmin, &vmax);
+    } else {
+        // The next buffers are free until the game starts
+        float window = AUTO_DT_WINDOW * (float)PHYS_TURNS_PER_SECOND * 2.f * g_dt;
+        for (int i = 0; i < AUTO_DT_SAMPLES; i++) {
+            evaluateCourse(&g_nextPotentialBuffer, &g_nextWallBuffer, window * (float)i / AUTO_DT_SAMPLES);
+            measurePotentialRange(&g_nextPotentialBuffer, &g_nextWallBuffer, &vmin, &vmax);
+        }
+    }
+
+    if (vmin > vmax) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Couldn't measure the course potential, keeping dt=%g", g_dt);
+        return 0;
+    }
+
+    float kmin, kmax;
+    kineticRange(constants, &kmin, &kmax);
+    // The drag potential is DRAG times a line integral of the phase
+    // gradient, and the LIP integration pins its corners around 0.
+    float dragBound = g_drag * DRAG_MAX_PHASE_STEP * 0.5f * (float)(g_simBuffers[0].width + g_simBuffers[0].height - 2);
+    float lo = vmin - dragBound + kmin;
+    float hi = vmax + dragBound + kmax;
+    float oldDt = g_dt;
+    if (autoDt) {
+        constants->potentialShift = lo;
+        float stableDt = AUTO_DT_SAFETY * 2.f / (hi - lo);
+        float puttEnergy = 0.5f * AUTO_DT_MAX_PUTT_KDX * AUTO_DT_MAX_PUTT_KDX / (g_mass * g_dx * g_dx);
+        float accurateDt = 2.f * sqrtf(6.f * AUTO_DT_MAX_FREQ_ERROR) / (vmax + dragBound + puttEnergy - lo);
+        g_dt = SDL_min(stableDt, accurateDt);
+    } else {
+        float radius = SDL_max(fabsf(lo - constants->potentialShift), fabsf(hi - constants->potentialShift));
+        if (g_dt * radius <= 2.f) return 0;
+        g_dt = AUTO_DT_SAFETY * 2.f / radius;
+        SDL_LogWarn(
+            SDL_LOG_CATEGORY_APPLICATION, "dt=%g isn't stable for H in [%g, %g], reducing it (see $PICOPUTT_AUTO_DT)",
+            oldDt, lo, hi
+        );
+    }
+
+    turnsPerSecond = PHYS_TURNS_PER_SECOND * (double)(oldDt / g_dt);
+    SDL_Log(
+        "Potential range [%g, %g], shifted by %g: dt=%g (%.0f turns per second)",
+        vmin, vmax, constants->potentialShift, g_dt, turnsPerSecond
+    );
+    return setShaderConstants(*constants);
+}
 
 void initPhysics(float x0, float y0, float sigma) {
-    setGaussianWavepacket(&g_simBuffers[0], x0, y0, sigma, dx);
+    if (courseAnimated) {
+        courseTime = 0.f;
+        evaluateCourse(&g_potentialBuffer, &g_wallBuffer, courseTime);
+    }
+
+    setGaussianWavepacket(&g_simBuffers[0], x0, y0, sigma, g_dx);
 
     // Set drag potential to zero
     glBindFramebuffer(GL_FRAMEBUFFER, g_dragPot.fbo);
@@ -168,7 +582,6 @@ void initPhysics(float x0, float y0, float sigma) {
     glClearColor(0.f, 0.f, 0.0f, 1.f);
     glClear(GL_COLOR_BUFFER_BIT);
 
-    // Expects perfQuery to be initialized
     glBindFramebuffer(GL_FRAMEBUFFER, g_simBuffers[0].fbo);
     // Note to self: translating glViewport with x and y doesn't affect
     // gl_FragCoord, it only affects NDC (-1..1) coordinates.
@@ -177,10 +590,8 @@ void initPhysics(float x0, float y0, float sigma) {
     glViewport(0, 0, g_simBuffers[0].width, g_simBuffers[0].height);
 
     glUseProgram(g_qturn.prog.id);
-    glUniform1f(g_qturn.u_4m_dx2, 4.f * mass * dx * dx);
-    glUniform1f(g_qturn.u_dt, 0.5f * dt);
+    glUniform1f(g_qturn.u_dt, 0.5f * g_dt);
 
-    glBeginQuery(GL_TIME_ELAPSED, perfQuery);
     curBuf = 1;
     glBindFramebuffer(GL_FRAMEBUFFER, g_simBuffers[1].fbo);
 
@@ -200,27 +611,232 @@ void initPhysics(float x0, float y0, float sigma) {
     glActiveTexture(GL_TEXTURE4);
     glBindTexture(GL_TEXTURE_2D, g_wallBuffer.texture);
 
+    bindQTurnInputs();
     drawQuad();
-    glEndQuery(GL_TIME_ELAPSED);
-    // 1 qturn = 1/4 turn is true physically speaking, although it's
-    // pretty optimistic since it doesn't account for drag update, etc.
-    // But it'll only affect the first frame, so doesn't really matter.
-    perfQueryTurns = 0.25;
+    unbindQTurnSamplers();
 
-    glUniform1f(g_qturn.u_dt, dt);
-
-    // Unnecessary, but it's nice to have an initial value in the buffer
-    glBindFramebuffer(GL_FRAMEBUFFER, g_puttBuffer.fbo);
-    glClearColor(1.f, 0.f, 0.0f, 1.f);
-    glClear(GL_COLOR_BUFFER_BIT);
+    glUniform1f(g_qturn.u_dt, g_dt);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-    updateDisplayInfo();
+
+// Computes the drag potential pot from the wavefunction in image unit
+// cur (with the previous state in unit 1 - cur) by building and
+// integrating the line integral pyramid lip, using progs.  If lanes is
+// nonzero, the images are array textures with that many layers and each
+// layer is handled independently (with the LANES variants of progs).
+// Expects image units 0 and 1 to be bound to the wavefunction buffers.
+void runDrag(const DragPrograms *progs, PyramidBuffer *lip, GLuint pot, int cur, GLsizei lanes) {
+    // Workgroup sizes are injected into the shaders, see LIPConfig
+    int block = progs->config.tile - 2;
+    int groupX = progs->config.groupX;
+    int groupY = progs->config.groupY;
+    GLboolean layered = lanes > 0? GL_TRUE : GL_FALSE;
+    GLuint groupsZ = lanes > 0? lanes : 1;
+
+    glBindImageTexture(2, lip->layers[0].texture, 0, layered, 0, GL_READ_WRITE, GL_RG32F);
+
+    glUseProgram(progs->init->prog.id);
+    glUniform1i(progs->init->u_cur, cur);
+    glUniform1i(progs->init->u_prev, 1 - cur);
+    glUniform1i(progs->init->u_lipOut, 2);
+
+    glDispatchCompute(
+        (lip->layers[0].width + block - 1)/block,
+        (lip->layers[0].height + block - 1)/block, groupsZ
+    );
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    glUseProgram(progs->build->prog.id);
+    int prevBound = 0;
+    for (int i = 1; i < lip->numLayers; i++) {
+        // This first image bind *should* be redundant so far as I can tell from the OpenGL spec because the same
+        // texture should already be bound to the same image unit.  However, in some OpenGL implementations, it is
+        // necessary to rebind the image (presumably due to a bug).
+        //
+        // Tested implementations (GL_RENDERER):
+        //  * AMD Radeon(TM) Graphics on Windows: rebind is needed
+        //    - It seems that without the "redundant" bind, u_lipIn somehow stays stuck on lip->layers[0].
+        //    - u_lipOut still changes (as it should) to lip->layers[i] though.
+        //    - So basically the corner of lip->layers[1] gets copied to all levels.
+        //    - Qualitatively, this "disables drag" as the top level line integrals are too small to be noticeable.
+        //  * Mesa Intel(R) UHD Graphics 620 (KBL GT2) on Linux: rebind is not needed
+        //    - Works fine either way, and there's no measurable performance penalty to doing the redundant bind.
+        glBindImageTexture(2 + prevBound, lip->layers[i - 1].texture, 0, layered, 0, GL_READ_WRITE, GL_RG32F);
+        glBindImageTexture(3 - prevBound, lip->layers[i].texture, 0, layered, 0, GL_READ_WRITE, GL_RG32F);
+        glUniform1i(progs->build->u_lipIn, 2 + prevBound);
+        glUniform1i(progs->build->u_lipOut, 3 - prevBound);
+
+        // Each block of build_lip covers 2*block texels of the previous layer
+        glDispatchCompute(
+            (lip->layers[i - 1].width + 2*block - 1)/(2*block),
+            (lip->layers[i - 1].height + 2*block - 1)/(2*block), groupsZ
+        );
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        prevBound = 1 - prevBound;
+    }
+
+    int lipBind = 2 + prevBound;
+    int potBind = 3 - prevBound;
+    glBindImageTexture(lipBind, lip->layers[lip->numLayers - 1].texture, 0, layered, 0, GL_READ_WRITE, GL_RG32F);
+    glBindImageTexture(potBind, pot, 0, layered, 0, GL_READ_WRITE, GL_R32F);
+    glUseProgram(progs->kiss->prog.id);
+    glUniform1i(progs->kiss->u_lipIn, lipBind);
+    glUniform1i(progs->kiss->u_potOut, potBind);
+
+    glDispatchCompute(1, 1, groupsZ);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    for (int i = lip->numLayers - 2; i >= 0; i--) {
+        int scale = 1 << i;
+        int numX, numY;
+        glBindImageTexture(lipBind, lip->layers[i].texture, 0, layered, 0, GL_READ_ONLY, GL_RG32F);
+
+        numX = (lip->layers[i].width - 1)/2;
+        numY = lip->layers[i + 1].height;
+        if (numX > 0) {
+            glUseProgram(progs->integrate[0].prog.id);
+            glUniform1i(progs->integrate[0].u_lipIn, lipBind);
+            glUniform1i(progs->integrate[0].u_potOut, potBind);
+            glUniform1i(progs->integrate[0].u_scale, scale);
+
+            glDispatchCompute((numX + groupX - 1)/groupX, (numY + groupY - 1)/groupY, groupsZ);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        }
+
+        numX = lip->layers[i].width;
+        numY = (lip->layers[i].height - 1)/2;
+        if (numY > 0) {
+            glUseProgram(progs->integrate[1].prog.id);
+            glUniform1i(progs->integrate[1].u_lipIn, lipBind);
+            glUniform1i(progs->integrate[1].u_potOut, potBind);
+            glUniform1i(progs->integrate[1].u_scale, scale);
+
+            glDispatchCompute((numX + groupX - 1)/groupX, (numY + groupY - 1)/groupY, groupsZ);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        }
+    }
+
+    // Not sure if necessary
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
 }
 
+// Computes the drag potential from the wavefunction in sim buffer cur
+// (with the previous state in 1 - cur).
+// Expects image units 0 and 1 to be bound to the sim buffers.
+void updateDragPotential(int cur) {
+    DragPrograms progs = {&g_initLIP, &g_buildLIP, &g_LIPKiss, g_integrateLIP, g_lipConfig};
+    runDrag(&progs, &g_dragLIP, g_dragPot.texture, cur, 0);
+}
+
+
+static void initScheduler() {
+    sched = (FrameScheduler) {0};
+    for (int i = 0; i < SCHED_QUERY_SETS; i++) {
+        glGenQueries(7, sched.sets[i].queries);
+    }
 
-int doPhysics(int turnsNeeded, double maxTime) {
-    // Assumed preconditions: g_qturn has u_dt and u_4m_dx2 already set
+    // Until the first results come in, assume that we can just about
+    // reach PHYS_TURNS_PER_SECOND in the frame time, and that a turn of
+    // the search costs as much as a turn per lane.
+    sched.cost[SCHED_QTURNS] = 0.8 / MIN_FPS / PHYS_TURNS_PER_SECOND;
+    sched.cost[SCHED_DRAG] = 0.2 / MIN_FPS / PHYS_TURNS_PER_SECOND;
+    sched.cost[SCHED_SEARCH] = 16. / MIN_FPS / PHYS_TURNS_PER_SECOND;
+}
+
+static void destroyScheduler() {
+    for (int i = 0; i < SCHED_QUERY_SETS; i++) {
+        glDeleteQueries(7, sched.sets[i].queries);
+    }
+}
+
+static void updateCost(SchedStage stage, double sample) {
+    sched.cost[stage] += SCHED_EMA_ALPHA * (sample - sched.cost[stage]);
+}
+
+// Collects the results of frames which the GPU has finished
+static void collectSchedulerResults() {
+    for (; sched.head != sched.tail; sched.head++) {
+        SchedQuerySet *set = &sched.sets[sched.head % SCHED_QUERY_SETS];
+        GLint available;
+        glGetQueryObjectiv(set->queries[4], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) break;
+
+        GLuint64 t[7];
+        for (int i = 0; i < 7; i++) glGetQueryObjectui64v(set->queries[i], GL_QUERY_RESULT, &t[i]);
+        double search = 1e-9 * (double)(t[6] - t[5]);
+        if (set->searchTurns > 0) updateCost(SCHED_SEARCH, search / set->searchTurns);
+
+        if (!sched.measured) {
+            // The first sample replaces the initial guess entirely
+            sched.cost[SCHED_OTHER] = 1e-9 * (double)(t[4] - t[3]) - search;
+            if (set->turns == 0) continue;
+            sched.cost[SCHED_QTURNS] = 1e-9 * (double)(t[1] - t[0]);
+            sched.cost[SCHED_DRAG] = 1e-9 * (double)(t[2] - t[1]);
+            sched.measured = 1;
+        } else {
+            updateCost(SCHED_OTHER, 1e-9 * (double)(t[4] - t[3]) - search);
+            if (set->turns == 0) continue;
+            updateCost(SCHED_QTURNS, 1e-9 * (double)(t[1] - t[0]));
+            updateCost(SCHED_DRAG, 1e-9 * (double)(t[2] - t[1]));
+        }
+
+        perfQueryTurns = set->turns;
+        maxTurnsPerSecond = 1. / (sched.cost[SCHED_QTURNS] + sched.cost[SCHED_DRAG]);
+        maxTurnsPerSecondFresh = 1;
+    }
+
+    sched.framesBehind = sched.tail - sched.head;
+}
+
+// GPU time predicted to be left in a frame of targetTime seconds for
+// the turns (and whatever else is fitted in with them)
+static double frameBudget(double targetTime) {
+    double budget = targetTime - sched.cost[SCHED_OTHER];
+
+    // If the GPU is falling behind, leave it time to catch up rather
+    // than letting the backlog grow (and the latency with it).
+    if (sched.framesBehind > SCHED_FRAMES_IN_FLIGHT) {
+        budget -= (double)(sched.framesBehind - SCHED_FRAMES_IN_FLIGHT) * targetTime;
+    }
+
+    return budget;
+}
+
+// Number of turns (up to turnsNeeded) predicted to fit in a frame of
+// targetTime seconds.
+static int turnBudget(int turnsNeeded, double targetTime) {
+    double turnCost = sched.cost[SCHED_QTURNS] + sched.cost[SCHED_DRAG];
+    double budget = frameBudget(targetTime);
+    double maxTurns = SDL_max(budget / turnCost, 1.);
+    return maxTurns < (double)turnsNeeded? (int)maxTurns : turnsNeeded;
+}
+
+// Marks the end of the frame (or the end of a batch of turns and
+// whatever comes after it on the physics thread).  Must be called once
+// per frame, whether or not doPhysics was.
+static void endSchedulerFrame() {
+    if (sched.recording) {
+        SchedQuerySet *set = &sched.sets[sched.tail % SCHED_QUERY_SETS];
+        if (!set->searchRecorded) {
+            glQueryCounter(set->queries[5], GL_TIMESTAMP);
+            glQueryCounter(set->queries[6], GL_TIMESTAMP);
+            set->searchTurns = 0;
+        }
+        glQueryCounter(set->queries[4], GL_TIMESTAMP);
+        sched.tail++;
+        sched.recording = 0;
+    }
+
+    collectSchedulerResults();
+}
+
+
+// Runs as many of turnsNeeded as are predicted to fit in a frame of
+// targetTime seconds, returning the number of turns skipped.
+int doPhysics(int turnsNeeded, double targetTime) {
+    // Assumed preconditions: g_qturn has u_dt already set
     glViewport(0, 0, g_simBuffers[0].width, g_simBuffers[0].height);
 
     // TODO: consider switching to use only image units (glBindImageTexture)
@@ -228,8 +844,7 @@ int doPhysics(int turnsNeeded, double maxTime) {
     //   I'm not quite sure though if we're writing to the images with a
     //   framebuffer whether we need to use GL_READ_WRITE and whether we
     //   need glMemoryBarrier.
-    glBindImageTexture(0, g_simBuffers[0].texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
-    glBindImageTexture(1, g_simBuffers[1].texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
+    bindQTurnInputs();
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, g_simBuffers[0].texture);
@@ -242,21 +857,21 @@ int doPhysics(int turnsNeeded, double maxTime) {
     glActiveTexture(GL_TEXTURE4);
     glBindTexture(GL_TEXTURE_2D, g_wallBuffer.texture);
 
-    GLint queryDone;
-    glGetQueryObjectiv(perfQuery, GL_QUERY_RESULT_AVAILABLE, &queryDone);
-    if (queryDone) {
-        GLuint64 nsElapsedLastFrame;
-        glGetQueryObjectui64v(perfQuery, GL_QUERY_RESULT, &nsElapsedLastFrame);
-        maxTurnsPerSecond = perfQueryTurns / (1e-9 * (double)nsElapsedLastFrame);
-        maxTurnsPerSecondFresh = 1;
-    }
-
-    int startNewQuery = queryDone && turnsNeeded > 0;
-    if (startNewQuery) glBeginQuery(GL_TIME_ELAPSED, perfQuery);
+    // If all the query sets are still pending, this frame just isn't
+    // measured.
+    SchedQuerySet *set = &sched.sets[sched.tail % SCHED_QUERY_SETS];
+    sched.recording = sched.tail - sched.head < SCHED_QUERY_SETS;
+    set->searchRecorded = 0;
+    if (sched.recording) glQueryCounter(set->queries[0], GL_TIMESTAMP);
 
-    double maxTurns = maxTurnsPerSecond * maxTime;
+    int turns = turnBudget(turnsNeeded, targetTime);
     int turn = 0;
-    for (; turn < turnsNeeded; turn++) {
+    for (; turn < turns; turn++) {
+        // The next turn's course is drawn while this turn reads the
+        // current one, so it needs no sync, and since it happens inside
+        // the turn, the scheduler counts it as part of the turn's cost.
+        if (courseAnimated) evaluateCourse(&g_nextPotentialBuffer, &g_nextWallBuffer, courseTime + 2.f * g_dt);
+
         glViewport(0, 0, g_simBuffers[0].width, g_simBuffers[0].height);
         glUseProgram(g_qturn.prog.id);
         glUniform1i(g_qturn.u_potential, 2);
@@ -270,102 +885,58 @@ int doPhysics(int turnsNeeded, double maxTime) {
             drawQuad();
         }
 
-        glBindImageTexture(2, g_dragLIP.layers[0].texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG32F);
-
-        glUseProgram(g_initLIP.prog.id);
-        glUniform1i(g_initLIP.u_cur, curBuf);
-        glUniform1i(g_initLIP.u_prev, 1 - curBuf);
-        glUniform1i(g_initLIP.u_lipOut, 2);
-        glUniform2i(g_initLIP.u_simSize, g_simBuffers[0].width, g_simBuffers[0].height);
-
-        glDispatchCompute((g_simBuffers[0].width + 5)/6, (g_simBuffers[0].height + 5)/6, 1);
-        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-
-        glUseProgram(g_buildLIP.prog.id);
-        int prevBound = 0;
-        for (int i = 1; i < g_dragLIP.numLayers; i++) {
-            // This first image bind *should* be redundant so far as I can tell from the OpenGL spec because the same
-            // texture should already be bound to the same image unit.  However, in some OpenGL implementations, it is
-            // necessary to rebind the image (presumably due to a bug).
-            //
-            // Tested implementations (GL_RENDERER):
-            //  * AMD Radeon(TM) Graphics on Windows: rebind is needed
-            //    - It seems that without the "redundant" bind, u_lipIn somehow stays stuck on g_dragLIP.layers[0].
-            //    - u_lipOut still changes (as it should) to g_dragLIP.layers[i] though.
-            //    - So basically the corner of g_dragLIP.layers[1] gets copied to all levels.
-            //    - Qualitatively, this "disables drag" as the top level line integrals are too small to be noticeable.
-            //  * Mesa Intel(R) UHD Graphics 620 (KBL GT2) on Linux: rebind is not needed
-            //    - Works fine either way, and there's no measurable performance penalty to doing the redundant bind.
-            glBindImageTexture(2 + prevBound, g_dragLIP.layers[i - 1].texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG32F);
-            glBindImageTexture(3 - prevBound, g_dragLIP.layers[i].texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG32F);
-            glUniform1i(g_buildLIP.u_lipIn, 2 + prevBound);
-            glUniform1i(g_buildLIP.u_lipOut, 3 - prevBound);
-
-            glDispatchCompute((g_dragLIP.layers[i - 1].width + 11)/12, (g_dragLIP.layers[i - 1].height + 11)/12, 1);
-            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        if (turn == 0 && sched.recording) glQueryCounter(set->queries[1], GL_TIMESTAMP);
+        updateDragPotential(curBuf);
+        if (turn == 0 && sched.recording) glQueryCounter(set->queries[2], GL_TIMESTAMP);
+        observeTurn(curBuf);
+        if (courseAnimated) swapCourse();
+    }
 
-            prevBound = 1 - prevBound;
+    if (sched.recording) {
+        if (turns == 0) {
+            glQueryCounter(set->queries[1], GL_TIMESTAMP);
+            glQueryCounter(set->queries[2], GL_TIMESTAMP);
         }
 
-        int lipBind = 2 + prevBound;
-        int potBind = 3 - prevBound;
-        glBindImageTexture(lipBind, g_dragLIP.layers[g_dragLIP.numLayers - 1].texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG32F);
-        glBindImageTexture(potBind, g_dragPot.texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
-        glUseProgram(g_LIPKiss.prog.id);
-        glUniform1i(g_LIPKiss.u_lipIn, lipBind);
-        glUniform1i(g_LIPKiss.u_potOut, potBind);
-
-        glDispatchCompute(1, 1, 1);
-        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-
-        for (int i = g_dragLIP.numLayers - 2; i >= 0; i--) {
-            int scale = 1 << i;
-            int numX, numY;
-            glBindImageTexture(lipBind, g_dragLIP.layers[i].texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
-
-            numX = (g_dragLIP.layers[i].width - 1)/2;
-            numY = g_dragLIP.layers[i + 1].height;
-            if (numX > 0) {
-                glUseProgram(g_integrateLIP[0].prog.id);
-                glUniform1i(g_integrateLIP[0].u_lipIn, lipBind);
-                glUniform1i(g_integrateLIP[0].u_potOut, potBind);
-                glUniform1i(g_integrateLIP[0].u_scale, scale);
-
-                glDispatchCompute((numX + 7)/8, (numY + 7)/8, 1);
-                glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-            }
-
-            numX = g_dragLIP.layers[i].width;
-            numY = (g_dragLIP.layers[i].height - 1)/2;
-            if (numY > 0) {
-                glUseProgram(g_integrateLIP[1].prog.id);
-                glUniform1i(g_integrateLIP[1].u_lipIn, lipBind);
-                glUniform1i(g_integrateLIP[1].u_potOut, potBind);
-                glUniform1i(g_integrateLIP[1].u_scale, scale);
+        glQueryCounter(set->queries[3], GL_TIMESTAMP);
+        set->turns = turns;
+    }
 
-                glDispatchCompute((numX + 7)/8, (numY + 7)/8, 1);
-                glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-            }
-        }
+    unbindQTurnSamplers();
 
-        // Not sure if necessary
-        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    sched.droppedTurns += (unsigned long)(turnsNeeded - turns);
+    return turnsNeeded - turns;
+}
 
-        // We allow at least one turn to run (assuming turns > 0) before
-        // checking maxTurns.
-        if ((double)turn > maxTurns) break;
-    }
+// Number of turns of the putt search predicted to fit in
+// SEARCH_FRAME_SHARE of a frame of targetTime seconds, after the frame's
+// physicsTurns and everything else.  At least 1 turn is always allowed,
+// so that the search finishes eventually.
+static int searchBudget(double targetTime, int physicsTurns) {
+    double turnCost = sched.cost[SCHED_QTURNS] + sched.cost[SCHED_DRAG];
+    double budget = frameBudget(SEARCH_FRAME_SHARE * targetTime) - physicsTurns * turnCost;
+    double maxTurns = SDL_max(budget / sched.cost[SCHED_SEARCH], 1.);
+    return maxTurns < (double)SDL_MAX_SINT32? (int)maxTurns : SDL_MAX_SINT32;
+}
 
-    if (startNewQuery) {
-        glEndQuery(GL_TIME_ELAPSED);
-        perfQueryTurns = (double)turn;
+// Advances the putt search, if one is running, by the turns which fit
+// in the frame (see searchBudget), measuring their cost.  Must come
+// after doPhysics (if it runs) and before endSchedulerFrame.
+static void runSearchSlice(double targetTime, int physicsTurns) {
+    if (!puttSearchRunning()) return;
+    SchedQuerySet *set = &sched.sets[sched.tail % SCHED_QUERY_SETS];
+    int recording = sched.recording && !set->searchRecorded;
+    if (recording) glQueryCounter(set->queries[5], GL_TIMESTAMP);
+    updatePuttSearch(searchBudget(targetTime, physicsTurns), 0);
+    if (recording) {
+        glQueryCounter(set->queries[6], GL_TIMESTAMP);
+        set->searchTurns = puttSearchSliceTurns();
+        set->searchRecorded = 1;
     }
-
-    return turnsNeeded - turn;
 }
 
 
-void applyPutt() {
+void applyPutt(Putt putt) {
     // In addition to applying the putt, this function also effectively
     // advances the wavefunction by half a timestep by applying two half
     // size qturns.  I do not plan to actually advance time to match.
@@ -374,49 +945,48 @@ void applyPutt() {
     // can leave behind some noticeable probability residue.
     // This effect is (almost) completely eliminated by the restaggering
     // technique used here.
-
-    // Assumed preconditions: g_qturn has u_4m_dx2 already set
-    glViewport(0, 0, g_simBuffers[0].width, g_simBuffers[0].height);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, g_simBuffers[0].texture);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, g_simBuffers[1].texture);
+    // All three steps are fused into shaders/putt.comp, which writes the
+    // re-staggered state to the other sim buffer and the putt (the new
+    // previous state) to g_simSpare, which then takes the place of the
+    // current buffer.
+    int next = 1 - curBuf;
+    glBindImageTexture(0, g_simBuffers[curBuf].texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
+    glBindImageTexture(1, g_simBuffers[next].texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32F);
+    glBindImageTexture(2, g_simSpare.texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32F);
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_2D, g_potentialBuffer.texture);
     glActiveTexture(GL_TEXTURE3);
     glBindTexture(GL_TEXTURE_2D, g_dragPot.texture);
     glActiveTexture(GL_TEXTURE4);
     glBindTexture(GL_TEXTURE_2D, g_wallBuffer.texture);
-    glActiveTexture(GL_TEXTURE5);
-    glBindTexture(GL_TEXTURE_2D, g_puttBuffer.texture);
 
-    // Do half a qturn to un-stagger the wavefunction
-    glUseProgram(g_qturn.prog.id);
-    glUniform1i(g_qturn.u_potential, 2);
-    glUniform1i(g_qturn.u_dragPot, 3);
-    glUniform1i(g_qturn.u_wall, 4);
-    glUniform1f(g_qturn.u_dt, 0.5f * dt);
-    glUniform1i(g_qturn.u_prev, 0 + curBuf);
-    curBuf = 1 - curBuf;
-    glBindFramebuffer(GL_FRAMEBUFFER, g_simBuffers[curBuf].fbo);
-    drawQuad();
-
-    glUseProgram(g_cmul.prog.id);
-    glUniform1i(g_cmul.u_left, 5);
-    glUniform1i(g_cmul.u_right, 0 + curBuf);
-    curBuf = 1 - curBuf;
-    glBindFramebuffer(GL_FRAMEBUFFER, g_simBuffers[curBuf].fbo);
-    drawQuad();
-
-    // Do another half qturn to re-stagger the wavefunction
-    glUseProgram(g_qturn.prog.id);
-    glUniform1i(g_qturn.u_prev, 0 + curBuf);
-    curBuf = 1 - curBuf;
-    glBindFramebuffer(GL_FRAMEBUFFER, g_simBuffers[curBuf].fbo);
-    drawQuad();
+    int planeWave = isinf(putt.clubRadius);
+    glUseProgram(g_applyPutt.prog.id);
+    glUniform1i(g_applyPutt.u_cur, 0);
+    glUniform1i(g_applyPutt.u_next, 1);
+    glUniform1i(g_applyPutt.u_prevOut, 2);
+    glUniform1i(g_applyPutt.u_potential, 2);
+    glUniform1i(g_applyPutt.u_dragPot, 3);
+    glUniform1i(g_applyPutt.u_wall, 4);
+    glUniform1f(g_applyPutt.u_dt, 0.5f * g_dt);
+    glUniform2f(g_applyPutt.u_origin, g_dx * putt.origin.x, g_dx * putt.origin.y);
+    glUniform2f(g_applyPutt.u_momentum, putt.px, putt.py);
+    glUniform1f(g_applyPutt.u_clubRadius, planeWave? 0.f : g_dx * putt.clubRadius);
+    glUniform1i(g_applyPutt.u_planeWave, planeWave);
+    glUniform1f(g_applyPutt.u_dx, g_dx);
+
+    // Same tile size as putt.comp
+    glDispatchCompute((g_simBuffers[0].width + 15)/16, (g_simBuffers[0].height + 15)/16, 1);
+    // The results are used in every way the sim buffers are
+    glMemoryBarrier(
+        GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT |
+        GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT
+    );
 
-    // Reset timestep back to normal
-    glUniform1f(g_qturn.u_dt, dt);
+    TexturedFrameBuffer putted = g_simSpare;
+    g_simSpare = g_simBuffers[curBuf];
+    g_simBuffers[curBuf] = putted;
+    curBuf = next;
 }
 
 
@@ -432,6 +1002,24 @@ void updateDisplayInfo() {
     drDisplayArea.x = (g_drWidth - drDisplayArea.w) / 2;
     drDisplayArea.y = (g_drHeight - drDisplayArea.h) / 2;
     displayScale = (float)drDisplayArea.w / (float)g_simBuffers[0].width;
+
+    SDL_DisplayMode mode;
+    int display = SDL_GetWindowDisplayIndex(g_window);
+    if (display >= 0 && SDL_GetCurrentDisplayMode(display, &mode) == 0 && mode.refresh_rate > 0) {
+        displayFrameTime = 1. / mode.refresh_rate;
+    } else {
+        displayFrameTime = 1. / DEFAULT_REFRESH_RATE;
+    }
+}
+
+// SDL_GetMouseState gives screen units, but we want draw units
+static SDL_Point getDrMouseState() {
+    SDL_Point mouse;
+    SDL_GetMouseState(&mouse.x, &mouse.y);
+    return (SDL_Point) {
+        .x = (int) ((float)mouse.x * (float)g_drWidth / (float)g_scWidth),
+        .y = (int) ((float)mouse.y * (float)g_drHeight / (float)g_scHeight)
+    };
 }
 
 SDL_FPoint simPixelPos(SDL_Point drPos) {
@@ -485,76 +1073,133 @@ void renderDebug(GLuint texture, float a, float b, float c, float d) {
     drawQuad();
 }
 
+// (Re)allocates sceneBuffer for the current render scale.  Returns 0
+// if the scene should be drawn directly to the display instead.
+static int updateSceneBuffer() {
+    int width = SDL_max(1, (int)lroundf(renderScale * (float)drDisplayArea.w));
+    int height = SDL_max(1, (int)lroundf(renderScale * (float)drDisplayArea.h));
+    if (renderScale >= 1.f || width >= drDisplayArea.w) {
+        if (sceneBuffer.texture) deleteTexturedFrameBuffer(&sceneBuffer);
+        return 0;
+    }
+
+    if (sceneBuffer.texture && sceneBuffer.width == width && sceneBuffer.height == height) return 1;
+    if (sceneBuffer.texture) deleteTexturedFrameBuffer(&sceneBuffer);
+    if (initTexturedFrameBuffer(&sceneBuffer, width, height, GL_RGBA8, 1)) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create scene buffer, using full render scale: %s", SDL_GetError());
+        sceneBuffer = (TexturedFrameBuffer) {0};
+        renderScale = 1.f;
+        fixedRenderScale = 1;
+        return 0;
+    }
+
+    return 1;
+}
+
 void renderGame(float seconds, int showClub) {
     static float contourProgress = 0.f;
     contourProgress += 0.5f * seconds;
     contourProgress -= floorf(contourProgress);
 
+    // Everything that doesn't depend on the view is computed at sim
+    // resolution first, so the cost of the display pass doesn't depend
+    // much on the window size.
+    glBindFramebuffer(GL_FRAMEBUFFER, g_surfaceBuffer.fbo);
+    glViewport(0, 0, g_surfaceBuffer.width, g_surfaceBuffer.height);
+    glUseProgram(g_surfacePass.prog.id);
+
+    glUniform1i(g_surfacePass.u_pdf, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, view.pdf);
+
+    glUniform1i(g_surfacePass.u_totalProb, 1);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, view.totalProb);
+
+    glUniform1i(g_surfacePass.u_potential, 2);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, view.potential);
+
+    drawQuad();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
     glViewport(0, 0, g_drWidth, g_drHeight);
 
     glClearColor(0.8f, 0.8f, 0.8f, 1.f);
     glClear(GL_COLOR_BUFFER_BIT);
 
-    glViewport(drDisplayArea.x, drDisplayArea.y, drDisplayArea.w, drDisplayArea.h);
-    glUseProgram(g_renderer.prog.id);
-
-    glUniform2f(
-        g_renderer.vert.u_scale,
-        (float)g_pdfPyramid.layers[0].dataWidth/(float)g_pdfPyramid.layers[0].buf.width,
-        (float)g_pdfPyramid.layers[0].dataHeight/(float)g_pdfPyramid.layers[0].buf.height
-    );
-    glUniform2f(g_renderer.vert.u_shift, 0.f, 0.f);
+    // Pixels of the scene per draw unit
+    float sceneScale = 1.f;
+    int scaled = updateSceneBuffer();
+    if (scaled) {
+        // The renderer discards walls, so the background must be
+        // cleared here too.
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneBuffer.fbo);
+        glViewport(0, 0, sceneBuffer.width, sceneBuffer.height);
+        glClear(GL_COLOR_BUFFER_BIT);
+        sceneScale = (float)sceneBuffer.width / (float)drDisplayArea.w;
+    } else {
+        glViewport(drDisplayArea.x, drDisplayArea.y, drDisplayArea.w, drDisplayArea.h);
+    }
 
-    glUniform2f(g_renderer.u_simSize, (float)g_simBuffers[0].width, (float)g_simBuffers[0].height);
-    glUniform1f(g_renderer.u_drContourThickness, 0.5f*(float)g_drWidth/(float)g_scWidth);
-    glUniform1f(g_renderer.u_contourProgress, contourProgress);
-    glUniform1f(g_renderer.u_contourSep, 0.01f);
+    ProgRenderer *renderer = fancyGraphics? &g_renderer : &g_rendererSimple;
+    glUseProgram(renderer->prog.id);
 
-    glUniform1i(g_renderer.u_cur, 0);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, g_simBuffers[curBuf].texture);
+    glUniform2f(renderer->vert.u_scale, 1.f, 1.f);
+    glUniform2f(renderer->vert.u_shift, 0.f, 0.f);
 
-    glUniform1i(g_renderer.u_pdf, 1);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, g_pdfPyramid.layers[0].buf.texture);
+    glUniform2f(renderer->u_simSize, (float)g_simBuffers[0].width, (float)g_simBuffers[0].height);
+    glUniform1f(renderer->u_drContourThickness, 0.5f*sceneScale*(float)g_drWidth/(float)g_scWidth);
+    glUniform1f(renderer->u_contourProgress, contourProgress);
+    glUniform1f(renderer->u_contourSep, 0.01f);
 
-    glUniform1i(g_renderer.u_totalProb, 2);
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, g_pdfPyramid.layers[g_pdfPyramid.numLayers - 1].buf.texture);
+    glUniform1i(renderer->u_surface, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, g_surfaceBuffer.texture);
 
-    glUniform1i(g_renderer.u_skybox, 3);
+    glUniform1i(renderer->u_skybox, 3);
     glActiveTexture(GL_TEXTURE3);
     glBindTexture(GL_TEXTURE_CUBE_MAP, g_skyboxTexture);
 
-    glUniform1i(g_renderer.u_colormap, 4);
+    glUniform1i(renderer->u_colormap, 4);
     glActiveTexture(GL_TEXTURE4);
     glBindTexture(GL_TEXTURE_2D, g_colormapTexture);
 
-    glUniform1i(g_renderer.u_potential, 5);
-    glActiveTexture(GL_TEXTURE5);
-    glBindTexture(GL_TEXTURE_2D, g_potentialBuffer.texture);
-
-    glUniform1i(g_renderer.u_wall, 6);
+    glUniform1i(renderer->u_wall, 6);
     glActiveTexture(GL_TEXTURE6);
-    glBindTexture(GL_TEXTURE_2D, g_wallBuffer.texture);
+    glBindTexture(GL_TEXTURE_2D, view.wall);
 
-    glUniform1i(g_renderer.u_puttActive, puttActive);
+    glUniform1i(renderer->u_puttActive, puttActive);
     if (puttActive) {
-        glUniform1i(g_renderer.u_putt, 7);
-        glActiveTexture(GL_TEXTURE7);
-        glBindTexture(GL_TEXTURE_2D, g_puttBuffer.texture);
+        glUniform2f(renderer->u_puttOrigin, aimedPutt.origin.x, aimedPutt.origin.y);
+        glUniform2f(renderer->u_puttMomentum, aimedPutt.px, aimedPutt.py);
+        glUniform1f(renderer->u_puttClubRadius, g_dx * aimedPutt.clubRadius);
+        glUniform1f(renderer->u_puttPhase, puttPhase);
+        glUniform1f(renderer->u_dx, g_dx);
     }
 
-    SDL_Point mouse;
-    SDL_GetMouseState(&mouse.x, &mouse.y);
+    SDL_Point mouse = getDrMouseState();
     SDL_FPoint mouseUV = {
         (float)(mouse.x - drDisplayArea.x)/(float)drDisplayArea.w,
         (float)(drDisplayArea.h - mouse.y - drDisplayArea.y)/(float)drDisplayArea.h
     };
-    glUniform2f(g_renderer.u_mouse, mouseUV.x, mouseUV.y);
+    glUniform2f(renderer->u_mouse, mouseUV.x, mouseUV.y);
 
     drawQuad();
 
+    if (scaled) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneBuffer.fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(
+            0, 0, sceneBuffer.width, sceneBuffer.height,
+            drDisplayArea.x, drDisplayArea.y,
+            drDisplayArea.x + drDisplayArea.w, drDisplayArea.y + drDisplayArea.h,
+            GL_COLOR_BUFFER_BIT, GL_LINEAR
+        );
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(drDisplayArea.x, drDisplayArea.y, drDisplayArea.w, drDisplayArea.h);
+    }
+
     if (showClub) {
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -567,6 +1212,107 @@ void renderGame(float seconds, int showClub) {
 }
 
 
+// Returns 1 if the scene (everything drawn by renderGame or renderDebug)
+// has to be rendered, or 0 if it was drawn from the cache.  The key
+// must identify everything the scene depends on, and animated scenes
+// shouldn't be cached at all.
+static int beginCachedScene(const int key[SCENE_KEY_SIZE], int cacheable) {
+    if (!cacheable) {
+        sceneCacheValid = 0;
+        return 1;
+    }
+
+    if (sceneCacheValid && SDL_memcmp(key, sceneCacheKey, sizeof sceneCacheKey) == 0) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneCache.fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(
+            0, 0, sceneCache.width, sceneCache.height,
+            0, 0, sceneCache.width, sceneCache.height,
+            GL_COLOR_BUFFER_BIT, GL_NEAREST
+        );
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return 0;
+    }
+
+    return 1;
+}
+
+// Copies the newly rendered scene into the cache
+static void endCachedScene(const int key[SCENE_KEY_SIZE], int cacheable) {
+    if (!cacheable) return;
+    if (sceneCache.texture && (sceneCache.width != g_drWidth || sceneCache.height != g_drHeight)) {
+        deleteTexturedFrameBuffer(&sceneCache);
+    }
+
+    if (!sceneCache.texture && initTexturedFrameBuffer(&sceneCache, g_drWidth, g_drHeight, GL_RGBA8, 1)) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create scene cache: %s", SDL_GetError());
+        sceneCache = (TexturedFrameBuffer) {0};
+        return;
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, sceneCache.fbo);
+    glBlitFramebuffer(
+        0, 0, g_drWidth, g_drHeight,
+        0, 0, g_drWidth, g_drHeight,
+        GL_COLOR_BUFFER_BIT, GL_NEAREST
+    );
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    SDL_memcpy(sceneCacheKey, key, sizeof sceneCacheKey);
+    sceneCacheValid = 1;
+}
+
+
+// Called once per frame, droppedTurns is the number of turns skipped
+// by the frame scheduler since the last call.  Quality is lowered a
+// step at a time (render scale, then fancy graphics) while over budget,
+// and raised again once it has been within budget for a while.
+static void governRenderScale(double frameDuration, unsigned long droppedTurns) {
+    static double avgFrameTime = 0.;
+    static double goodTime = 0.;
+    static double cooldown = 0.;
+    if (fixedRenderScale) return;
+
+    avgFrameTime += 0.1 * (frameDuration - avgFrameTime);
+    cooldown -= frameDuration;
+    if (cooldown > 0.) return;
+
+    double budget = GOVERNOR_SLACK * SDL_max(displayFrameTime, 1. / GOVERNOR_MAX_FPS);
+    int overBudget = avgFrameTime > budget || droppedTurns > 0;
+    if (!overBudget) {
+        goodTime += frameDuration;
+        if (goodTime < GOVERNOR_PATIENCE) return;
+        if (!fancyGraphics) {
+            fancyGraphics = 1;
+        } else if (renderScale < 1.f) {
+            renderScale = SDL_min(renderScale + GOVERNOR_STEP, 1.f);
+        } else {
+            return;
+        }
+    } else if (renderScale > GOVERNOR_MIN_SCALE) {
+        renderScale = SDL_max(renderScale - GOVERNOR_STEP, GOVERNOR_MIN_SCALE);
+    } else if (fancyGraphics) {
+        fancyGraphics = 0;
+    } else {
+        return;
+    }
+
+    goodTime = 0.;
+    cooldown = GOVERNOR_COOLDOWN;
+    SDL_Log("Render scale: %.3f%s", renderScale, fancyGraphics? "" : " (simple graphics)");
+}
+
+static void initRenderScale() {
+    const char *env = getenv("PICOPUTT_RENDER_SCALE");
+    if (env == NULL || env[0] == '\0') return;
+
+    renderScale = SDL_clamp((float)SDL_atof(env), 0.25f, 1.f);
+    fixedRenderScale = 1;
+    SDL_Log("Using render scale %.3f set by $PICOPUTT_RENDER_SCALE", renderScale);
+}
+
+
 SDL_Point samplePyramid(PaddedPyramidBuffer *pbuf) {
     // TODO: I get the sense from testing this that there's a bias
     //  towards (0, 0).  Holding down space to do a random walk tends to
@@ -609,7 +1355,110 @@ SDL_Point samplePyramid(PaddedPyramidBuffer *pbuf) {
 
 
 #define FPS_HISTORY 8
-void renderFPS(double fps) {
+// Frame time percentiles are over the last FRAME_TIME_HISTORY frames,
+// and are recomputed every FRAME_TIME_UPDATE frames.
+#define FRAME_TIME_HISTORY 240
+#define FRAME_TIME_UPDATE 30
+
+// The layouts of the HUD text, which are only redone when it changes
+// (see beginTextBlock)
+enum {
+    TEXT_FRAME_STATS,
+    TEXT_OBSERVABLES,
+    TEXT_FPS,
+    TEXT_STATUS_BAR,
+    TEXT_WIN_SCREEN,
+    TEXT_MEASUREMENTS,
+    NUM_TEXT_BLOCKS
+};
+static TextBlock textBlocks[NUM_TEXT_BLOCKS];
+
+static void destroyTextBlocks() {
+    for (int i = 0; i < NUM_TEXT_BLOCKS; i++) destroyTextBlock(&textBlocks[i]);
+}
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void renderFrameStats(double frameDuration) {
+    static double frameTimes[FRAME_TIME_HISTORY];
+    static int numFrames = 0;
+    static int percentiles[3];  // p50, p95 and p99 in units of 0.1 ms
+    frameTimes[numFrames % FRAME_TIME_HISTORY] = frameDuration;
+    numFrames++;
+
+    if (numFrames % FRAME_TIME_UPDATE == 1) {
+        int n = SDL_min(numFrames, FRAME_TIME_HISTORY);
+        double sorted[FRAME_TIME_HISTORY];
+        SDL_memcpy(sorted, frameTimes, (size_t)n * sizeof(double));
+        SDL_qsort(sorted, (size_t)n, sizeof(double), compareDoubles);
+
+        const double ps[3] = {0.5, 0.95, 0.99};
+        for (int i = 0; i < 3; i++) {
+            percentiles[i] = (int)lround(1e4 * sorted[(int)(ps[i] * (n - 1))]);
+        }
+    }
+
+    TextBlock *block = &textBlocks[TEXT_FRAME_STATS];
+    int dropped = (int)SDL_min(view.droppedTurns, (unsigned long)SDL_MAX_SINT32);
+    int key[TEXT_BLOCK_KEY_SIZE] = {
+        g_scWidth, g_scHeight, percentiles[0], percentiles[1], percentiles[2],
+        dropped, (int)view.framesBehind
+    };
+
+    if (beginTextBlock(block, key)) {
+        char text[96];
+        SDL_snprintf(
+            text, sizeof text, "frame p50/p95/p99: %.1f/%.1f/%.1f ms | dropped: %d T | GPU behind: %d",
+            0.1 * percentiles[0], 0.1 * percentiles[1], 0.1 * percentiles[2],
+            dropped, (int)view.framesBehind
+        );
+
+        setTextColor(0.f, 0.f, 0.f, 1.f);
+        Cursor c = {
+            .left=5.f, .x=5.f, .y=23.f, .size=15.f,
+            .viewWidth=(float)g_scWidth, .viewHeight=(float)g_scHeight
+        };
+
+        drawStringFixedNum(&c, text);
+        endTextBlock();
+    }
+
+    drawTextBlock(block);
+}
+
+// The latest observables sample, see observables.h
+static void renderObservables() {
+    ObservableSample s;
+    if (!readObservables(&s, 1)) return;
+
+    TextBlock *block = &textBlocks[TEXT_OBSERVABLES];
+    int key[TEXT_BLOCK_KEY_SIZE] = {g_scWidth, g_scHeight, (int)(s.turn % (unsigned long)SDL_MAX_SINT32)};
+    if (beginTextBlock(block, key)) {
+        char text[160];
+        SDL_snprintf(
+            text, sizeof text, "E: %.6g | norm: %.6f (drift %+.1e) | <x>: %.1f, %.1f | <p>: %.3f, %.3f | spread: %.1f, %.1f",
+            s.energy, s.norm, s.normDrift, s.position.x, s.position.y,
+            s.momentum.x, s.momentum.y, s.spread.x, s.spread.y
+        );
+
+        setTextColor(0.f, 0.f, 0.f, 1.f);
+        Cursor c = {
+            .left=5.f, .x=5.f, .y=41.f, .size=15.f,
+            .viewWidth=(float)g_scWidth, .viewHeight=(float)g_scHeight
+        };
+
+        drawStringFixedNum(&c, text);
+        endTextBlock();
+    }
+
+    drawTextBlock(block);
+}
+
+void renderFPS(double frameDuration) {
+    double fps = 1. / frameDuration;
     float pixels = (float)g_simBuffers[0].width * (float)g_simBuffers[0].height;
 
     static int histIdx = 0;
@@ -619,15 +1468,15 @@ void renderFPS(double fps) {
     if (needsInit) {
         for (int i = 0; i < FPS_HISTORY; i++) {
             fpsHist[i] = fps;
-            mtpsHist[i] = maxTurnsPerSecond;
+            mtpsHist[i] = view.maxTurnsPerSecond;
         }
-        maxTurnsPerSecondFresh = 0;
+        view.maxTurnsPerSecondFresh = 0;
         needsInit = 0;
     } else {
         fpsHist[histIdx] = fps;
-        if (maxTurnsPerSecondFresh) {
-            mtpsHist[histIdx] = maxTurnsPerSecond;
-            maxTurnsPerSecondFresh = 0;
+        if (view.maxTurnsPerSecondFresh) {
+            mtpsHist[histIdx] = view.maxTurnsPerSecond;
+            view.maxTurnsPerSecondFresh = 0;
         }
         histIdx = (histIdx + 1)%FPS_HISTORY;
     }
@@ -641,34 +1490,41 @@ void renderFPS(double fps) {
     avgFPS /= FPS_HISTORY;
     avgMTPS /= FPS_HISTORY;
 
-    char *text;
-    if (SDL_asprintf(
-        &text, "%.f FPS | max perf: %.f T/s (%.f MpxT/s)",
-        avgFPS, avgMTPS, pixels * avgMTPS / 1e6
-    ) == -1) return;
+    // The text is only laid out again when one of the displayed
+    // (rounded) numbers changes
+    TextBlock *block = &textBlocks[TEXT_FPS];
+    int fpsKey = (int)lround(avgFPS);
+    int mtpsKey = (int)lround(avgMTPS);
+    int mpxtpsKey = (int)lround(pixels * avgMTPS / 1e6);
+    int key[TEXT_BLOCK_KEY_SIZE] = {g_scWidth, g_scHeight, fpsKey, mtpsKey, mpxtpsKey};
 
     glViewport(0, 0, g_drWidth, g_drHeight);
-    useFont(&g_fontRegular, (ProgDrawGlyph*)&g_msdfGlyph, 0);
-    glUniform4f(g_msdfGlyph.u_color, 0.f, 0.f, 0.f, 1.f);
-    Cursor c = {
-        .left=5.f, .x=5.f, .y=5.f, .size=15.f,
-        .viewWidth=(float)g_scWidth, .viewHeight=(float)g_scHeight
-    };
+    useFont(&g_fontRegular, &g_msdfGlyph, 0);
+    if (beginTextBlock(block, key)) {
+        char text[80];
+        SDL_snprintf(
+            text, sizeof text, "%d FPS | max perf: %d T/s (%d MpxT/s)",
+            fpsKey, mtpsKey, mpxtpsKey
+        );
+
+        setTextColor(0.f, 0.f, 0.f, 1.f);
+        Cursor c = {
+            .left=5.f, .x=5.f, .y=5.f, .size=15.f,
+            .viewWidth=(float)g_scWidth, .viewHeight=(float)g_scHeight
+        };
+
+        drawStringFixedNum(&c, text);
+        endTextBlock();
+    }
 
-    drawStringFixedNum(&c, text);
-    SDL_free(text);
+    drawTextBlock(block);
+    renderFrameStats(frameDuration);
+    if (g_observableInterval) renderObservables();
+    flushGlyphs();
 }
 
 
-void renderStatusBar() {
-    glUseProgram(g_fillColor.prog.id);
-    int headerHeight = 40 * g_drHeight / g_scHeight;
-    glViewport(0, g_drHeight - headerHeight, g_drWidth, headerHeight);
-    glUniform4f(g_fillColor.u_color, 1.f, 1.f, 1.f, 0.25f);
-    drawQuad();
-    glViewport(0, 0, g_drWidth, g_drHeight);
-
-    useFont(&g_fontRegular, (ProgDrawGlyph*)&g_msdfGlyph, 0);
+static void layoutStatusBar(int winPercent, int thresholdPercent, int vortices) {
     Cursor c = {
         .left=5.f, .x=5.f, .y=(float)g_scHeight - 27.f, .size=22.f,
         .viewWidth=(float)g_scWidth, .viewHeight=(float)g_scHeight
@@ -677,11 +1533,11 @@ void renderStatusBar() {
     GLfloat mainColor[4] = {0.f, 0.f, 0.f, 1.f};
     GLfloat winColor[4] = {0.2f, 1.f, 0.f, 1.f};
 
-    glUniform4fv(g_msdfGlyph.u_color, 1, mainColor);
+    setTextColorv(mainColor);
     drawString(&c, "P(");
-    glUniform4fv(g_msdfGlyph.u_color, 1, winColor);
+    setTextColorv(winColor);
     drawString(&c, "win");
-    glUniform4fv(g_msdfGlyph.u_color, 1, mainColor);
+    setTextColorv(mainColor);
     drawString(&c, ") = ");
     c.size = 25.f;
     drawChar(&c, '|');
@@ -692,9 +1548,9 @@ void renderStatusBar() {
     c.size = 22.f;
     drawChar(&c, '|');
     c.size = 20.f;
-    glUniform4fv(g_msdfGlyph.u_color, 1, winColor);
+    setTextColorv(winColor);
     drawString(&c, "hole");
-    glUniform4fv(g_msdfGlyph.u_color, 1, mainColor);
+    setTextColorv(mainColor);
     c.size = 22.f;
     drawChar(&c, 0x27e9);
     c.size = 25.f;
@@ -710,87 +1566,123 @@ void renderStatusBar() {
         c.size = prevSize;
     }
 
-    char *text;
-    if (SDL_asprintf(
-        &text, " = %.f%% / ",
-        floorf(100.f * winProbability)
-    ) == -1) return;
-    glUniform4fv(g_msdfGlyph.u_color, 1, mainColor);
+    char text[64];
+    SDL_snprintf(text, sizeof text, " = %d%% / ", winPercent);
+    setTextColorv(mainColor);
     drawString(&c, text);
-    SDL_free(text);
 
-    if (SDL_asprintf(
-        &text, "%.f%%",
-        ceilf(100.f * winThreshold)
-    ) == -1) return;
-    glUniform4fv(g_msdfGlyph.u_color, 1, winColor);
+    SDL_snprintf(text, sizeof text, "%d%%", thresholdPercent);
+    setTextColorv(winColor);
     drawString(&c, text);
-    SDL_free(text);
 
-    if (SDL_asprintf(
-        &text, "Score: %d%s",
+    SDL_snprintf(
+        text, sizeof text, "Score: %d%s",
         score%2 == 0? score / 2 : score,
         score%2 == 0? "" : "/2"
-    ) == -1) return;
+    );
 
     float scoreWidth = emWidth(&g_fontRegular, text);
     c.x = c.left = (float)g_scWidth - scoreWidth * c.size - 5.f;
-    glUniform4fv(g_msdfGlyph.u_color, 1, mainColor);
+    setTextColorv(mainColor);
     drawString(&c, text);
-    SDL_free(text);
 
     c.left = c.x = 5.f;
     c.y -= 30.f;
     c.size = 18.f;
 
     if (debugView) {
-        glUniform4f(g_msdfGlyph.u_color, 0.75f, 0.75f, 0.75f, 1.f);
+        setTextColor(0.75f, 0.75f, 0.75f, 1.f);
         drawString(&c, "Debug view.  Press [D] to return to normal view\n");
         drawString(&c, "Left and right arrows to change view\n");
+        SDL_snprintf(text, sizeof text, "qturn variant: %s\n", g_qturnVariantNames[g_qturnVariant]);
+        drawString(&c, text);
     }
 
     if (paused) {
         drawString(&c, "Game is paused, press [P] to unpause\n");
     }
+
+    // As the README says, the drag force won't get rid of these
+    if (vortices > 0) {
+        SDL_snprintf(
+            text, sizeof text, "%d vorti%s in the ball, try measuring [Space] or putting\n",
+            vortices, vortices == 1? "ex" : "ces"
+        );
+        drawString(&c, text);
+    }
 }
 
-void renderWinScreen() {
+void renderStatusBar() {
     glUseProgram(g_fillColor.prog.id);
-    glViewport(0, 0, g_drWidth, g_drHeight);
-    glUniform4f(g_fillColor.u_color, 0.f, 0.2f, 0.1f, 0.75f);
+    int headerHeight = 40 * g_drHeight / g_scHeight;
+    glViewport(0, g_drHeight - headerHeight, g_drWidth, headerHeight);
+    glUniform4f(g_fillColor.u_color, 1.f, 1.f, 1.f, 0.25f);
     drawQuad();
+    glViewport(0, 0, g_drWidth, g_drHeight);
 
-    useFont(&g_fontRegular, (ProgDrawGlyph*)&g_msdfGlyph, 0);
-
-    Cursor c = {
-        .y=(float)g_scHeight * 0.75f, .size=75.f,
-        .viewWidth=(float)g_scWidth, .viewHeight=(float)g_scHeight
+    useFont(&g_fontRegular, &g_msdfGlyph, 0);
+    TextBlock *block = &textBlocks[TEXT_STATUS_BAR];
+    int winPercent = (int)floorf(100.f * view.winProbability);
+    int thresholdPercent = (int)ceilf(100.f * winThreshold);
+    int vortices = gameWon? 0 : view.vortexCount;
+    int key[TEXT_BLOCK_KEY_SIZE] = {
+        g_scWidth, g_scHeight, winPercent, thresholdPercent, score,
+        debugView, paused, g_qturnVariant, vortices
     };
 
-    char *text = "You probably won!";
-    float width = emWidth(&g_fontRegular, text);
-    c.left = c.x = (float)g_scWidth * 0.5f - c.size * width * 0.5f;
-    glUniform4f(g_msdfGlyph.u_color, 1.f, 1.f, 1.f, 1.f);
-    drawString(&c, text);
-    c.size = 45.f;
+    if (beginTextBlock(block, key)) {
+        layoutStatusBar(winPercent, thresholdPercent, vortices);
+        endTextBlock();
+    }
 
-    if (SDL_asprintf(
-        &text, "\n\nHole in %d%s (par %d%s)",
-        score%2 == 0? score / 2 : score,
-        score%2 == 0? "" : "/2",
-        par%2 == 0? par / 2 : par,
-        par%2 == 0? "" : "/2"
-    ) == -1) return;
-    width = emWidth(&g_fontRegular, text);
-    c.left = c.x = (float)g_scWidth * 0.5f - c.size * width * 0.5f;
-    drawString(&c, text);
-    SDL_free(text);
+    drawTextBlock(block);
+    flushGlyphs();
+}
 
-    c.size = 30.f;
-    text = "\nPress [R] to restart";
-    width = emWidth(&g_fontRegular, text);
-    c.left = c.x = (float)g_scWidth * 0.5f - c.size * width * 0.5f;
-    drawString(&c, text);
+void renderWinScreen() {
+    glUseProgram(g_fillColor.prog.id);
+    glViewport(0, 0, g_drWidth, g_drHeight);
+    glUniform4f(g_fillColor.u_color, 0.f, 0.2f, 0.1f, 0.75f);
+    drawQuad();
+
+    useFont(&g_fontRegular, &g_msdfGlyph, 0);
+    TextBlock *block = &textBlocks[TEXT_WIN_SCREEN];
+    int key[TEXT_BLOCK_KEY_SIZE] = {g_scWidth, g_scHeight, score, par};
+    if (beginTextBlock(block, key)) {
+        Cursor c = {
+            .y=(float)g_scHeight * 0.75f, .size=75.f,
+            .viewWidth=(float)g_scWidth, .viewHeight=(float)g_scHeight
+        };
+
+        const char *title = "You probably won!";
+        float width = emWidth(&g_fontRegular, title);
+        c.left = c.x = (float)g_scWidth * 0.5f - c.size * width * 0.5f;
+        setTextColor(1.f, 1.f, 1.f, 1.f);
+        drawString(&c, title);
+        c.size = 45.f;
+
+        char text[64];
+        SDL_snprintf(
+            text, sizeof text, "\n\nHole in %d%s (par %d%s)",
+            score%2 == 0? score / 2 : score,
+            score%2 == 0? "" : "/2",
+            par%2 == 0? par / 2 : par,
+            par%2 == 0? "" : "/2"
+        );
+        width = emWidth(&g_fontRegular, text);
+        c.left = c.x = (float)g_scWidth * 0.5f - c.size * width * 0.5f;
+        drawString(&c, text);
+
+        c.size = 30.f;
+        const char *restart = "\nPress [R] to restart";
+        width = emWidth(&g_fontRegular, restart);
+        c.left = c.x = (float)g_scWidth * 0.5f - c.size * width * 0.5f;
+        drawString(&c, restart);
+        endTextBlock();
+    }
+
+    drawTextBlock(block);
+    flushGlyphs();
 }
 
 
@@ -801,7 +1693,7 @@ void renderHoleArrow(float seconds) {
     progress -= floorf(progress);
 
     glViewport(drDisplayArea.x, drDisplayArea.y, drDisplayArea.w, drDisplayArea.h);
-    Glyph *arrow = findGlyph(0x2193, g_fontRegular.numGlyphs, g_fontRegular.glyphs);
+    Glyph *arrow = findGlyph(&g_fontRegular, 0x2193);
     if (!arrow) return;
     Glyph centeredArrow = *arrow;
     centeredArrow.bbox.x = -centeredArrow.bbox.w / 2.f;
@@ -812,74 +1704,67 @@ void renderHoleArrow(float seconds) {
         .viewHeight=(float)g_simBuffers[0].height
     };
 
-    c.left = c.x = 0.5f + holePos.x/dx;
-    c.y = holePos.y/dx;
-    glUniform4f(g_msdfGlyph.u_color, 0.2f, 1.f, 0.f, opacity);
+    c.left = c.x = 0.5f + holePos.x/g_dx;
+    c.y = holePos.y/g_dx;
+    useFont(&g_fontRegular, &g_msdfGlyph, 0);
+    setTextColor(0.2f, 1.f, 0.f, opacity);
     drawGlyph(&c, &centeredArrow);
+    flushGlyphs();
 }
 
 
-// origin and size are in simulation grid units
-void setPutt(SDL_FPoint origin, float size, float px, float py, float phase) {
-    glViewport(0, 0, g_puttBuffer.width, g_puttBuffer.height);
-    glBindFramebuffer(GL_FRAMEBUFFER, g_puttBuffer.fbo);
-    glUseProgram(g_putt.prog.id);
-
-    glUniform2f(g_putt.vert.u_scale, dx * (float)g_puttBuffer.width, dx * (float)g_puttBuffer.height);
-    glUniform2f(g_putt.vert.u_shift, -dx * origin.x, -dx * origin.y);
-
-    glUniform1f(g_putt.u_clubRadius, dx * size);
-    glUniform2f(g_putt.u_momentum, px, py);
-    glUniform1f(g_putt.u_phase, phase);
-
-    drawQuad();
-}
-
-
-void setPlaneWavePutt(float px, float py) {
-    glViewport(0, 0, g_puttBuffer.width, g_puttBuffer.height);
-    glBindFramebuffer(GL_FRAMEBUFFER, g_puttBuffer.fbo);
-    glUseProgram(g_planeWave.prog.id);
-    glUniform2f(g_planeWave.vert.u_scale, dx * (float)g_puttBuffer.width, dx * (float)g_puttBuffer.height);
-    glUniform2f(g_planeWave.u_momentum, px, py);
-
-    drawQuad();
-}
-
-
-#define MAX_MEASUREMENTS 100
+#define MAX_MEASUREMENTS CHECKPOINT_MAX_MEASUREMENTS
 static size_t activeMeasurements = 0;
 static SDL_Point measurements[MAX_MEASUREMENTS];
-void makeMeasurements() {
+// Incremented whenever new measurements are made, so the dots are only
+// laid out once per measurement
+static int measurementsVersion = 0;
+static void sampleMeasurements(SDL_Point points[MAX_MEASUREMENTS]) {
     for (size_t i = 0; i < MAX_MEASUREMENTS; i++) {
-        measurements[i] = samplePyramid(&g_pdfPyramid);
+        points[i] = samplePyramid(&g_pdfPyramid);
     }
+}
+
+static void showNewMeasurements(const SDL_Point points[MAX_MEASUREMENTS]) {
+    SDL_memcpy(measurements, points, sizeof measurements);
     activeMeasurements = MAX_MEASUREMENTS;
+    measurementsVersion++;
 }
 
 void showMeasurements() {
     if (!activeMeasurements) return;
     glViewport(drDisplayArea.x, drDisplayArea.y, drDisplayArea.w, drDisplayArea.h);
-    useFont(&g_fontRegular, (ProgDrawGlyph*)&g_msdfGlyph, 0);
-    glUniform4f(g_msdfGlyph.u_color, 0.f, 0.f, 0.f, 0.5f);
-
-    Cursor c = {
-        .size=15.f,
-        .viewWidth=(float)g_simBuffers[0].width,
-        .viewHeight=(float)g_simBuffers[0].height
-    };
-
-    Glyph *dot = findGlyph('.', g_fontRegular.numGlyphs, g_fontRegular.glyphs);
-    if (!dot) return;
-    Glyph centerDot = *dot;
-    centerDot.bbox.x = -dot->bbox.w/2.f;
-    centerDot.bbox.y = -dot->bbox.h/2.f;
+    useFont(&g_fontRegular, &g_msdfGlyph, 0);
+
+    // The dots are in sim units, so they don't depend on the screen size
+    TextBlock *block = &textBlocks[TEXT_MEASUREMENTS];
+    int key[TEXT_BLOCK_KEY_SIZE] = {measurementsVersion, (int)activeMeasurements};
+    if (beginTextBlock(block, key)) {
+        setTextColor(0.f, 0.f, 0.f, 0.5f);
+        Cursor c = {
+            .size=15.f,
+            .viewWidth=(float)g_simBuffers[0].width,
+            .viewHeight=(float)g_simBuffers[0].height
+        };
+
+        Glyph *dot = findGlyph(&g_fontRegular, '.');
+        if (dot) {
+            Glyph centerDot = *dot;
+            centerDot.bbox.x = -dot->bbox.w/2.f;
+            centerDot.bbox.y = -dot->bbox.h/2.f;
+
+            for (size_t i = 0; i < activeMeasurements; i++) {
+                c.left = c.x = (float)measurements[i].x;
+                c.y = (float)measurements[i].y;
+                drawGlyph(&c, &centerDot);
+            }
+        }
 
-    for (size_t i = 0; i < activeMeasurements; i++) {
-        c.left = c.x = (float)measurements[i].x;
-        c.y = (float)measurements[i].y;
-        drawGlyph(&c, &centerDot);
+        endTextBlock();
     }
+
+    drawTextBlock(block);
+    flushGlyphs();
 }
 
 void doMeasurement(float sigma) {
@@ -911,18 +1796,630 @@ void doMeasurement(float sigma) {
     float ry = quad[2*3 + 0];
     float iy = quad[2*3 + 1];
 
-    float px = atan2f(r0*ix - i0*rx, r0*rx + i0*ix)/dx;
-    float py = atan2f(r0*iy - i0*ry, r0*ry + i0*iy)/dx;
+    float px = atan2f(r0*ix - i0*rx, r0*rx + i0*ix)/g_dx;
+    float py = atan2f(r0*iy - i0*ry, r0*ry + i0*iy)/g_dx;
 
-    initPhysics(dx*(float)pos.x, dx*(float)pos.y, sigma);
-    setPlaneWavePutt(px, py);
-    applyPutt();
+    initPhysics(g_dx*(float)pos.x, g_dx*(float)pos.y, sigma);
+    applyPutt((Putt) {.clubRadius = INFINITY, .px = px, .py = py});
     beginComputingStats();
     // measurements[0] = pos;
     // activeMeasurements = 1;
 }
 
 
+// Physics thread
+// ==============
+// With $PICOPUTT_PHYSICS_THREAD set, physics runs on its own thread
+// with its own (shared) GL context, at full speed regardless of the
+// frame rate.  The main thread sends it commands (putts, measurements,
+// etc) through a queue, and it publishes snapshots of the state to be
+// rendered through a triple buffer.  The snapshots are fenced both
+// ways: the renderer always shows the latest complete state, and the
+// physics thread doesn't overwrite a snapshot until the main thread's
+// draws (and capture readbacks) of it are done, since GL doesn't order
+// commands across contexts.
+//
+// Programs, textures, buffers and syncs are shared between the
+// contexts, but FBOs, VAOs and queries are not.  So the physics thread
+// takes over the FBOs of the buffers it renders to (see
+// movePhysicsFrameBuffers), and has its own quad VAO and scheduler.
+// Putts are sent as their parameters (see applyPutt), so nothing the
+// main thread draws is needed by the physics.
+
+// Max GPU time of turns between snapshots, so that the renderer always
+// has a recent state to show.
+#define SNAPSHOT_FPS 120
+#define NUM_SNAPSHOTS 3
+#define PHYS_QUEUE_SIZE 16
+
+typedef enum {
+    PHYS_RESET,    // Reset the ball and goal state
+    PHYS_PUTT,     // Apply a putt
+    PHYS_MEASURE,  // Partial measurement (doMeasurement)
+    PHYS_SAMPLE,   // Sample MAX_MEASUREMENTS points (showNewMeasurements)
+    PHYS_SAVE,     // Start saving a checkpoint (see saveGame)
+    PHYS_LOAD,     // Upload a checkpoint (see loadGame)
+    PHYS_SEARCH    // Start a putt search from the current state
+} PhysCommandType;
+
+typedef struct {
+    PhysCommandType type;
+    SDL_FPoint pos;      // PHYS_RESET: initial ball position
+    float sigma;         // PHYS_RESET and PHYS_MEASURE
+    SDL_FPoint holePos;  // PHYS_RESET
+    float holeSigma;     // PHYS_RESET
+    Putt putt;           // PHYS_PUTT
+    CheckpointHeader checkpoint;  // PHYS_SAVE and PHYS_LOAD
+    void *checkpointData;         // PHYS_LOAD: planes from readCheckpoint
+} PhysCommand;
+
+typedef struct {
+    TexturedFrameBuffer psi;
+    TexturedFrameBuffer pdf;
+    TexturedFrameBuffer totalProb;
+    TexturedFrameBuffer potential;  // Only for animated courses
+    TexturedFrameBuffer wall;
+    GLsync fence;           // Signaled once the copies above are done
+    GLsync readFence;       // Signaled once the main thread stops reading it
+    unsigned commandsDone;  // Number of commands run before the snapshot
+    PhysicsView view;
+} PhysicsSnapshot;
+
+static SDL_Thread *physThread = NULL;
+static SDL_GLContext physContext = NULL;
+static SDL_mutex *physMutex = NULL;
+static SDL_cond *physCond = NULL;       // New commands, physRunning or physQuit changed
+static SDL_cond *publishedCond = NULL;  // Snapshot published, or physStarted changed
+static PhysicsSnapshot snapshots[NUM_SNAPSHOTS];
+
+// Protected by physMutex
+static PhysCommand physQueue[PHYS_QUEUE_SIZE];
+static unsigned physQueueHead = 0;
+static unsigned physQueueTail = 0;  // Total number of commands sent
+static int physRunning = 0;
+static int physQuit = 0;
+static int physStarted = 0;  // 1 once the thread is set up, -1 if setup failed
+static int readySnapshot = 1;
+static int snapshotReady = 0;
+static SDL_Point sampledPoints[MAX_MEASUREMENTS];
+static unsigned sampledVersion = 0;
+
+// Only used by the physics thread (except while it isn't running)
+static int backSnapshot = 0;
+
+// Only used by the main thread
+static int frontSnapshot = 2;
+// Snapshots from before the last command aren't shown, so that eg the
+// win probability from before a reset can't win the new game.
+static unsigned minCommandsDone = 0;
+static unsigned seenSampledVersion = 0;
+
+// Checkpoints are saved to $PICOPUTT_CHECKPOINT (F5), and loaded from it
+// (F9), or at startup from $PICOPUTT_LOAD_CHECKPOINT.  They are
+// compressed if $PICOPUTT_CHECKPOINT_COMPRESS is set (to anything but 0).
+static const char *checkpointPath = "picoputt.ckpt";
+static CheckpointCompression checkpointCompression = CHECKPOINT_RAW;
+static TexturedFrameBuffer *const checkpointPlanes[CHECKPOINT_PLANES] = {
+    &g_simBuffers[0], &g_simBuffers[1], &g_dragPot
+};
+
+
+static PhysicsView currentPhysicsView() {
+    PhysicsView result = {
+        .psi = g_simBuffers[curBuf].texture,
+        .pdf = g_pdfPyramid.layers[0].buf.texture,
+        .totalProb = g_pdfPyramid.layers[g_pdfPyramid.numLayers - 1].buf.texture,
+        .potential = g_potentialBuffer.texture,
+        .wall = g_wallBuffer.texture,
+        .totalProbability = totalProbability,
+        .winProbability = winProbability,
+        .vortexCount = vortexCount,
+        .maxTurnsPerSecond = maxTurnsPerSecond,
+        .perfQueryTurns = perfQueryTurns,
+        .maxTurnsPerSecondFresh = maxTurnsPerSecondFresh,
+        .framesBehind = sched.framesBehind,
+        .droppedTurns = sched.droppedTurns
+    };
+
+    maxTurnsPerSecondFresh = 0;
+    return result;
+}
+
+static void setView(PhysicsView newView) {
+    // The freshness flag is cleared by renderFPS once it's used
+    newView.maxTurnsPerSecondFresh |= view.maxTurnsPerSecondFresh;
+    view = newView;
+}
+
+
+static void runPhysicsCommand(PhysCommand *cmd) {
+    SDL_Point points[MAX_MEASUREMENTS];
+    // Any suggestion in progress would be for the old state
+    if (cmd->type != PHYS_SAMPLE && cmd->type != PHYS_SAVE) cancelPuttSearch();
+
+    switch (cmd->type) {
+        case PHYS_RESET:
+            initPhysics(cmd->pos.x, cmd->pos.y, cmd->sigma);
+            disturbVortices();
+            resetObservables();
+            if (setGoalState(&g_goalState, cmd->holePos.x, cmd->holePos.y, cmd->holeSigma, g_dx)) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't set goal state: %s", SDL_GetError());
+            }
+            beginComputingStats();
+            break;
+
+        case PHYS_PUTT:
+            applyPutt(cmd->putt);
+            disturbVortices();
+            rebaseObservables();
+            beginComputingStats();
+            break;
+
+        case PHYS_MEASURE:
+            beginVortexScan(curBuf, VORTEX_SCAN_BEFORE_MEASUREMENT);
+            doMeasurement(cmd->sigma);
+            beginVortexScan(curBuf, VORTEX_SCAN_AFTER_MEASUREMENT);
+            rebaseObservables();
+            break;
+
+        case PHYS_SAMPLE:
+            sampleMeasurements(points);
+            if (!physicsThreaded) {
+                showNewMeasurements(points);
+                break;
+            }
+
+            SDL_LockMutex(physMutex);
+            SDL_memcpy(sampledPoints, points, sizeof points);
+            sampledVersion++;
+            SDL_UnlockMutex(physMutex);
+            break;
+
+        case PHYS_SAVE:
+            cmd->checkpoint.curBuf = curBuf;
+            cmd->checkpoint.courseTime = courseTime;
+            if (saveCheckpoint(checkpointPath, cmd->checkpoint, checkpointPlanes)) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't save checkpoint: %s", SDL_GetError());
+            }
+            break;
+
+        case PHYS_LOAD:
+            uploadCheckpoint(cmd->checkpointData, checkpointPlanes);
+            curBuf = cmd->checkpoint.curBuf;
+            courseTime = cmd->checkpoint.courseTime;
+            if (courseAnimated) evaluateCourse(&g_potentialBuffer, &g_wallBuffer, courseTime);
+            disturbVortices();
+            resetObservables();
+            if (setGoalState(&g_goalState, cmd->checkpoint.holeX, cmd->checkpoint.holeY, cmd->checkpoint.holeSigma, g_dx)) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't set goal state: %s", SDL_GetError());
+            }
+            beginComputingStats();
+            break;
+
+        case PHYS_SEARCH:
+            if (startPuttSearch(&g_simBuffers[curBuf], &g_simBuffers[1 - curBuf], &g_dragPot, SEARCH_HORIZON_TURNS)) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't start putt search: %s", SDL_GetError());
+            }
+            break;
+    }
+}
+
+// Runs the command immediately, or sends it to the physics thread
+static void physicsCommand(PhysCommand cmd) {
+    viewVersion++;
+    if (!physicsThreaded) {
+        runPhysicsCommand(&cmd);
+        return;
+    }
+
+    SDL_LockMutex(physMutex);
+    if (physQueueTail - physQueueHead == PHYS_QUEUE_SIZE) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Physics command queue is full, dropping command");
+        free(cmd.checkpointData);
+    } else {
+        physQueue[physQueueTail++ % PHYS_QUEUE_SIZE] = cmd;
+        minCommandsDone = physQueueTail;
+        SDL_CondSignal(physCond);
+    }
+    SDL_UnlockMutex(physMutex);
+}
+
+static void setPhysicsRunning(int running) {
+    SDL_LockMutex(physMutex);
+    if (physRunning != running) {
+        physRunning = running;
+        SDL_CondSignal(physCond);
+    }
+    SDL_UnlockMutex(physMutex);
+}
+
+
+static void initCheckpointing() {
+    const char *env = getenv("PICOPUTT_CHECKPOINT");
+    if (env != NULL && env[0] != '\0') checkpointPath = env;
+
+    env = getenv("PICOPUTT_CHECKPOINT_COMPRESS");
+    if (env != NULL && env[0] != '\0' && SDL_strcmp(env, "0") != 0) {
+        checkpointCompression = CHECKPOINT_SHUFFLE_RLE;
+    }
+
+    initCheckpoints();
+}
+
+static void saveGame() {
+    SDL_Log("Saving checkpoint to %s", checkpointPath);
+    CheckpointHeader header = {
+        .compression = checkpointCompression,
+        .score = score,
+        .gameWon = gameWon,
+        .initialSigma = initialSigma,
+        .holeX = holePos.x,
+        .holeY = holePos.y,
+        .holeSigma = holeSigma,
+        .activeMeasurements = (Uint32)activeMeasurements,
+        .dt = g_dt,
+        .dx = g_dx,
+        .mass = g_mass,
+        .drag = g_drag
+    };
+    for (size_t i = 0; i < activeMeasurements; i++) {
+        header.measurements[i][0] = measurements[i].x;
+        header.measurements[i][1] = measurements[i].y;
+    }
+    physicsCommand((PhysCommand) {.type = PHYS_SAVE, .checkpoint = header});
+}
+
+static void loadGame(const char *path) {
+    CheckpointHeader header;
+    void *planeData;
+    if (readCheckpoint(path, g_simBuffers[0].width, g_simBuffers[0].height, &header, &planeData)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't load checkpoint %s: %s", path, SDL_GetError());
+        return;
+    }
+
+    if (header.dt != g_dt || header.dx != g_dx || header.mass != g_mass || header.drag != g_drag) {
+        SDL_LogWarn(
+            SDL_LOG_CATEGORY_APPLICATION,
+            "Checkpoint %s was saved with different parameters (dt=%g, dx=%g, mass=%g, drag=%g)",
+            path, header.dt, header.dx, header.mass, header.drag
+        );
+    }
+
+    gameWon = header.gameWon;
+    score = header.score;
+    puttActive = 0;
+    activeMeasurements = SDL_min(header.activeMeasurements, MAX_MEASUREMENTS);
+    for (size_t i = 0; i < activeMeasurements; i++) {
+        measurements[i] = (SDL_Point) {.x = header.measurements[i][0], .y = header.measurements[i][1]};
+    }
+    measurementsVersion++;
+    initialSigma = header.initialSigma;
+    holePos = (SDL_FPoint) {.x = header.holeX, .y = header.holeY};
+    holeSigma = header.holeSigma;
+    physicsCommand((PhysCommand) {.type = PHYS_LOAD, .checkpoint = header, .checkpointData = planeData});
+
+    // As with resetGame, the old win probability mustn't carry over
+    view.winProbability = 0.f;
+    SDL_Log("Loaded checkpoint %s", path);
+}
+
+
+// Moves the FBOs of everything the physics thread renders to between
+// contexts (see releaseFrameBuffer).
+static int movePhysicsFrameBuffers(int recreate) {
+    TexturedFrameBuffer *bufs[] = {
+        &g_simBuffers[0], &g_simBuffers[1], &g_simSpare, &g_dragPot,
+        &g_potentialBuffer, &g_wallBuffer, &g_nextPotentialBuffer, &g_nextWallBuffer
+    };
+    PaddedPyramidBuffer *pyramids[] = {&g_pdfPyramid};
+
+    for (size_t i = 0; i < sizeof bufs / sizeof bufs[0]; i++) {
+        if (!recreate) releaseFrameBuffer(bufs[i]);
+        else if (recreateFrameBuffer(bufs[i])) return 1;
+    }
+
+    for (size_t i = 0; i < sizeof pyramids / sizeof pyramids[0]; i++) {
+        for (size_t j = 0; j < pyramids[i]->numLayers; j++) {
+            if (!recreate) releaseFrameBuffer(&pyramids[i]->layers[j].buf);
+            else if (recreateFrameBuffer(&pyramids[i]->layers[j].buf)) return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static void copyTexture(TexturedFrameBuffer *dst, GLuint src) {
+    glCopyImageSubData(
+        src, GL_TEXTURE_2D, 0, 0, 0, 0,
+        dst->texture, GL_TEXTURE_2D, 0, 0, 0, 0,
+        dst->width, dst->height, 1
+    );
+}
+
+static void publishSnapshot(unsigned commandsDone) {
+    PhysicsSnapshot *snapshot = &snapshots[backSnapshot];
+    if (snapshot->readFence) {
+        glWaitSync(snapshot->readFence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(snapshot->readFence);
+        snapshot->readFence = NULL;
+    }
+    beginComputingStats();
+    PhysicsView current = currentPhysicsView();
+    copyTexture(&snapshot->psi, current.psi);
+    copyTexture(&snapshot->pdf, current.pdf);
+    copyTexture(&snapshot->totalProb, current.totalProb);
+    if (courseAnimated) {
+        copyTexture(&snapshot->potential, current.potential);
+        copyTexture(&snapshot->wall, current.wall);
+    }
+
+    if (snapshot->fence) glDeleteSync(snapshot->fence);
+    snapshot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    // This waits for the stats, which is fine since we're not holding
+    // up any rendering, but it means the GPU idles briefly between
+    // batches of turns.
+    updateStats();
+    current.totalProbability = totalProbability;
+    current.winProbability = winProbability;
+    current.vortexCount = vortexCount;
+    current.psi = snapshot->psi.texture;
+    current.pdf = snapshot->pdf.texture;
+    current.totalProb = snapshot->totalProb.texture;
+    if (courseAnimated) {
+        current.potential = snapshot->potential.texture;
+        current.wall = snapshot->wall.texture;
+    }
+    snapshot->view = current;
+    snapshot->commandsDone = commandsDone;
+
+    SDL_LockMutex(physMutex);
+    backSnapshot = readySnapshot;
+    readySnapshot = (int)(snapshot - snapshots);
+    snapshotReady = 1;
+    SDL_CondBroadcast(publishedCond);
+    SDL_UnlockMutex(physMutex);
+}
+
+// Makes the latest snapshot the view.  The first time, this waits for
+// the first snapshot, since there's nothing to show until then.
+static void acquireSnapshot() {
+    int acquired = 0;
+    SDL_LockMutex(physMutex);
+    while (1) {
+        PhysicsSnapshot *ready = &snapshots[readySnapshot];
+        if (snapshotReady && (int)(ready->commandsDone - minCommandsDone) >= 0) {
+            // Everything reading the old front snapshot has been issued
+            // by now, and the fence must be flushed before the physics
+            // context can wait on it.
+            int front = frontSnapshot;
+            if (snapshots[front].readFence) glDeleteSync(snapshots[front].readFence);
+            snapshots[front].readFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+            frontSnapshot = readySnapshot;
+            readySnapshot = front;
+            snapshotReady = 0;
+            acquired = 1;
+            break;
+        }
+
+        if (view.psi != 0 || physQuit) break;
+        SDL_CondWait(publishedCond, physMutex);
+    }
+
+    SDL_Point points[MAX_MEASUREMENTS];
+    int newPoints = sampledVersion != seenSampledVersion;
+    if (newPoints) {
+        SDL_memcpy(points, sampledPoints, sizeof points);
+        seenSampledVersion = sampledVersion;
+    }
+    SDL_UnlockMutex(physMutex);
+
+    if (newPoints) showNewMeasurements(points);
+    if (acquired) {
+        viewVersion++;
+        glWaitSync(snapshots[frontSnapshot].fence, 0, GL_TIMEOUT_IGNORED);
+        setView(snapshots[frontSnapshot].view);
+    }
+}
+
+
+static int physicsThreadMain(void *data) {
+    (void) data;
+    FrameScheduler mainSched = sched;
+    int err = SDL_GL_MakeCurrent(g_window, physContext) != 0;
+    int current = !err;
+    if (current) {
+        initQuad();
+        initScheduler();
+        err = movePhysicsFrameBuffers(1);
+    }
+
+    SDL_LockMutex(physMutex);
+    physStarted = err? -1 : 1;
+    SDL_CondBroadcast(publishedCond);
+
+    Uint64 prev = SDL_GetPerformanceCounter();
+    double pfreq = (double)SDL_GetPerformanceFrequency();
+    double slopTime = 0.;
+    Uint64 lastSlice = prev;
+    unsigned commandsDone = 0;
+    while (!err && !physQuit) {
+        if (physQueueHead == physQueueTail && !physRunning && !puttSearchRunning()) {
+            SDL_CondWait(physCond, physMutex);
+            prev = SDL_GetPerformanceCounter();
+            slopTime = 0.;
+            continue;
+        }
+
+        PhysCommand commands[PHYS_QUEUE_SIZE];
+        unsigned numCommands = physQueueTail - physQueueHead;
+        for (unsigned i = 0; i < numCommands; i++) {
+            commands[i] = physQueue[physQueueHead++ % PHYS_QUEUE_SIZE];
+        }
+        int running = physRunning;
+        SDL_UnlockMutex(physMutex);
+
+        for (unsigned i = 0; i < numCommands; i++) {
+            runPhysicsCommand(&commands[i]);
+        }
+        commandsDone += numCommands;
+
+        Uint64 cur = SDL_GetPerformanceCounter();
+        slopTime += (double)(cur - prev) / pfreq;
+        prev = cur;
+
+        int turns = 0;
+        if (running) {
+            int turnsNeeded = (int) (slopTime * turnsPerSecond);
+            turns = turnsNeeded - doPhysics(turnsNeeded, 1. / SNAPSHOT_FPS);
+            slopTime = fmod(slopTime, 1. / turnsPerSecond);
+        } else {
+            slopTime = 0.;
+        }
+
+        // The search gets a slice with each physics frame, or every
+        // 1/SNAPSHOT_FPS seconds while paused.
+        int searchDue = puttSearchRunning() && (
+            numCommands || turns || (double)(cur - lastSlice) / pfreq >= 1. / SNAPSHOT_FPS
+        );
+        if (numCommands || turns) publishSnapshot(commandsDone);
+        if (searchDue) {
+            runSearchSlice(1. / SNAPSHOT_FPS, turns);
+            lastSlice = cur;
+        }
+        if (numCommands || turns) endSchedulerFrame();
+        else SDL_Delay(1);
+        collectObservables();
+
+        SDL_LockMutex(physMutex);
+    }
+
+    // Loads which never ran still have data to clean up
+    while (physQueueHead != physQueueTail) {
+        PhysCommand *cmd = &physQueue[physQueueHead++ % PHYS_QUEUE_SIZE];
+        free(cmd->checkpointData);
+    }
+    SDL_UnlockMutex(physMutex);
+
+    if (err) SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Physics thread failed to start: %s", SDL_GetError());
+    if (!current) return err;
+
+    movePhysicsFrameBuffers(0);
+    destroyScheduler();
+    sched = mainSched;
+    destroyQuad();
+    glFinish();
+    SDL_GL_MakeCurrent(g_window, NULL);
+    return err;
+}
+
+
+static void deleteSnapshots() {
+    for (int i = 0; i < NUM_SNAPSHOTS; i++) {
+        deleteTexturedFrameBuffer(&snapshots[i].psi);
+        deleteTexturedFrameBuffer(&snapshots[i].pdf);
+        deleteTexturedFrameBuffer(&snapshots[i].totalProb);
+        deleteTexturedFrameBuffer(&snapshots[i].potential);
+        deleteTexturedFrameBuffer(&snapshots[i].wall);
+        if (snapshots[i].fence) glDeleteSync(snapshots[i].fence);
+        if (snapshots[i].readFence) glDeleteSync(snapshots[i].readFence);
+        snapshots[i] = (PhysicsSnapshot) {0};
+    }
+}
+
+static void stopPhysicsThread() {
+    if (!physicsThreaded) return;
+    if (physThread != NULL) {
+        SDL_LockMutex(physMutex);
+        physQuit = 1;
+        SDL_CondSignal(physCond);
+        SDL_UnlockMutex(physMutex);
+        SDL_WaitThread(physThread, NULL);
+        physThread = NULL;
+    }
+
+    // The physics thread has released its FBOs, so take them back
+    movePhysicsFrameBuffers(1);
+    deleteSnapshots();
+    SDL_GL_DeleteContext(physContext);
+    physContext = NULL;
+    SDL_DestroyCond(publishedCond);
+    SDL_DestroyCond(physCond);
+    SDL_DestroyMutex(physMutex);
+    physicsThreaded = 0;
+}
+
+// Starts the physics thread if $PICOPUTT_PHYSICS_THREAD is set (to
+// anything but 0).  If the thread can't be started, physics just stays
+// on the main thread.
+static void startPhysicsThread() {
+    const char *env = getenv("PICOPUTT_PHYSICS_THREAD");
+    if (env == NULL || env[0] == '\0' || SDL_strcmp(env, "0") == 0) return;
+
+    PaddedPyramidLayer *pdfTop = &g_pdfPyramid.layers[g_pdfPyramid.numLayers - 1];
+    for (int i = 0; i < NUM_SNAPSHOTS; i++) {
+        if (initTexturedFrameBuffer(&snapshots[i].psi, g_simBuffers[0].width, g_simBuffers[0].height, GL_RG32F, 1) ||
+            initTexturedFrameBuffer(&snapshots[i].pdf, g_pdfPyramid.layers[0].buf.width, g_pdfPyramid.layers[0].buf.height, GL_R32F, 1) ||
+            initTexturedFrameBuffer(&snapshots[i].totalProb, pdfTop->buf.width, pdfTop->buf.height, GL_R32F, 1) ||
+            (courseAnimated && (
+                initTexturedFrameBuffer(&snapshots[i].potential, g_potentialBuffer.width, g_potentialBuffer.height, GL_R32F, 1) ||
+                initTexturedFrameBuffer(&snapshots[i].wall, g_wallBuffer.width, g_wallBuffer.height, GL_RED, 1)
+            ))) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create physics snapshots: %s", SDL_GetError());
+            deleteSnapshots();
+            return;
+        }
+    }
+
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+    physContext = SDL_GL_CreateContext(g_window);
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+    // Creating a context makes it current
+    SDL_GL_MakeCurrent(g_window, g_GLContext);
+    if (physContext == NULL) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create physics context: %s", SDL_GetError());
+        deleteSnapshots();
+        return;
+    }
+
+    // Everything the physics thread uses must be complete before it
+    // starts using it from the other context.
+    movePhysicsFrameBuffers(0);
+    glFinish();
+
+    physMutex = SDL_CreateMutex();
+    physCond = SDL_CreateCond();
+    publishedCond = SDL_CreateCond();
+    physQueueHead = physQueueTail = minCommandsDone = 0;
+    physRunning = physQuit = physStarted = 0;
+    backSnapshot = 0;
+    readySnapshot = 1;
+    frontSnapshot = 2;
+    snapshotReady = 0;
+    physicsThreaded = 1;
+    physThread = SDL_CreateThread(physicsThreadMain, "physics", NULL);
+
+    int started = physThread != NULL;
+    if (started) {
+        SDL_LockMutex(physMutex);
+        while (physStarted == 0) SDL_CondWait(publishedCond, physMutex);
+        started = physStarted == 1;
+        SDL_UnlockMutex(physMutex);
+    }
+
+    if (!started) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Couldn't start physics thread, running physics on the main thread");
+        stopPhysicsThread();
+        return;
+    }
+
+    SDL_Log("Running physics on its own thread, set by $PICOPUTT_PHYSICS_THREAD");
+}
+
+
 void resetGame() {
     gameWon = 0;
     puttActive = 0;
@@ -930,62 +2427,187 @@ void resetGame() {
     debugView = 0;
     score = 0;
     activeMeasurements = 0;
+    updateDisplayInfo();
 
-    float simWidth = dx * (float)g_simBuffers[0].width;
-    float simHeight = dx * (float)g_simBuffers[0].height;
+    float simWidth = g_dx * (float)g_simBuffers[0].width;
+    float simHeight = g_dx * (float)g_simBuffers[0].height;
     initialSigma = 0.03f * simHeight;
-    initPhysics(0.2f * simWidth, 0.5f * simHeight, initialSigma);
 
     float holeRadius = 0.2f*simHeight;
     float holeDepth = 0.05f;
-    float holeSigma = sqrtf(holeRadius/M_PI)*powf(2.f/mass/holeDepth, 0.25f);
+    holeSigma = sqrtf(holeRadius/M_PI)*powf(2.f/g_mass/holeDepth, 0.25f);
     holePos = (SDL_FPoint) {.x = simWidth-0.45f*simHeight, .y = 0.5f*simHeight};
-    setGaussianWavepacket(&g_goalState, holePos.x, holePos.y, holeSigma, dx);
     // initPhysics(holePos.x, holePos.y, holeSigma);
 
     // setPlaneWavePutt(0.5f, 0.f);
     // applyPutt();
-    beginComputingStats();
+    physicsCommand((PhysCommand) {
+        .type = PHYS_RESET,
+        .pos = {.x = 0.2f * simWidth, .y = 0.5f * simHeight},
+        .sigma = initialSigma,
+        .holePos = holePos,
+        .holeSigma = holeSigma
+    });
+
+    // The win probability of the old game mustn't carry over
+    view.winProbability = 0.f;
 }
 
-int gameLoop() {
+static unsigned suggestionVersion = 0;
+
+static void logPuttSuggestion(const PuttSuggestion *s) {
+    SDL_Log(
+        "Suggested putt (best of %d): direction %.0f degrees, momentum %.3f, club size %.2f, P(win) %.3f",
+        s->candidates, atan2f(s->putt.py, s->putt.px) * 180.f / (float)M_PI,
+        hypotf(s->putt.px, s->putt.py), s->putt.clubSize, s->winProbability
+    );
+}
+
+// With $PICOPUTT_COMPUTE_PAR set (to anything but 0), par is computed
+// at startup by searching for the best putt, then for the best putt
+// from wherever that one leaves the ball, and so on until one is
+// predicted to win.  This takes a while, so it's meant for finding par
+// for new courses rather than for every game.  Must be called before
+// the physics thread is started.
+static void computePar() {
+    const char *env = getenv("PICOPUTT_COMPUTE_PAR");
+    if (env == NULL || env[0] == '\0' || SDL_strcmp(env, "0") == 0) return;
+    SDL_Log("Computing par, set by $PICOPUTT_COMPUTE_PAR");
+    TRACE_BEGIN("computePar");
+
+    resetGame();
+    int err = startPuttSearch(&g_simBuffers[curBuf], &g_simBuffers[1 - curBuf], &g_dragPot, SEARCH_HORIZON_TURNS);
+    int putts = 1;
+    int won = 0;
+    while (!err) {
+        while (!updatePuttSearch(PAR_SLICE_TURNS, 1) && puttSearchRunning());
+
+        PuttSuggestion suggestion;
+        if (!pollPuttSuggestion(&suggestion, &suggestionVersion)) {
+            // The search failed, and has already said why
+            err = 1;
+            break;
+        }
+
+        logPuttSuggestion(&suggestion);
+        won = suggestion.winProbability >= winThreshold;
+        if (won || putts == PAR_MAX_PUTTS) break;
+        putts++;
+        err = continuePuttSearch(SEARCH_HORIZON_TURNS);
+    }
+
+    TRACE_END();
+    if (err) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't compute par: %s", SDL_GetError());
+        return;
+    }
+
+    if (!won) SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "No putts found which win within %d putts", PAR_MAX_PUTTS);
+    par = 2 * putts;
+    SDL_Log("Par for this course: %d", putts);
+}
+
+// Moves to the next debug view in the direction of step (or stays put
+// with step 0) which can be shown.  The drag views read g_dragLIP and
+// g_dragPot directly, which the physics thread writes while it runs
+// (they aren't in the snapshots), so they're skipped when it does.
+static void stepDebugView(int step) {
+    debugViewIdx += step;
+    while (physicsThreaded && (debugViewIdx % 4 == 0 || (debugViewIdx-3) % 4 == 0)) {
+        debugViewIdx += step? step : 1;
+    }
+}
+
+// Runs the game until it quits or fails to start, leaving the cleanup
+// to finishGame (whichever way it returns).
+static int runGame() {
     Uint64 prev = SDL_GetPerformanceCounter();
     double slopTime = 0.;
     unsigned frame = 0;
-    // TODO: perfQuery never gets deleted, and probably should be
-    //  created elsewhere (really should be part of physics system, but
-    //  I need to separate that out)
-    glGenQueries(1, &perfQuery);
+    initScheduler();
+    // This must come before resetGame, since rebuilding the programs
+    // loses their uniforms.
+    ShaderConstants constants = {.fourMDx2 = 4.f * g_mass * g_dx * g_dx, .drag = g_drag, .stencilOrder = getStencilOrder()};
+    if (setShaderConstants(constants)) return 1;
+    courseAnimated = g_coursePotential.u_time != -1 || g_courseWall.u_time != -1;
+    if (courseAnimated) SDL_Log("Course is animated");
+    if (controlTimestep(&constants)) return 1;
+    TRACE_GPU_BEGIN("tuneQTurn");
+    int err = tuneQTurn(constants);
+    TRACE_GPU_END();
+    if (err || benchmarkStencils(constants)) return 1;
+    initPuttSearch();
+    initObservables();
+    initVortices();
+    computePar();
+    // The physics thread saves checkpoints, so the worker must be ready
+    // before it starts.
+    initCheckpointing();
+    startPhysicsThread();
+    initRenderScale();
     resetGame();
 
+    const char *startCheckpoint = getenv("PICOPUTT_LOAD_CHECKPOINT");
+    if (startCheckpoint != NULL && startCheckpoint[0] != '\0') loadGame(startCheckpoint);
+
+    int idle = 0;  // Whether the last frame was skipped
+    int gotEvents = 1;
     while (1) {
-        SDL_GL_SwapWindow(g_window);
+        if (!idle) {
+            TRACE_BEGIN("SDL_GL_SwapWindow");
+            SDL_GL_SwapWindow(g_window);
+            TRACE_END();
+        } else if (!gotEvents) {
+            // Nothing on screen would change, so there's no point in
+            // drawing anything until something happens.
+            TRACE_BEGIN("SDL_WaitEventTimeout");
+            SDL_WaitEventTimeout(NULL, IDLE_WAIT_MS);
+            TRACE_END();
+        }
+        int wasIdle = idle;
+        // The frame scope covers everything between buffer swaps
+        if (frame > 0) TRACE_END();
+        traceFrame();
+        TRACE_BEGIN("Frame");
         Uint64 cur = SDL_GetPerformanceCounter();
         double pfreq = (double)SDL_GetPerformanceFrequency();
         double frameDuration = (double)(cur - prev) / pfreq;
         slopTime += frameDuration;
         prev = cur;
 
-        int skippedTurns;
-        if (!paused && !puttActive) {
-            skippedTurns = doPhysics(
-                (int) (slopTime * PHYS_TURNS_PER_SECOND),
-                1. / MIN_FPS
-            );
-            slopTime = fmod(slopTime, 1. / PHYS_TURNS_PER_SECOND);
+        int skippedTurns = 0;
+        if (physicsThreaded) {
+            // The physics thread keeps its own time, so only the putt
+            // animation uses slopTime.
+            setPhysicsRunning(!paused && !puttActive);
+        }
+
+        int physicsTurns = 0;
+        if (!paused && !puttActive && !physicsThreaded) {
+            TRACE_GPU_BEGIN("doPhysics");
+            int turnsNeeded = (int) (slopTime * turnsPerSecond);
+            skippedTurns = doPhysics(turnsNeeded, displayFrameTime);
+            physicsTurns = turnsNeeded - skippedTurns;
+            if (turnsNeeded > skippedTurns) viewVersion++;
+            TRACE_GPU_END();
+            slopTime = fmod(slopTime, 1. / turnsPerSecond);
+            TRACE_GPU_BEGIN("beginComputingStats");
             beginComputingStats();
+            TRACE_GPU_END();
         } else if (puttActive) {
-            int mouseX, mouseY;
-            SDL_GetMouseState(&mouseX, &mouseY);
+            SDL_Point mouse = getDrMouseState();
             // TODO: actually choose momentum sensibly
             //  Also, possibly we may want the putt wave we show to be
             //  different than the putt wave we use.
-            float px = 8e-4f*(float)(mouseX - puttStart.x);
-            float py = 8e-4f*(float)(puttStart.y - mouseY);
-            puttPhase += hypotf(px, py) * 0.5f * PHYS_TURNS_PER_SECOND * dt * (float)slopTime / mass;
+            // The momentum is in screen units so that putts feel the
+            // same regardless of DPI.
+            float scPerDr = (float)g_scWidth / (float)g_drWidth;
+            float px = 8e-4f*scPerDr*(float)(mouse.x - puttStart.x);
+            float py = 8e-4f*scPerDr*(float)(puttStart.y - mouse.y);
+            puttPhase += hypotf(px, py) * 0.5f * (float)turnsPerSecond * g_dt * (float)slopTime / g_mass;
             slopTime = 0.;  // slopTime is fully consumed by the putt animation
             puttPhase = fmodf(puttPhase, 2.*M_PI);
-            setPutt(simPixelPos(puttStart), clubPixSize(), px, py, puttPhase);
+            aimedPutt = (Putt) {.origin = simPixelPos(puttStart), .clubRadius = clubPixSize(), .px = px, .py = py};
         } else {
             // If slopTime isn't used, it still needs to be reset to 0
             // (fully consumed by the frame).
@@ -995,116 +2617,227 @@ int gameLoop() {
             slopTime = 0.;
         }
 
+        // The search runs even while paused
+        if (!physicsThreaded) {
+            TRACE_GPU_BEGIN("updatePuttSearch");
+            runSearchSlice(displayFrameTime, physicsTurns);
+            TRACE_GPU_END();
+            collectObservables();
+        }
+
+        PuttSuggestion suggestion;
+        if (pollPuttSuggestion(&suggestion, &suggestionVersion)) logPuttSuggestion(&suggestion);
+
         // if (frame == 0) paused = 1;
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        if (debugView) {
-            if (debugViewIdx % 4 == 0) renderDebug(g_dragLIP.layers[0].texture, 1e-3f, 0.f, 0.f, 0.f);
-            else if ((debugViewIdx-1) % 4 == 0) renderDebug(g_simBuffers[curBuf].texture, 1e-3f, 1.f, 0.f, 0.f);
-            else if ((debugViewIdx-2) % 4 == 0) renderDebug(g_goalPyramid.layers[0].buf.texture, 1e-5f, 2.f, 0.f, 0.f);
-            else renderDebug(g_dragPot.texture, 5e-2f, 3.f, 0.f, 0.f);
-        } else renderGame(paused||puttActive? 0.f:(float)frameDuration, !gameWon);
+        if (physicsThreaded) acquireSnapshot();
+        else setView(currentPhysicsView());
+
+        // The contours crawl and the putt animates unless paused
+        SDL_Point mouse = getDrMouseState();
+        int animated = !debugView && (!paused || puttActive);
+        int clubSizeKey;
+        SDL_memcpy(&clubSizeKey, &clubSize, sizeof clubSizeKey);
+        int sceneKey[SCENE_KEY_SIZE] = {
+            (int)viewVersion, g_drWidth, g_drHeight, mouse.x, mouse.y,
+            debugView, debugViewIdx, !gameWon, clubSizeKey,
+            (int)lroundf(1000.f * renderScale), fancyGraphics
+        };
+
+        // Over a static scene, only the hole arrow animates, and it
+        // stops while paused, so once the game is paused (or won) and
+        // nothing else happens, the frame can be skipped.
+        idle = !gotEvents && (paused || gameWon) && !animated && sceneCacheValid &&
+            (physicsThreaded || !puttSearchRunning()) &&
+            SDL_memcmp(sceneKey, sceneCacheKey, sizeof sceneKey) == 0;
+        gotEvents = 0;
+
+        if (!idle) {
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            TRACE_GPU_BEGIN("Render");
+            if (beginCachedScene(sceneKey, !animated)) {
+                if (debugView) {
+                    if (debugViewIdx % 4 == 0) renderDebug(g_dragLIP.layers[0].texture, 1e-3f, 0.f, 0.f, 0.f);
+                    // Only the sim buffer and PDF come from the snapshot, so
+                    //  the others aren't shown with the physics thread (see
+                    //  stepDebugView).
+                    else if ((debugViewIdx-1) % 4 == 0) renderDebug(view.psi, 1e-3f, 1.f, 0.f, 0.f);
+                    else if ((debugViewIdx-2) % 4 == 0) renderDebug(view.pdf, 1e-3f, 2.f, 0.f, 0.f);
+                    else renderDebug(g_dragPot.texture, 5e-2f, 3.f, 0.f, 0.f);
+                } else renderGame(paused||puttActive? 0.f:(float)frameDuration, !gameWon);
+                endCachedScene(sceneKey, !animated);
+            }
+            TRACE_GPU_END();
+
+            TRACE_GPU_BEGIN("Text");
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            showMeasurements();
+            if (!physicsThreaded) {
+                TRACE_BEGIN("updateStats");
+                updateStats();
+                TRACE_END();
+                view.totalProbability = totalProbability;
+                view.winProbability = winProbability;
+                view.vortexCount = vortexCount;
+            }
 
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        showMeasurements();
-        updateStats();
-        if (winProbability >= winThreshold) {
-            paused = paused || !gameWon;
-            gameWon = 1;
-            puttActive = 0;  // currently unnecessary
-        }
-        renderStatusBar();
+            if (view.winProbability >= winThreshold) {
+                paused = paused || !gameWon;
+                gameWon = 1;
+                puttActive = 0;  // currently unnecessary
+            }
+            renderStatusBar();
 
-        if (!gameWon) {
-            renderHoleArrow((float)frameDuration);
-        }
+            if (!gameWon) {
+                renderHoleArrow(paused? 0.f : (float)frameDuration);
+            }
+
+            if (gameWon) {
+                renderWinScreen();
+            }
 
-        if (gameWon) {
-            renderWinScreen();
+            renderFPS(frameDuration);
+            glDisable(GL_BLEND);
+            TRACE_GPU_END();
+
+            captureFrame(view.psi, view.pdf);
         }
 
-        renderFPS(1./frameDuration);
-        glDisable(GL_BLEND);
+        // Time spent waiting while idle isn't a slow frame
+        static unsigned long lastDroppedTurns = 0;
+        if (!idle && !wasIdle) governRenderScale(frameDuration, view.droppedTurns - lastDroppedTurns);
+        lastDroppedTurns = view.droppedTurns;
 
         SDL_Event e;
-        while (SDL_PollEvent(&e)) switch (e.type) {
-            case SDL_QUIT:
-                return 0;
-            case SDL_MOUSEWHEEL:
-                if (gameWon) break;
-                clubSize += 0.1f*e.wheel.preciseY;
-                clubSize = SDL_clamp(clubSize, 0.f, 1.f);
-                break;
-            case SDL_MOUSEBUTTONDOWN:
-                if (gameWon) break;
-                // TODO: maybe use SDL_SetRelativeMouseMode(SDL_TRUE) in putt mode
-                puttActive = 1;
-                puttPhase = 0.f;
-                // TODO: I believe that SDL_GetMouseState gives results in screen coordinates,
-                //  but we treat them as if they are in draw coordinates
-                SDL_GetMouseState(&puttStart.x, &puttStart.y);
-                break;
-            case SDL_MOUSEBUTTONUP:
-                if (puttActive) {
-                    puttActive = 0;
-                    applyPutt();
-                    beginComputingStats();  // Update stats even when paused
-                    score += 2; // 2/2
-                }
-                break;
-            case SDL_KEYDOWN:
-                if (e.key.keysym.sym == SDLK_f) {
-                    SDL_Log(
-                        "fps:%f, skippedTurns:%d, turns per second: %f (actual) / %f (estimated max)",
-                        1./frameDuration, skippedTurns, perfQueryTurns / frameDuration, maxTurnsPerSecond
-                    );
-
-                    SDL_Log("P(win): %f, P(total): %f", winProbability, totalProbability);
-                } else if (e.key.keysym.sym == SDLK_p) {
-                    paused = !paused;
-                    activeMeasurements = 0;
-                } else if (e.key.keysym.sym == SDLK_d) {
-                    debugView = !debugView;
-                } else if (e.key.keysym.sym == SDLK_LEFT) {
-                    if (debugView) debugViewIdx--;
-                } else if (e.key.keysym.sym == SDLK_RIGHT) {
-                    if (debugView) debugViewIdx++;
-                } else if (e.key.keysym.sym == SDLK_SPACE) {
+        while (SDL_PollEvent(&e)) {
+            gotEvents = 1;
+            switch (e.type) {
+                case SDL_QUIT:
+                    return 0;
+                case SDL_WINDOWEVENT:
+                    // Also happens when the window moves to a display with
+                    // a different DPI
+                    if (e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                        updateWindowSize();
+                        updateDisplayInfo();
+                    } else if (e.window.event == SDL_WINDOWEVENT_MOVED) {
+                        // For the refresh rate, if it's on another display
+                        updateDisplayInfo();
+                    }
+                    break;
+                case SDL_MOUSEWHEEL:
                     if (gameWon) break;
-                    doMeasurement(initialSigma);
-                    score += 1; // 1/2
-                } else if (e.key.keysym.sym == SDLK_m) {
-                    makeMeasurements();
-                    paused = 1;
-                } else if (e.key.keysym.sym == SDLK_r) {
-                    resetGame();
-                } else if (e.key.keysym.sym == SDLK_ESCAPE) {
-                    puttActive = 0;
-                }
-                break;
+                    clubSize += 0.1f*e.wheel.preciseY;
+                    clubSize = SDL_clamp(clubSize, 0.f, 1.f);
+                    break;
+                case SDL_MOUSEBUTTONDOWN:
+                    if (gameWon) break;
+                    // TODO: maybe use SDL_SetRelativeMouseMode(SDL_TRUE) in putt mode
+                    puttActive = 1;
+                    puttPhase = 0.f;
+                    puttStart = getDrMouseState();
+                    aimedPutt = (Putt) {.origin = simPixelPos(puttStart), .clubRadius = clubPixSize()};
+                    break;
+                case SDL_MOUSEBUTTONUP:
+                    if (puttActive) {
+                        puttActive = 0;
+                        // Stats are updated even when paused
+                        physicsCommand((PhysCommand) {.type = PHYS_PUTT, .putt = aimedPutt});
+                        score += 2; // 2/2
+                    }
+                    break;
+                case SDL_KEYDOWN:
+                    if (e.key.keysym.sym == SDLK_f) {
+                        SDL_Log(
+                            "fps:%f, skippedTurns:%d, turns per second: %f (actual) / %f (estimated max)",
+                            1./frameDuration, skippedTurns, view.perfQueryTurns / frameDuration, view.maxTurnsPerSecond
+                        );
+
+                        SDL_Log("P(win): %f, P(total): %f", view.winProbability, view.totalProbability);
+                    } else if (e.key.keysym.sym == SDLK_p) {
+                        paused = !paused;
+                        activeMeasurements = 0;
+                    } else if (e.key.keysym.sym == SDLK_d) {
+                        debugView = !debugView;
+                        if (debugView) stepDebugView(0);
+                    } else if (e.key.keysym.sym == SDLK_LEFT) {
+                        if (debugView) stepDebugView(-1);
+                    } else if (e.key.keysym.sym == SDLK_RIGHT) {
+                        if (debugView) stepDebugView(1);
+                    } else if (e.key.keysym.sym == SDLK_SPACE) {
+                        if (gameWon) break;
+                        physicsCommand((PhysCommand) {.type = PHYS_MEASURE, .sigma = initialSigma});
+                        score += 1; // 1/2
+                    } else if (e.key.keysym.sym == SDLK_m) {
+                        physicsCommand((PhysCommand) {.type = PHYS_SAMPLE});
+                        paused = 1;
+                    } else if (e.key.keysym.sym == SDLK_r) {
+                        resetGame();
+                    } else if (e.key.keysym.sym == SDLK_h) {
+                        if (gameWon) break;
+                        SDL_Log("Searching for a putt...");
+                        physicsCommand((PhysCommand) {.type = PHYS_SEARCH});
+                    } else if (e.key.keysym.sym == SDLK_F5) {
+                        saveGame();
+                    } else if (e.key.keysym.sym == SDLK_F9) {
+                        loadGame(checkpointPath);
+                    } else if (e.key.keysym.sym == SDLK_ESCAPE) {
+                        puttActive = 0;
+                    }
+                    break;
+            }
         }
 
         const Uint8 *keys = SDL_GetKeyboardState(NULL);
         if (keys[SDL_SCANCODE_LEFTBRACKET]) {
             clubSize -= (float)frameDuration;
             clubSize = SDL_max(clubSize, 0.f);
+            gotEvents = 1;
         } else if (keys[SDL_SCANCODE_RIGHTBRACKET]) {
             clubSize += (float)frameDuration;
             clubSize = SDL_min(clubSize, 1.f);
+            gotEvents = 1;
         }
 
+        if (!physicsThreaded) endSchedulerFrame();
         processGlErrors(NULL);
         frame++;
     }
 }
 
+// Safe to call however far runGame got, since each of these only cleans
+// up what was started.
+static void finishGame() {
+    stopPhysicsThread();
+    // Saves queued by the physics thread still finish
+    finishCheckpoints();
+    finishPuttSearch();
+    finishObservables();
+    finishVortices();
+    destroyTextBlocks();
+    deleteTexturedFrameBuffer(&sceneBuffer);
+    deleteTexturedFrameBuffer(&sceneCache);
+    // Once the physics thread has given back the main scheduler
+    destroyScheduler();
+}
+
+int gameLoop() {
+    int err = runGame();
+    finishGame();
+    return err;
+}
+
 float clubPixSize() {
+    return clubPixSizeFor(clubSize);
+}
+
+float clubPixSizeFor(float size) {
     GLsizei minDim = SDL_min(g_simBuffers[0].width, g_simBuffers[0].height);
     GLsizei maxDim = SDL_max(g_simBuffers[0].width, g_simBuffers[0].height);
 
     float minPixSize = 0.1f * (float)minDim;
     float maxPixSize = 0.4f * (float)maxDim;
 
-    return (1.f - clubSize) * minPixSize + clubSize * maxPixSize;
+    return (1.f - size) * minPixSize + size * maxPixSize;
 }
@@ -1,8 +1,28 @@
 #ifndef PICOPUTT_LOOP_H
 #define PICOPUTT_LOOP_H
 #include "resources.h"
+
+// Simulation parameters
+extern float g_dt;
+extern float g_dx;
+extern float g_mass;
+extern float g_drag;
+
+// The programs for runDrag, which must have been compiled with config
+typedef struct {
+    ProgInitLIP *init;
+    ProgBuildLIP *build;
+    ProgLIPKiss *kiss;
+    ProgIntegrateLIP *integrate;  // x then y
+    LIPConfig config;
+} DragPrograms;
+
 int gameLoop();
 float clubPixSize();
+float clubPixSizeFor(float size);
 void updateDisplayInfo();
+void updateDragPotential(int cur);
+void runDrag(const DragPrograms *progs, PyramidBuffer *lip, GLuint pot, int cur, GLsizei lanes);
+void setGaussianWavepacket(TexturedFrameBuffer *tfb, float x0, float y0, float sigma, float dx_);
 void uniformDisplayRelative(ProgSurface prog, float scale, SDL_Point drCenter);
 #endif //PICOPUTT_LOOP_H
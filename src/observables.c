@@ -0,0 +1,224 @@
+#include "observables.h"
+#include <GL/glew.h>
+#include <SDL.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "loop.h"
+#include "resources.h"
+#include "utils.h"
+
+// Must match observables.comp
+#define OBS_GROUP 16
+// Samples which can be in flight on the GPU at once.  If they're all
+// still pending, samples are dropped.
+#define OBS_SLOTS 32
+
+typedef struct {
+    GLsync fence;
+    unsigned long turn;
+    float time;
+    unsigned generation;  // See rebaseObservables
+} PendingSample;
+
+int g_observableInterval = 0;
+
+static SDL_mutex *ringMutex = NULL;
+// Protected by ringMutex
+static ObservableSample ring[OBSERVABLE_RING];
+static unsigned long ringCount = 0;
+
+// Only used by the thread running physics
+static GLuint partials;
+static GLuint results;
+static GLsizei numGroupsX;
+static GLsizei numGroupsY;
+static PendingSample pending[OBS_SLOTS];
+static unsigned pendingHead, pendingTail;
+static unsigned long turns;
+static unsigned long droppedSamples;
+static unsigned generation;
+static unsigned refGeneration = ~0u;
+static float refNorm;
+static FILE *logFile = NULL;
+
+
+void initObservables() {
+    const char *env = getenv("PICOPUTT_OBSERVABLES");
+    if (env == NULL || env[0] == '\0') return;
+    int interval = SDL_atoi(env);
+    if (interval < 1) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Ignoring $PICOPUTT_OBSERVABLES=%s (must be a number of turns)", env);
+        return;
+    }
+
+    ringMutex = SDL_CreateMutex();
+    if (ringMutex == NULL) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create observables mutex: %s", SDL_GetError());
+        return;
+    }
+
+    const char *path = getenv("PICOPUTT_OBSERVABLES_LOG");
+    if (path != NULL && path[0] != '\0') {
+        if ((logFile = fopen(path, "w")) == NULL) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't open %s for writing", path);
+        } else {
+            fprintf(logFile, "turn,time,norm,norm_drift,energy,x,y,px,py,spread_x,spread_y\n");
+        }
+    }
+
+    numGroupsX = (g_simBuffers[0].width + OBS_GROUP - 1) / OBS_GROUP;
+    numGroupsY = (g_simBuffers[0].height + OBS_GROUP - 1) / OBS_GROUP;
+    glGenBuffers(1, &partials);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, partials);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)numGroupsX * numGroupsY * 8 * sizeof(float), NULL, GL_DYNAMIC_COPY);
+    glGenBuffers(1, &results);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, results);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, OBS_SLOTS * 8 * sizeof(float), NULL, GL_DYNAMIC_READ);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    g_observableInterval = interval;
+    SDL_Log("Sampling observables every %d turns", interval);
+}
+
+void resetObservables() {
+    turns = 0;
+    rebaseObservables();
+}
+
+void rebaseObservables() {
+    generation++;
+}
+
+static void beginSample(int cur) {
+    if (pendingTail - pendingHead == OBS_SLOTS) {
+        droppedSamples++;
+        return;
+    }
+
+    PendingSample *sample = &pending[pendingTail % OBS_SLOTS];
+    GLint slot = (GLint)(pendingTail % OBS_SLOTS);
+    pendingTail++;
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, partials);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, results);
+
+    glUseProgram(g_observables.prog.id);
+    glUniform1i(g_observables.u_cur, 0 + cur);
+    glUniform1i(g_observables.u_prev, 0 + 1 - cur);
+    glUniform1i(g_observables.u_potential, 2);
+    glUniform1i(g_observables.u_dragPot, 3);
+    glUniform1i(g_observables.u_wall, 4);
+    glDispatchCompute((GLuint)numGroupsX, (GLuint)numGroupsY, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glUseProgram(g_observablesSum.prog.id);
+    glUniform1i(g_observablesSum.u_numPartials, numGroupsX * numGroupsY);
+    glUniform1i(g_observablesSum.u_slot, slot);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+
+    sample->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    sample->turn = turns;
+    sample->time = 2.f * g_dt * (float)turns;
+    sample->generation = generation;
+}
+
+void observeTurn(int cur) {
+    if (!g_observableInterval) return;
+    turns++;
+    if (turns % (unsigned long)g_observableInterval == 0) beginSample(cur);
+}
+
+// Turns the sums from observables.comp into a sample.  See the shader
+// for the units of the sums.
+static ObservableSample finishSample(const PendingSample *p, const float r[8]) {
+    float width = (float)g_simBuffers[0].width;
+    float height = (float)g_simBuffers[0].height;
+    ObservableSample s = {.turn = p->turn, .time = p->time, .norm = r[0] * g_dx * g_dx};
+    if (r[0] <= 0.f) return s;
+
+    SDL_FPoint mean = {.x = r[2] / r[0], .y = r[3] / r[0]};
+    s.energy = r[1] / r[0];
+    s.position = (SDL_FPoint) {.x = g_dx * (mean.x + 0.5f * width), .y = g_dx * (mean.y + 0.5f * height)};
+    s.momentum = (SDL_FPoint) {.x = r[6] / (2.f * g_dx * r[0]), .y = r[7] / (2.f * g_dx * r[0])};
+    s.spread = (SDL_FPoint) {
+        .x = g_dx * sqrtf(SDL_max(r[4] / r[0] - mean.x * mean.x, 0.f)),
+        .y = g_dx * sqrtf(SDL_max(r[5] / r[0] - mean.y * mean.y, 0.f))
+    };
+
+    if (p->generation != refGeneration) {
+        refGeneration = p->generation;
+        refNorm = s.norm;
+    }
+    s.normDrift = s.norm - refNorm;
+    return s;
+}
+
+void collectObservables() {
+    if (!g_observableInterval) return;
+
+    int collected = 0;
+    while (pendingHead != pendingTail) {
+        PendingSample *p = &pending[pendingHead % OBS_SLOTS];
+        GLenum status = glClientWaitSync(p->fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED) break;
+        glDeleteSync(p->fence);
+        GLint slot = (GLint)(pendingHead % OBS_SLOTS);
+        pendingHead++;
+        if (status == GL_WAIT_FAILED) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Waiting for observables failed: %s", getGlErrorString(glGetError()));
+            continue;
+        }
+
+        float r[8];
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, results);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, (GLintptr)slot * sizeof r, sizeof r, r);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        ObservableSample s = finishSample(p, r);
+
+        SDL_LockMutex(ringMutex);
+        ring[ringCount++ % OBSERVABLE_RING] = s;
+        SDL_UnlockMutex(ringMutex);
+
+        if (logFile) {
+            fprintf(
+                logFile, "%lu,%g,%.9g,%.9g,%.9g,%g,%g,%g,%g,%g,%g\n",
+                s.turn, s.time, s.norm, s.normDrift, s.energy, s.position.x, s.position.y,
+                s.momentum.x, s.momentum.y, s.spread.x, s.spread.y
+            );
+        }
+        collected = 1;
+    }
+
+    if (collected && logFile) fflush(logFile);
+}
+
+int readObservables(ObservableSample *out, int max) {
+    if (!g_observableInterval) return 0;
+    SDL_LockMutex(ringMutex);
+    unsigned long n = SDL_min(ringCount, (unsigned long)SDL_min(max, OBSERVABLE_RING));
+    for (unsigned long i = 0; i < n; i++) {
+        out[i] = ring[(ringCount - n + i) % OBSERVABLE_RING];
+    }
+    SDL_UnlockMutex(ringMutex);
+    return (int)n;
+}
+
+void finishObservables() {
+    if (!g_observableInterval) return;
+    while (pendingHead != pendingTail) glDeleteSync(pending[pendingHead++ % OBS_SLOTS].fence);
+    glDeleteBuffers(1, &partials);
+    glDeleteBuffers(1, &results);
+    if (droppedSamples) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Dropped %lu observable samples", droppedSamples);
+    }
+    if (logFile) fclose(logFile);
+    logFile = NULL;
+    SDL_DestroyMutex(ringMutex);
+    ringMutex = NULL;
+    g_observableInterval = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef PICOPUTT_OBSERVABLES_H
+#define PICOPUTT_OBSERVABLES_H
+#include <GL/glew.h>
+#include <SDL.h>
+
+// Physical observables of the simulation, for checking that changes to
+// the solver (stencils, precision, dt) keep it stable: the norm and the
+// energy should stay constant between putts and measurements.  They're
+// sampled every $PICOPUTT_OBSERVABLES turns (off if unset), with all of
+// them computed in a single read of psi (see observables.comp), and
+// collected asynchronously into a ring of samples.  If
+// $PICOPUTT_OBSERVABLES_LOG is set, every sample is also appended to
+// that file as CSV, for runs without anyone watching the overlay.
+
+// Number of samples kept in the ring
+#define OBSERVABLE_RING 1024
+
+typedef struct {
+    unsigned long turn;   // Turns since the game was reset or loaded
+    float time;           // Simulated time since the reset, 2*dt per turn
+    float norm;           // Total probability
+    float normDrift;      // Change in norm since the state was last changed by a command
+    float energy;         // <H>, including the drag potential
+    SDL_FPoint position;  // <x>, in the same units as the hole position
+    SDL_FPoint momentum;  // <p>, from the phase gradient
+    SDL_FPoint spread;    // Standard deviation of the position
+} ObservableSample;
+
+// The sampling interval in turns, or 0 if the observables are off
+extern int g_observableInterval;
+
+// Must be called on the main thread with the GL context current, after
+// the resources are loaded.
+void initObservables();
+// Restarts the turn count, for a new game or a loaded checkpoint.
+void resetObservables();
+// Makes the next sample the reference for normDrift, since a putt or a
+// measurement changes the norm on purpose.
+void rebaseObservables();
+// Called by doPhysics after each turn, with cur as curBuf.  Samples are
+// taken with the textures doPhysics binds (sim buffers on units 0 and 1,
+// potential on 2 and drag potential on 3).
+void observeTurn(int cur);
+// Collects the samples the GPU has finished, without waiting.  Must be
+// called on the thread which runs physics.
+void collectObservables();
+// Copies up to max of the latest samples into out, oldest first, and
+// returns how many there were.  Can be called from any thread.
+int readObservables(ObservableSample *out, int max);
+// Must be called on the main thread, once physics has stopped.
+void finishObservables();
+#endif //PICOPUTT_OBSERVABLES_H
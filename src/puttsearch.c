@@ -0,0 +1,264 @@
+#include "puttsearch.h"
+#include <GL/glew.h>
+#include <SDL.h>
+#include <math.h>
+#include <stdlib.h>
+#include "lanes.h"
+#include "loop.h"
+#include "utils.h"
+
+// The candidate grid.  Momenta go up to about the strongest putts a
+// player can comfortably drag.
+#define SEARCH_DIRECTIONS 16
+#define SEARCH_STRENGTHS 4
+#define SEARCH_CLUB_SIZES 2
+#define NUM_CANDIDATES (SEARCH_DIRECTIONS * SEARCH_STRENGTHS * SEARCH_CLUB_SIZES)
+#define SEARCH_MAX_MOMENTUM 0.5f
+static const float clubSizes[SEARCH_CLUB_SIZES] = {0.25f, 0.75f};
+
+// Win probabilities are sampled every this many turns of the horizon
+// (and at its end), rather than after every turn, since each sample
+// reduces the whole of every lane.  A slice never steps past a sample,
+// since only one can be pending at a time.
+#define SEARCH_STATS_TURNS 32
+
+// Lanes per batch, each of which needs about 30 bytes per sim texel.
+// Can be set with $PICOPUTT_SEARCH_LANES.
+#define DEFAULT_SEARCH_LANES 16
+
+typedef enum {
+    SEARCH_IDLE,
+    SEARCH_LOCATING,  // Finding the centroid of the forked state
+    SEARCH_RUNNING
+} SearchStage;
+
+static SDL_mutex *resultMutex = NULL;
+// Protected by resultMutex
+static PuttSuggestion result;
+static unsigned resultVersion = 0;
+
+// Only used by the thread running physics
+static GLsizei numLanes = DEFAULT_SEARCH_LANES;
+static int allocated = 0;
+static LaneBatch lanes;
+static LaneBatch forked;  // 1 lane: the state the candidates start from
+static LaneBatch best;  // 1 lane: end of the best candidate so far
+static int haveBest = 0;
+static SearchStage stage = SEARCH_IDLE;
+static PuttCandidate candidates[NUM_CANDIDATES];
+static int nextCandidate;  // First candidate of the running batch
+static int batchSize;
+static int horizon;
+static int turnsDone;
+static int statsPending;
+static int sliceTurns;  // Turns issued by the last updatePuttSearch
+static float peakWin[MAX_LANES];
+static PuttSuggestion bestSoFar;
+
+
+void initPuttSearch() {
+    resultMutex = SDL_CreateMutex();
+    if (resultMutex == NULL) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create putt search mutex: %s", SDL_GetError());
+    }
+
+    const char *env = getenv("PICOPUTT_SEARCH_LANES");
+    if (env != NULL && env[0] != '\0') {
+        int value = SDL_atoi(env);
+        if (value >= 1 && value <= MAX_LANES) {
+            numLanes = value;
+        } else {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Ignoring $PICOPUTT_SEARCH_LANES=%s (must be 1 to %d)", env, MAX_LANES);
+        }
+    }
+}
+
+static int allocateBatches() {
+    if (allocated) return 0;
+    int err = initLaneBatch(&lanes, numLanes);
+    if (!err) err = initLaneBatch(&forked, 1);
+    if (!err) err = initLaneBatch(&best, 1);
+    if (err) {
+        deleteLaneBatch(&lanes);
+        deleteLaneBatch(&forked);
+        deleteLaneBatch(&best);
+        return err;
+    }
+
+    allocated = 1;
+    return 0;
+}
+
+static void buildCandidates() {
+    int n = 0;
+    for (int c = 0; c < SEARCH_CLUB_SIZES; c++) {
+        for (int s = 0; s < SEARCH_STRENGTHS; s++) {
+            float momentum = SEARCH_MAX_MOMENTUM * (float)(s + 1) / SEARCH_STRENGTHS;
+            for (int d = 0; d < SEARCH_DIRECTIONS; d++) {
+                float angle = 2.f * (float)M_PI * (float)d / SEARCH_DIRECTIONS;
+                candidates[n++] = (PuttCandidate) {
+                    .px = momentum * cosf(angle),
+                    .py = momentum * sinf(angle),
+                    .clubSize = clubSizes[c],
+                    .clubRadius = clubPixSizeFor(clubSizes[c])
+                };
+            }
+        }
+    }
+}
+
+// Starts a search from the state in forked
+static void beginSearch(int horizonTurns) {
+    horizon = SDL_max(horizonTurns, 1);
+    statsPending = 0;
+    stage = SEARCH_LOCATING;
+    beginLaneStats(&forked);
+}
+
+int startPuttSearch(TexturedFrameBuffer *cur, TexturedFrameBuffer *prev, TexturedFrameBuffer *dragPot, int horizonTurns) {
+    if (allocateBatches()) return 1;
+    setLane(&forked, 0, cur, prev, dragPot);
+    beginSearch(horizonTurns);
+    return 0;
+}
+
+int continuePuttSearch(int horizonTurns) {
+    if (SET_ERR_IF_TRUE(!haveBest)) return 1;
+    copyLane(&forked, 0, &best, 0);
+    beginSearch(horizonTurns);
+    return 0;
+}
+
+void cancelPuttSearch() {
+    stage = SEARCH_IDLE;
+}
+
+int puttSearchRunning() {
+    return stage != SEARCH_IDLE;
+}
+
+
+static void startBatch(SDL_FPoint origin) {
+    LanePutt putts[MAX_LANES] = {0};
+    batchSize = SDL_min(numLanes, NUM_CANDIDATES - nextCandidate);
+    for (int i = 0; i < batchSize; i++) {
+        PuttCandidate *c = &candidates[nextCandidate + i];
+        putts[i] = (LanePutt) {.px = c->px, .py = c->py, .clubRadius = c->clubRadius};
+        copyLane(&lanes, i, &forked, 0);
+        peakWin[i] = 0.f;
+    }
+
+    // Any spare lanes in the last batch just carry on with whatever they
+    // had, and are ignored.
+    applyLanePutts(&lanes, origin, putts);
+    turnsDone = 0;
+}
+
+static void finishBatch() {
+    int bestLane = 0;
+    for (int i = 1; i < batchSize; i++) {
+        if (peakWin[i] > peakWin[bestLane]) bestLane = i;
+    }
+
+    if (peakWin[bestLane] > bestSoFar.winProbability) {
+        bestSoFar.putt = candidates[nextCandidate + bestLane];
+        bestSoFar.winProbability = peakWin[bestLane];
+        copyLane(&best, 0, &lanes, bestLane);
+        haveBest = 1;
+    }
+    bestSoFar.candidates = nextCandidate + batchSize;
+}
+
+static void publishResult() {
+    SDL_LockMutex(resultMutex);
+    result = bestSoFar;
+    resultVersion++;
+    SDL_UnlockMutex(resultMutex);
+}
+
+int updatePuttSearch(int maxTurns, int wait) {
+    sliceTurns = 0;
+    if (stage == SEARCH_IDLE) return 0;
+
+    if (stage == SEARCH_LOCATING) {
+        LaneStats stats;
+        int status = readLaneStats(&forked, &stats, wait);
+        if (status == 1) return 0;
+        if (status < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Putt search failed: %s", SDL_GetError());
+            stage = SEARCH_IDLE;
+            return 0;
+        }
+
+        // The club is centered on the ball, like a player would
+        buildCandidates();
+        bestSoFar = (PuttSuggestion) {.origin = stats.centroid, .winProbability = -1.f};
+        haveBest = 0;
+        nextCandidate = 0;
+        startBatch(stats.centroid);
+        stage = SEARCH_RUNNING;
+    } else if (statsPending) {
+        LaneStats stats[MAX_LANES];
+        int status = readLaneStats(&lanes, stats, wait);
+        if (status == 1) return 0;
+        statsPending = 0;
+        if (status < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Putt search failed: %s", SDL_GetError());
+            stage = SEARCH_IDLE;
+            return 0;
+        }
+
+        for (int i = 0; i < batchSize; i++) peakWin[i] = SDL_max(peakWin[i], stats[i].winProbability);
+
+        if (turnsDone >= horizon) {
+            finishBatch();
+            nextCandidate += batchSize;
+            if (nextCandidate >= NUM_CANDIDATES) {
+                publishResult();
+                stage = SEARCH_IDLE;
+                return 1;
+            }
+            startBatch(bestSoFar.origin);
+        }
+    }
+
+    if (maxTurns < 1) return 0;
+    int turns = SDL_min(maxTurns, horizon - turnsDone);
+    turns = SDL_min(turns, SEARCH_STATS_TURNS - turnsDone % SEARCH_STATS_TURNS);
+    stepLanes(&lanes, turns);
+    turnsDone += turns;
+    sliceTurns = turns;
+    if (turnsDone % SEARCH_STATS_TURNS == 0 || turnsDone >= horizon) {
+        beginLaneStats(&lanes);
+        statsPending = 1;
+    }
+    return 0;
+}
+
+int puttSearchSliceTurns() {
+    return sliceTurns;
+}
+
+int pollPuttSuggestion(PuttSuggestion *suggestion, unsigned *version) {
+    SDL_LockMutex(resultMutex);
+    int fresh = resultVersion != *version;
+    if (fresh) {
+        *suggestion = result;
+        *version = resultVersion;
+    }
+    SDL_UnlockMutex(resultMutex);
+    return fresh;
+}
+
+void finishPuttSearch() {
+    stage = SEARCH_IDLE;
+    if (allocated) {
+        deleteLaneBatch(&lanes);
+        deleteLaneBatch(&forked);
+        deleteLaneBatch(&best);
+        allocated = 0;
+    }
+    haveBest = 0;
+    SDL_DestroyMutex(resultMutex);
+    resultMutex = NULL;
+}
@@ -0,0 +1,57 @@
+#ifndef PICOPUTT_PUTTSEARCH_H
+#define PICOPUTT_PUTTSEARCH_H
+#include <GL/glew.h>
+#include <SDL.h>
+#include "framebuffers.h"
+
+// Suggests putts by forking the current state into a grid of candidate
+// putts (direction x strength x club size), simulating them all in lanes
+// (see lanes.h) for a fixed horizon, and ranking them by their peak win
+// probability over it.  The game is won as soon as the win probability
+// crosses the threshold, so the peak is what matters rather than the
+// value at the end of the horizon.
+//
+// Searches run in slices, on whichever thread runs physics, so that the
+// game keeps running meanwhile: each updatePuttSearch call issues at
+// most the lane turns it's given (which the frame scheduler in loop.c
+// budgets by their measured cost), and only once the GPU has finished
+// the win probabilities it needs.  The result can be collected from any
+// thread.
+
+typedef struct {
+    float px;          // Momentum, as in applyPutt
+    float py;
+    float clubSize;    // 0 to 1, as the player's club size
+    float clubRadius;  // In sim grid units
+} PuttCandidate;
+
+typedef struct {
+    PuttCandidate putt;
+    SDL_FPoint origin;     // Where the putt is centered, in sim grid units
+    float winProbability;  // Predicted (peak over the horizon)
+    int candidates;        // Number of candidates evaluated
+} PuttSuggestion;
+
+// Must be called once, on the main thread, before any other function.
+void initPuttSearch();
+// Starts a new search (replacing any running one) from the given state.
+// horizonTurns is how long each candidate is simulated for.
+int startPuttSearch(TexturedFrameBuffer *cur, TexturedFrameBuffer *prev, TexturedFrameBuffer *dragPot, int horizonTurns);
+// Starts a new search from the state at the end of the horizon of the
+// best candidate of the last finished search (for planning several
+// putts ahead, see computePar).
+int continuePuttSearch(int horizonTurns);
+void cancelPuttSearch();
+// Advances the running search by up to maxTurns turns of all lanes.
+// If wait is 0 and the GPU is still busy with the last slice, does
+// nothing.  Returns 1 if the search finished.
+int updatePuttSearch(int maxTurns, int wait);
+// Number of lane turns the last updatePuttSearch call issued
+int puttSearchSliceTurns();
+int puttSearchRunning();
+// Gets the result of the last finished search.  Returns 1 if it's newer
+// than *version (which is then updated), otherwise 0.
+int pollPuttSuggestion(PuttSuggestion *suggestion, unsigned *version);
+// Frees everything, once nothing else can be using the search.
+void finishPuttSearch();
+#endif //PICOPUTT_PUTTSEARCH_H
@@ -4,18 +4,38 @@
 #include "shaders.h"
 #include "utils.h"
 #include "text.h"
-
-ProgQTurn g_qturn = {.prog = {.name = "shaders/qturn.frag"}};
+#include "trace.h"
+#include "tuning.h"
+#include "vortices.h"
+
+ProgQTurn g_qturn;
+ProgQTurn g_qturnVariants[NUM_QTURN_VARIANTS] = {
+    [QTURN_TERNARY] = {.prog = {.name = "shaders/qturn.frag"}},
+    [QTURN_MULTIPLY] = {.prog = {.name = "shaders/qturn.frag"}},
+    [QTURN_IMAGE] = {.prog = {.name = "shaders/qturn.frag"}},
+    [QTURN_ROBUST] = {.prog = {.name = "shaders/qturn.frag"}},
+    [QTURN_BORDER] = {.prog = {.name = "shaders/qturn.frag"}},
+};
+const char *g_qturnVariantNames[NUM_QTURN_VARIANTS] = {
+    [QTURN_TERNARY] = "ternary",
+    [QTURN_MULTIPLY] = "multiply",
+    [QTURN_IMAGE] = "image",
+    [QTURN_ROBUST] = "robust",
+    [QTURN_BORDER] = "border",
+};
+QTurnVariant g_qturnVariant = QTURN_TERNARY;
+LIPConfig g_lipConfig = {.tile = 8, .groupX = 8, .groupY = 8};
+GLuint g_borderSampler = 0;
 ProgGaussian g_gaussian = {.prog = {.name = "shaders/gaussian.frag"}};
 ProgPDF g_pdf = {.prog = {.name = "shaders/pdf.frag"}};
 ProgRenderer g_renderer = {.prog = {.name = "shaders/graphics/renderer.frag"}};
+ProgRenderer g_rendererSimple = {.prog = {.name = "shaders/graphics/renderer.frag"}};
+ProgSurfacePass g_surfacePass = {.prog = {.name = "shaders/graphics/surface_pass.frag"}};
 ProgDebugRenderer g_debugRenderer = {.prog = {.name = "shaders/graphics/debug.frag"}};
 ProgClubGraphics g_clubGfx = {.prog = {.name = "shaders/graphics/club.frag"}};
-ProgPutt g_putt = {.prog = {.name = "shaders/putt.frag"}};
-ProgPlaneWave g_planeWave = {.prog = {.name = "shaders/plane_wave.frag"}};
-ProgCMul g_cmul = {.prog = {.name = "shaders/cmul.frag"}};
+ProgApplyPutt g_applyPutt = {.prog = {.name = "shaders/putt.comp"}};
+ProgGoalOverlap g_goalOverlap = {.prog = {.name = "shaders/goal_overlap.comp"}};
 ProgReduce g_rsumReduce = {.prog = {.name = "shaders/rsum_reduce.frag"}};
-ProgReduce g_rgsumReduce = {.prog = {.name = "shaders/rgsum_reduce.frag"}};
 ProgInitLIP g_initLIP = {.prog = {.name = "shaders/drag/init_lip.comp"}};
 ProgBuildLIP g_buildLIP = {.prog = {.name = "shaders/drag/build_lip.comp"}};
 ProgLIPKiss g_LIPKiss = {.prog = {.name = "shaders/drag/lip_kiss.comp"}};
@@ -23,19 +43,37 @@ ProgIntegrateLIP g_integrateLIP[2] = {
     {.prog = {.name = "shaders/drag/integrate_lip_x.comp"}},
     {.prog = {.name = "shaders/drag/integrate_lip_y.comp"}}
 };
-ProgDrawMSDFGlyph g_msdfGlyph = {.prog = {.name = "shaders/text/msdf.frag"}};
+ProgQTurnLanes g_qturnLanes = {.prog = {.name = "shaders/lanes/qturn.comp"}};
+ProgLaneStats g_laneStats = {.prog = {.name = "shaders/lanes/stats.comp"}};
+ProgLaneStatsSum g_laneStatsSum = {.prog = {.name = "shaders/lanes/stats_sum.comp"}};
+ProgPuttLanes g_puttLanes = {.prog = {.name = "shaders/lanes/putt.comp"}};
+ProgObservables g_observables = {.prog = {.name = "shaders/observables.comp"}};
+ProgObservablesSum g_observablesSum = {.prog = {.name = "shaders/observables_sum.comp"}};
+ProgVortices g_vortices = {.prog = {.name = "shaders/vortices.comp"}};
+ProgPotentialRange g_potentialRange = {.prog = {.name = "shaders/potential_range.comp"}};
+ProgInitLIP g_initLIPLanes = {.prog = {.name = "shaders/drag/init_lip.comp"}};
+ProgBuildLIP g_buildLIPLanes = {.prog = {.name = "shaders/drag/build_lip.comp"}};
+ProgLIPKiss g_LIPKissLanes = {.prog = {.name = "shaders/drag/lip_kiss.comp"}};
+ProgIntegrateLIP g_integrateLIPLanes[2] = {
+    {.prog = {.name = "shaders/drag/integrate_lip_x.comp"}},
+    {.prog = {.name = "shaders/drag/integrate_lip_y.comp"}}
+};
+LIPConfig g_laneLIPConfig;
+ProgDrawGlyph g_msdfGlyph = {.prog = {.name = "shaders/text/msdf.frag"}};
 ProgCourse g_courseWall = {.prog = {.name = "shaders/system/wall.frag"}};
 ProgCourse g_coursePotential = {.prog = {.name = "shaders/system/potential.frag"}};
 ProgFillColor g_fillColor = {.prog = {.name = "shaders/graphics/fill_color.frag"}};
 
 TexturedFrameBuffer g_potentialBuffer;
 TexturedFrameBuffer g_wallBuffer;
+TexturedFrameBuffer g_nextPotentialBuffer;
+TexturedFrameBuffer g_nextWallBuffer;
 TexturedFrameBuffer g_simBuffers[2];
-TexturedFrameBuffer g_puttBuffer;
+TexturedFrameBuffer g_simSpare;
 TexturedFrameBuffer g_pdfBuffer;
+TexturedFrameBuffer g_surfaceBuffer;
 PaddedPyramidBuffer g_pdfPyramid;
-TexturedFrameBuffer g_goalState;
-PaddedPyramidBuffer g_goalPyramid;
+GoalTile g_goalState;
 TexturedFrameBuffer g_dragPot;
 PyramidBuffer g_dragLIP;
 
@@ -58,210 +96,398 @@ static Shader surfaceShader = {
 
 static Shader glyphVertShader = {
     .name = "shaders/text/glyph.vert",
-    .numReqVars = 1, .reqVars = (VariableBinding[]) {VAR_BIND_UV}
+    .numReqVars = 3, .reqVars = (VariableBinding[]) {
+        VAR_BIND_GLYPH_NDC, VAR_BIND_GLYPH_ATLAS, VAR_BIND_GLYPH_COLOR
+    }
 };
 
-int loadResources() {
-    int err;
-    initQuad();
-
-    identityShader.id = loadShader(GL_VERTEX_SHADER, g_basePath, identityShader.name);
-    if (identityShader.id == 0) return 1;
+static Shader *vertShaders[] = {&identityShader, &surfaceShader, &glyphVertShader};
+
+// Filled in from g_lipConfig before the programs are submitted
+static char lipDefines[128];
+static char lipLaneDefines[160];
+static char vortexDefines[64];
+
+// All programs are submitted to the driver up front so that they can be
+// compiled in parallel, and then checked once they're all done.
+static ProgramBuild programBuilds[] = {
+    {&g_gaussian.prog, &surfaceShader, GL_FRAGMENT_SHADER, "o_psi"},
+    {&g_pdf.prog, &identityShader, GL_FRAGMENT_SHADER, "o_psi2"},
+    {&g_renderer.prog, &surfaceShader, GL_FRAGMENT_SHADER, "o_color"},
+    {&g_rendererSimple.prog, &surfaceShader, GL_FRAGMENT_SHADER, "o_color", "#define FANCY 0\n"},
+    {&g_surfacePass.prog, &identityShader, GL_FRAGMENT_SHADER, "o_surface"},
+    {&g_debugRenderer.prog, &surfaceShader, GL_FRAGMENT_SHADER, "o_color"},
+    {&g_clubGfx.prog, &surfaceShader, GL_FRAGMENT_SHADER, "o_color"},
+    {&g_applyPutt.prog, NULL, GL_COMPUTE_SHADER},
+    {&g_goalOverlap.prog, NULL, GL_COMPUTE_SHADER},
+    {&g_rsumReduce.prog, &identityShader, GL_FRAGMENT_SHADER, "o_sum"},
+    {&g_initLIP.prog, NULL, GL_COMPUTE_SHADER, NULL, lipDefines},
+    {&g_buildLIP.prog, NULL, GL_COMPUTE_SHADER, NULL, lipDefines},
+    {&g_LIPKiss.prog, NULL, GL_COMPUTE_SHADER},
+    {&g_integrateLIP[0].prog, NULL, GL_COMPUTE_SHADER, NULL, lipDefines},
+    {&g_integrateLIP[1].prog, NULL, GL_COMPUTE_SHADER, NULL, lipDefines},
+    {&g_qturnLanes.prog, NULL, GL_COMPUTE_SHADER},
+    {&g_laneStats.prog, NULL, GL_COMPUTE_SHADER},
+    {&g_laneStatsSum.prog, NULL, GL_COMPUTE_SHADER},
+    {&g_puttLanes.prog, NULL, GL_COMPUTE_SHADER},
+    {&g_observables.prog, NULL, GL_COMPUTE_SHADER},
+    {&g_observablesSum.prog, NULL, GL_COMPUTE_SHADER},
+    {&g_vortices.prog, NULL, GL_COMPUTE_SHADER, NULL, vortexDefines},
+    {&g_potentialRange.prog, NULL, GL_COMPUTE_SHADER},
+    {&g_initLIPLanes.prog, NULL, GL_COMPUTE_SHADER, NULL, lipLaneDefines},
+    {&g_buildLIPLanes.prog, NULL, GL_COMPUTE_SHADER, NULL, lipLaneDefines},
+    {&g_LIPKissLanes.prog, NULL, GL_COMPUTE_SHADER, NULL, lipLaneDefines},
+    {&g_integrateLIPLanes[0].prog, NULL, GL_COMPUTE_SHADER, NULL, lipLaneDefines},
+    {&g_integrateLIPLanes[1].prog, NULL, GL_COMPUTE_SHADER, NULL, lipLaneDefines},
+    {&g_msdfGlyph.prog, &glyphVertShader, GL_FRAGMENT_SHADER, "o_color"},
+    {&g_courseWall.prog, &identityShader, GL_FRAGMENT_SHADER, "o_wall"},
+    {&g_coursePotential.prog, &identityShader, GL_FRAGMENT_SHADER, "o_potential"},
+    {&g_fillColor.prog, &identityShader, GL_FRAGMENT_SHADER, "o_color"},
+};
 
-    surfaceShader.id = loadShader(GL_VERTEX_SHADER, g_basePath, surfaceShader.name);
-    if (surfaceShader.id == 0) return 1;
+static ProgramBuild qturnBuilds[NUM_QTURN_VARIANTS] = {
+    {&g_qturnVariants[QTURN_TERNARY].prog, &identityShader, GL_FRAGMENT_SHADER, "o_psi", "#define QTURN_TERNARY\n"},
+    {&g_qturnVariants[QTURN_MULTIPLY].prog, &identityShader, GL_FRAGMENT_SHADER, "o_psi", "#define QTURN_MULTIPLY\n"},
+    {&g_qturnVariants[QTURN_IMAGE].prog, &identityShader, GL_FRAGMENT_SHADER, "o_psi", "#define QTURN_IMAGE\n"},
+    {&g_qturnVariants[QTURN_ROBUST].prog, &identityShader, GL_FRAGMENT_SHADER, "o_psi", "#define QTURN_ROBUST\n"},
+    {&g_qturnVariants[QTURN_BORDER].prog, &identityShader, GL_FRAGMENT_SHADER, "o_psi", "#define QTURN_BORDER\n"},
+};
 
-    glyphVertShader.id = loadShader(GL_VERTEX_SHADER, g_basePath, glyphVertShader.name);
-    if (glyphVertShader.id == 0) return 1;
+#define NUM_VERT_SHADERS (sizeof vertShaders / sizeof vertShaders[0])
+#define NUM_PROGRAMS (sizeof programBuilds / sizeof programBuilds[0])
 
-    g_gaussian.prog.id = compileAndLinkFragProgram(
-        &surfaceShader, g_basePath, g_gaussian.prog.name, "o_psi"
+void formatLIPDefines(char *buf, size_t size, LIPConfig config) {
+    SDL_snprintf(
+        buf, size, "#define LIP_TILE %d\n#define LIP_GROUP_X %d\n#define LIP_GROUP_Y %d\n",
+        config.tile, config.groupX, config.groupY
     );
-    if (g_gaussian.prog.id == 0) return 1;
+}
+
+static int submitVertShaders() {
+    for (size_t i = 0; i < NUM_VERT_SHADERS; i++) {
+        vertShaders[i]->id = submitShader(GL_VERTEX_SHADER, g_basePath, vertShaders[i]->name);
+        if (vertShaders[i]->id == 0) return 1;
+    }
+
+    return 0;
+}
+
+static int submitPrograms() {
+    formatLIPDefines(lipDefines, sizeof lipDefines, g_lipConfig);
+    SDL_snprintf(lipLaneDefines, sizeof lipLaneDefines, "%s#define LANES\n", lipDefines);
+    SDL_snprintf(vortexDefines, sizeof vortexDefines, "#define MAX_VORTICES %d\n", MAX_VORTICES);
+    g_laneLIPConfig = g_lipConfig;
+    for (size_t i = 0; i < NUM_PROGRAMS; i++) {
+        TRACE_BEGIN(programBuilds[i].prog->name);
+        int err = submitProgram(&programBuilds[i], g_basePath);
+        TRACE_END();
+        if (err) return 1;
+    }
+
+    // Out of bounds texelFetch is only guaranteed to give 0 with robust
+    // buffer access, so QTURN_ROBUST is pointless to try without it.
+    GLint contextFlags = 0;
+    glGetIntegerv(GL_CONTEXT_FLAGS, &contextFlags);
+    int robust = (contextFlags & GL_CONTEXT_FLAG_ROBUST_ACCESS_BIT) != 0;
+    // As in finishPrograms, only the reference variant is required.
+    for (int i = 0; i < NUM_QTURN_VARIANTS; i++) {
+        if (i == QTURN_ROBUST && !robust) continue;
+        if (submitProgram(&qturnBuilds[i], g_basePath)) {
+            if (i == QTURN_TERNARY) return 1;
+            SDL_LogWarn(
+                SDL_LOG_CATEGORY_APPLICATION, "qturn variant %s is unavailable: %s",
+                g_qturnVariantNames[i], SDL_GetError()
+            );
+            g_qturnVariants[i].prog.id = 0;
+        }
+    }
+
+    return 0;
+}
+
+static int finishPrograms() {
+    TRACE_BEGIN("waitForPrograms");
+    waitForPrograms(programBuilds, NUM_PROGRAMS);
+    waitForPrograms(qturnBuilds, NUM_QTURN_VARIANTS);
+    TRACE_END();
+
+    // Vertex shaders are checked first, since if one of them failed, all
+    // the programs using it will fail to link with a less useful error.
+    for (size_t i = 0; i < NUM_VERT_SHADERS; i++) {
+        vertShaders[i]->id = checkShaderOrDelete(vertShaders[i]->id, vertShaders[i]->name);
+        if (vertShaders[i]->id == 0) return 1;
+    }
+
+    for (size_t i = 0; i < NUM_PROGRAMS; i++) {
+        TRACE_BEGIN(programBuilds[i].prog->name);
+        int err = finishProgram(&programBuilds[i]);
+        TRACE_END();
+        if (err) return 1;
+    }
+
+    // Only the reference variant is required, the autotuner just skips
+    // any others that failed.
+    for (int i = 0; i < NUM_QTURN_VARIANTS; i++) {
+        if (g_qturnVariants[i].prog.id == 0) continue;
+        if (finishProgram(&qturnBuilds[i])) {
+            if (i == QTURN_TERNARY) return 1;
+            SDL_LogWarn(
+                SDL_LOG_CATEGORY_APPLICATION, "qturn variant %s is unavailable: %s",
+                g_qturnVariantNames[i], SDL_GetError()
+            );
+        }
+    }
+
+    return 0;
+}
+
+// Separate from findUniforms, since tuneLIP has its own copies of these
+void findLIPUniforms(ProgInitLIP *init, ProgBuildLIP *build, ProgIntegrateLIP integrate[2]) {
+    EXPECT_UNIFORM(init, u_cur);
+    EXPECT_UNIFORM(init, u_prev);
+    EXPECT_UNIFORM(init, u_lipOut);
+
+    EXPECT_UNIFORM(build, u_lipIn);
+    EXPECT_UNIFORM(build, u_lipOut);
+
+    for (int i = 0; i < 2; i++) {
+        EXPECT_UNIFORM(&integrate[i], u_lipIn);
+        EXPECT_UNIFORM(&integrate[i], u_potOut);
+        EXPECT_UNIFORM(&integrate[i], u_scale);
+    }
+}
+
+static void deletePrograms() {
+    for (size_t i = 0; i < NUM_PROGRAMS; i++) {
+        glDeleteProgram(programBuilds[i].prog->id);
+        programBuilds[i].prog->id = 0;
+    }
+
+    // g_qturn is just a copy of one of the variants
+    for (int i = 0; i < NUM_QTURN_VARIANTS; i++) {
+        glDeleteProgram(g_qturnVariants[i].prog.id);
+        g_qturnVariants[i].prog.id = 0;
+    }
+    g_qturn.prog.id = 0;
+}
+
+static void findUniforms() {
     // TODO: move common vertex uniform initialization elsewhere
     EXPECT_UNIFORM(&g_gaussian.vert, u_scale);
     EXPECT_UNIFORM(&g_gaussian.vert, u_shift);
     EXPECT_UNIFORM(&g_gaussian, u_peak);
 
+    for (int i = 0; i < NUM_QTURN_VARIANTS; i++) {
+        if (g_qturnVariants[i].prog.id == 0) continue;
+        EXPECT_UNIFORM(&g_qturnVariants[i], u_dt);
+        EXPECT_UNIFORM(&g_qturnVariants[i], u_prev);
+        EXPECT_UNIFORM(&g_qturnVariants[i], u_potential);
+        EXPECT_UNIFORM(&g_qturnVariants[i], u_dragPot);
+        EXPECT_UNIFORM(&g_qturnVariants[i], u_wall);
+    }
 
-    g_qturn.prog.id = compileAndLinkFragProgram(
-        &identityShader, g_basePath, g_qturn.prog.name, "o_psi"
-    );
-    if (g_qturn.prog.id == 0) return 1;
-    glUseProgram(g_qturn.prog.id);
-    EXPECT_UNIFORM(&g_qturn, u_4m_dx2);
-    EXPECT_UNIFORM(&g_qturn, u_dt);
-    EXPECT_UNIFORM(&g_qturn, u_prev);
-    EXPECT_UNIFORM(&g_qturn, u_potential);
-    EXPECT_UNIFORM(&g_qturn, u_dragPot);
-    EXPECT_UNIFORM(&g_qturn, u_wall);
-
-    g_pdf.prog.id = compileAndLinkFragProgram(
-        &identityShader, g_basePath, g_pdf.prog.name, "o_psi2"
-    );
-    if (g_pdf.prog.id == 0) return 1;
     EXPECT_UNIFORM(&g_pdf, u_cur);
     EXPECT_UNIFORM(&g_pdf, u_prev);
 
-    g_renderer.prog.id = compileAndLinkFragProgram(
-        &surfaceShader, g_basePath, g_renderer.prog.name, "o_color"
-    );
-    if (g_renderer.prog.id == 0) return 1;
-    EXPECT_UNIFORM(&g_renderer.vert, u_scale);
-    EXPECT_UNIFORM(&g_renderer.vert, u_shift);
-    FIND_UNIFORM(&g_renderer, u_cur);
-    FIND_UNIFORM(&g_renderer, u_pdf);
-    FIND_UNIFORM(&g_renderer, u_totalProb);
-    FIND_UNIFORM(&g_renderer, u_simSize);
-    FIND_UNIFORM(&g_renderer, u_puttActive);
-    FIND_UNIFORM(&g_renderer, u_putt);
-    FIND_UNIFORM(&g_renderer, u_colormap);
-    FIND_UNIFORM(&g_renderer, u_skybox);
-    FIND_UNIFORM(&g_renderer, u_mouse);
-    FIND_UNIFORM(&g_renderer, u_potential);
-    FIND_UNIFORM(&g_renderer, u_wall);
-    FIND_UNIFORM(&g_renderer, u_drContourThickness);
-    FIND_UNIFORM(&g_renderer, u_contourProgress);
-    FIND_UNIFORM(&g_renderer, u_contourSep);
-
-    g_debugRenderer.prog.id = compileAndLinkFragProgram(
-        &surfaceShader, g_basePath, g_debugRenderer.prog.name, "o_color"
-    );
-    if (g_debugRenderer.prog.id == 0) return 1;
+    ProgRenderer *renderers[] = {&g_renderer, &g_rendererSimple};
+    for (int i = 0; i < 2; i++) {
+        EXPECT_UNIFORM(&renderers[i]->vert, u_scale);
+        EXPECT_UNIFORM(&renderers[i]->vert, u_shift);
+        FIND_UNIFORM(renderers[i], u_surface);
+        FIND_UNIFORM(renderers[i], u_simSize);
+        FIND_UNIFORM(renderers[i], u_puttActive);
+        FIND_UNIFORM(renderers[i], u_puttOrigin);
+        FIND_UNIFORM(renderers[i], u_puttMomentum);
+        FIND_UNIFORM(renderers[i], u_puttClubRadius);
+        FIND_UNIFORM(renderers[i], u_puttPhase);
+        FIND_UNIFORM(renderers[i], u_dx);
+        FIND_UNIFORM(renderers[i], u_colormap);
+        FIND_UNIFORM(renderers[i], u_skybox);
+        FIND_UNIFORM(renderers[i], u_mouse);
+        FIND_UNIFORM(renderers[i], u_wall);
+        FIND_UNIFORM(renderers[i], u_drContourThickness);
+        FIND_UNIFORM(renderers[i], u_contourProgress);
+        FIND_UNIFORM(renderers[i], u_contourSep);
+    }
+
+    EXPECT_UNIFORM(&g_surfacePass, u_pdf);
+    EXPECT_UNIFORM(&g_surfacePass, u_totalProb);
+    EXPECT_UNIFORM(&g_surfacePass, u_potential);
+
     EXPECT_UNIFORM(&g_debugRenderer.vert, u_scale);
     EXPECT_UNIFORM(&g_debugRenderer.vert, u_shift);
     EXPECT_UNIFORM(&g_debugRenderer, u_data);
     FIND_UNIFORM(&g_debugRenderer, u_colormap);
     FIND_UNIFORM(&g_debugRenderer, u_mode);
 
-    g_clubGfx.prog.id = compileAndLinkFragProgram(
-        &surfaceShader, g_basePath, g_clubGfx.prog.name, "o_color"
-    );
-    if (g_clubGfx.prog.id == 0) return 1;
     EXPECT_UNIFORM(&g_clubGfx.vert, u_scale);
     EXPECT_UNIFORM(&g_clubGfx.vert, u_shift);
     EXPECT_UNIFORM(&g_clubGfx, u_radius);
 
-    g_putt.prog.id = compileAndLinkFragProgram(
-        &surfaceShader, g_basePath, g_putt.prog.name, "o_psi"
-    );
-    if (g_putt.prog.id == 0) return 1;
-    EXPECT_UNIFORM(&g_putt.vert, u_scale);
-    EXPECT_UNIFORM(&g_putt.vert, u_shift);
-    EXPECT_UNIFORM(&g_putt, u_clubRadius);
-    EXPECT_UNIFORM(&g_putt, u_momentum);
-    EXPECT_UNIFORM(&g_putt, u_phase);
-
-    g_planeWave.prog.id = compileAndLinkFragProgram(
-        &surfaceShader, g_basePath, g_planeWave.prog.name, "o_psi"
-    );
-    if (g_planeWave.prog.id == 0) return 1;
-    EXPECT_UNIFORM(&g_planeWave.vert, u_scale);
-    EXPECT_UNIFORM(&g_planeWave.vert, u_shift);
-    EXPECT_UNIFORM(&g_planeWave, u_momentum);
 
-    g_cmul.prog.id = compileAndLinkFragProgram(
-        &identityShader, g_basePath, g_cmul.prog.name, "o_result"
-    );
-    if (g_cmul.prog.id == 0) return 1;
-    EXPECT_UNIFORM(&g_cmul, u_left);
-    EXPECT_UNIFORM(&g_cmul, u_right);
+    EXPECT_UNIFORM(&g_applyPutt, u_cur);
+    EXPECT_UNIFORM(&g_applyPutt, u_next);
+    EXPECT_UNIFORM(&g_applyPutt, u_prevOut);
+    EXPECT_UNIFORM(&g_applyPutt, u_potential);
+    EXPECT_UNIFORM(&g_applyPutt, u_dragPot);
+    EXPECT_UNIFORM(&g_applyPutt, u_wall);
+    EXPECT_UNIFORM(&g_applyPutt, u_dt);
+    EXPECT_UNIFORM(&g_applyPutt, u_origin);
+    EXPECT_UNIFORM(&g_applyPutt, u_momentum);
+    EXPECT_UNIFORM(&g_applyPutt, u_clubRadius);
+    EXPECT_UNIFORM(&g_applyPutt, u_planeWave);
+    EXPECT_UNIFORM(&g_applyPutt, u_dx);
+
+    EXPECT_UNIFORM(&g_goalOverlap, u_cur);
+    EXPECT_UNIFORM(&g_goalOverlap, u_goal);
+    EXPECT_UNIFORM(&g_goalOverlap, u_offset);
 
-    g_rsumReduce.prog.id = compileAndLinkFragProgram(
-        &identityShader, g_basePath, g_rsumReduce.prog.name, "o_sum"
-    );
-    if (g_rsumReduce.prog.id == 0) return 1;
     EXPECT_UNIFORM(&g_rsumReduce, u_src);
 
-    g_rgsumReduce.prog.id = compileAndLinkFragProgram(
-        &identityShader, g_basePath, g_rgsumReduce.prog.name, "o_sum"
-    );
-    if (g_rgsumReduce.prog.id == 0) return 1;
-    EXPECT_UNIFORM(&g_rgsumReduce, u_src);
-
-    g_initLIP.prog.id = compileAndLinkCompProgram(g_basePath, g_initLIP.prog.name);
-    if (g_initLIP.prog.id == 0) return 1;
-    EXPECT_UNIFORM(&g_initLIP, u_cur);
-    EXPECT_UNIFORM(&g_initLIP, u_prev);
-    EXPECT_UNIFORM(&g_initLIP, u_lipOut);
-    EXPECT_UNIFORM(&g_initLIP, u_simSize);
-
-    g_buildLIP.prog.id = compileAndLinkCompProgram(g_basePath, g_buildLIP.prog.name);
-    if (g_buildLIP.prog.id == 0) return 1;
-    EXPECT_UNIFORM(&g_buildLIP, u_lipIn);
-    EXPECT_UNIFORM(&g_buildLIP, u_lipOut);
-
-    g_LIPKiss.prog.id = compileAndLinkCompProgram(g_basePath, g_LIPKiss.prog.name);
-    if (g_LIPKiss.prog.id == 0) return 1;
+    findLIPUniforms(&g_initLIP, &g_buildLIP, g_integrateLIP);
     EXPECT_UNIFORM(&g_LIPKiss, u_lipIn);
     EXPECT_UNIFORM(&g_LIPKiss, u_potOut);
 
-    for (int i = 0; i < 2; i++) {
-        g_integrateLIP[i].prog.id = compileAndLinkCompProgram(g_basePath, g_integrateLIP[i].prog.name);
-        if (g_integrateLIP[i].prog.id == 0) return 1;
-        EXPECT_UNIFORM(&g_integrateLIP[i], u_lipIn);
-        EXPECT_UNIFORM(&g_integrateLIP[i], u_potOut);
-        EXPECT_UNIFORM(&g_integrateLIP[i], u_scale);
-    }
+    EXPECT_UNIFORM(&g_qturnLanes, u_dt);
+    EXPECT_UNIFORM(&g_qturnLanes, u_prev);
+    EXPECT_UNIFORM(&g_qturnLanes, u_next);
+    EXPECT_UNIFORM(&g_qturnLanes, u_dragPot);
+    EXPECT_UNIFORM(&g_qturnLanes, u_potential);
+    EXPECT_UNIFORM(&g_qturnLanes, u_wall);
+    EXPECT_UNIFORM(&g_laneStats, u_cur);
+    EXPECT_UNIFORM(&g_laneStats, u_prev);
+    EXPECT_UNIFORM(&g_laneStats, u_goal);
+    EXPECT_UNIFORM(&g_laneStats, u_goalOffset);
+    EXPECT_UNIFORM(&g_laneStatsSum, u_numPartials);
+    EXPECT_UNIFORM(&g_puttLanes, u_psi);
+    EXPECT_UNIFORM(&g_puttLanes, u_origin);
+    EXPECT_UNIFORM(&g_puttLanes, u_dx);
+    EXPECT_UNIFORM(&g_observables, u_cur);
+    EXPECT_UNIFORM(&g_observables, u_prev);
+    EXPECT_UNIFORM(&g_observables, u_potential);
+    EXPECT_UNIFORM(&g_observables, u_dragPot);
+    FIND_UNIFORM(&g_observables, u_wall);  // Only used by the 4th order stencil
+    EXPECT_UNIFORM(&g_observablesSum, u_numPartials);
+    EXPECT_UNIFORM(&g_observablesSum, u_slot);
+    EXPECT_UNIFORM(&g_vortices, u_cur);
+    EXPECT_UNIFORM(&g_vortices, u_prev);
+    EXPECT_UNIFORM(&g_vortices, u_minDensity);
+    EXPECT_UNIFORM(&g_potentialRange, u_potential);
+    EXPECT_UNIFORM(&g_potentialRange, u_wall);
+    findLIPUniforms(&g_initLIPLanes, &g_buildLIPLanes, g_integrateLIPLanes);
+    EXPECT_UNIFORM(&g_LIPKissLanes, u_lipIn);
+    EXPECT_UNIFORM(&g_LIPKissLanes, u_potOut);
+
+    EXPECT_UNIFORM(&g_msdfGlyph, u_atlas);
+    FIND_UNIFORM(&g_msdfGlyph, u_pxrange);
 
-    g_msdfGlyph.prog.id = compileAndLinkFragProgram(&glyphVertShader, g_basePath, g_msdfGlyph.prog.name, "o_color");
-    if (g_msdfGlyph.prog.id == 0) return 1;
-    EXPECT_UNIFORM(&g_msdfGlyph.base, u_atlas);
-    EXPECT_UNIFORM(&g_msdfGlyph.base, u_ndcPos);
-    EXPECT_UNIFORM(&g_msdfGlyph.base, u_ndcSize);
-    EXPECT_UNIFORM(&g_msdfGlyph.base, u_atlasPos);
-    EXPECT_UNIFORM(&g_msdfGlyph.base, u_atlasSize);
-    FIND_UNIFORM(&g_msdfGlyph.base, u_pxrange);
-    EXPECT_UNIFORM(&g_msdfGlyph, u_color);
-
-    g_courseWall.prog.id = compileAndLinkFragProgram(&identityShader, g_basePath, g_courseWall.prog.name, "o_wall");
-    if (g_courseWall.prog.id == 0) return 1;
     FIND_UNIFORM(&g_courseWall, u_simSize);
-
-    g_coursePotential.prog.id = compileAndLinkFragProgram(&identityShader, g_basePath, g_coursePotential.prog.name, "o_potential");
-    if (g_coursePotential.prog.id == 0) return 1;
     FIND_UNIFORM(&g_coursePotential, u_simSize);
+    FIND_UNIFORM(&g_courseWall, u_time);
+    FIND_UNIFORM(&g_coursePotential, u_time);
 
-    g_fillColor.prog.id = compileAndLinkFragProgram(&identityShader, g_basePath, g_fillColor.prog.name, "o_color");
-    if (g_fillColor.prog.id == 0) return 1;
     EXPECT_UNIFORM(&g_fillColor, u_color);
+}
+
+static int simWidth;
+static int simHeight;
+static ShaderConstants shaderConstants = {.fourMDx2 = 4.f, .drag = 2e-3f, .stencilOrder = 2};
+static int loadedPrograms = 0;
+
+// Same return value as setShaderDefines
+static int updateShaderDefines() {
+    char defines[256];
+    SDL_snprintf(
+        defines, sizeof defines,
+        "#define SIM_SIZE ivec2(%d, %d)\n"
+        "#define FOUR_M_DX2 float(%.9g)\n"
+        "#define DRAG float(%.9g)\n"
+        "#define V_SHIFT float(%.9g)\n"
+        "#define STENCIL_ORDER %d\n",
+        simWidth, simHeight, shaderConstants.fourMDx2, shaderConstants.drag,
+        shaderConstants.potentialShift, shaderConstants.stencilOrder
+    );
+
+    return setShaderDefines(defines);
+}
+
+// Rebuilds all the programs (but not the vertex shaders, which don't
+// use any of the defines) after the shader defines change.
+static int reloadPrograms() {
+    SDL_Log("Shader constants changed, rebuilding programs");
+    deletePrograms();
+
+    TRACE_BEGIN("reloadPrograms");
+    int err = submitPrograms() || finishPrograms();
+    TRACE_END();
+    if (err) return 1;
+    findUniforms();
+
+    // Just in case the chosen variant doesn't compile with the new defines
+    if (g_qturnVariants[g_qturnVariant].prog.id == 0) g_qturnVariant = QTURN_TERNARY;
+    selectQTurnVariant(g_qturnVariant);
+    return 0;
+}
+
+// Sets the values of the constants in the shaders, rebuilding all the
+// programs if they changed.  Returns non-zero (and sets SDL error) on
+// failure, in which case the programs may no longer be usable.
+int setShaderConstants(ShaderConstants constants) {
+    shaderConstants = constants;
+    int changed = updateShaderDefines();
+    if (changed == -1) return 1;
+    if (changed && loadedPrograms) return reloadPrograms();
+    return 0;
+}
+
+int loadResources() {
+    int err;
+    initQuad();
+    initGlyphBatch();
+    initShaderCompiler();
 
     double aspect = 1.5;
-    int simHeight = 257;
-    int simWidth = (int)(simHeight*aspect);
+    simHeight = 257;
+    simWidth = (int)(simHeight*aspect);
+
+    // The shaders are specialized for the cached tuning, if any
+    loadLIPConfig(simWidth, simHeight);
+    if (updateShaderDefines() == -1) return 1;
+
+    // While the driver is busy compiling, we set up everything that
+    // doesn't depend on the programs.
+    TRACE_BEGIN("submitPrograms");
+    err = submitVertShaders() || submitPrograms();
+    TRACE_END();
+    if (err) return 1;
 
     for (int i = 0; i < 2; i++) {
         err = initTexturedFrameBuffer(&g_simBuffers[i], simWidth, simHeight, GL_RG32F, 1);
         if (err != 0) return err;
     }
 
+    err = initTexturedFrameBuffer(&g_simSpare, simWidth, simHeight, GL_RG32F, 1);
+    if (err != 0) return err;
+
 
     err = initTexturedFrameBuffer(&g_potentialBuffer, simWidth, simHeight, GL_R32F, 1);
     if (err != 0) return err;
-    glBindFramebuffer(GL_FRAMEBUFFER, g_potentialBuffer.fbo);
-    glViewport(0, 0, simWidth, simHeight);
-    glUseProgram(g_coursePotential.prog.id);
-    glUniform2f(g_coursePotential.u_simSize, (float)simWidth, (float)simHeight);
-    drawQuad();
-    glViewport(0, 0, g_drWidth, g_drHeight);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     err = initTexturedFrameBuffer(&g_wallBuffer, simWidth, simHeight, GL_RED, 1);
     if (err != 0) return err;
-    glBindFramebuffer(GL_FRAMEBUFFER, g_wallBuffer.fbo);
-    glViewport(0, 0, simWidth, simHeight);
-    glUseProgram(g_courseWall.prog.id);
-    glUniform2f(g_courseWall.u_simSize, (float)simWidth, (float)simHeight);
-    drawQuad();
-    glViewport(0, 0, g_drWidth, g_drHeight);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-    err = initTexturedFrameBuffer(&g_puttBuffer, simWidth, simHeight, GL_RG32F, 1);
+    err = initTexturedFrameBuffer(&g_nextPotentialBuffer, simWidth, simHeight, GL_R32F, 1);
+    if (err != 0) return err;
+
+    err = initTexturedFrameBuffer(&g_nextWallBuffer, simWidth, simHeight, GL_RED, 1);
     if (err != 0) return err;
 
     err = initTexturedFrameBuffer(&g_pdfBuffer, simWidth, simHeight, GL_R32F, 1);
     if (err != 0) return err;
 
+    err = initTexturedFrameBuffer(&g_surfaceBuffer, simWidth, simHeight, GL_RGBA32F, 1);
+    if (err != 0) return err;
+
     err = initCeilPyramidBuffer(&g_pdfPyramid, simWidth, simHeight, GL_R32F, 1);
     if (err != 0) return err;
 
@@ -271,11 +497,42 @@ int loadResources() {
     err = initTexturedFrameBuffer(&g_dragPot, simWidth, simHeight, GL_R32F, 1);
     if (err != 0) return err;
 
-    err = initTexturedFrameBuffer(&g_goalState, simWidth, simHeight, GL_RG32F, 1);
-    if (err != 0) return err;
+    // The goal's storage is (re)allocated by setGoalState once the hole
+    // is known, since the tile's size depends on holeSigma.
+    glGenTextures(1, &g_goalState.texture);
+    glBindTexture(GL_TEXTURE_2D, g_goalState.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    TRACE_BEGIN("loadFont");
+    err = loadFont(&g_fontRegular, g_basePath, "images/fonts/regular", '?', 8.f);
+    TRACE_END();
+    if (err) return err;
+
+    TRACE_BEGIN("finishPrograms");
+    err = finishPrograms();
+    TRACE_END();
+    if (err) return 1;
+    findUniforms();
+    loadedPrograms = 1;
 
-    err = initCeilPyramidBuffer(&g_goalPyramid, simWidth, simHeight, GL_RG32F, 1);
-    if (err != 0) return err;
+    glBindFramebuffer(GL_FRAMEBUFFER, g_potentialBuffer.fbo);
+    glViewport(0, 0, simWidth, simHeight);
+    glUseProgram(g_coursePotential.prog.id);
+    glUniform2f(g_coursePotential.u_simSize, (float)simWidth, (float)simHeight);
+    glUniform1f(g_coursePotential.u_time, 0.f);
+    drawQuad();
+    glViewport(0, 0, g_drWidth, g_drHeight);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, g_wallBuffer.fbo);
+    glViewport(0, 0, simWidth, simHeight);
+    glUseProgram(g_courseWall.prog.id);
+    glUniform2f(g_courseWall.u_simSize, (float)simWidth, (float)simHeight);
+    glUniform1f(g_courseWall.u_time, 0.f);
+    drawQuad();
+    glViewport(0, 0, g_drWidth, g_drHeight);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     if (g_renderer.u_skybox != -1) {
         char *filename;
@@ -290,12 +547,16 @@ int loadResources() {
         glGenTextures(1, &g_skyboxTexture);
 
         glBindTexture(GL_TEXTURE_CUBE_MAP, g_skyboxTexture);
+        TRACE_GPU_BEGIN("Skybox upload");
         for (int i = 0; i < 6; i++) {
             glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, surf->w, surf->h, 0, format, GL_UNSIGNED_BYTE, surf->pixels);
         }
+        TRACE_GPU_END();
         SDL_FreeSurface(surf);
 
+        TRACE_GPU_BEGIN("Skybox mipmaps");
         glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+        TRACE_GPU_END();
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -325,13 +586,25 @@ int loadResources() {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     }
 
-    if ((err = loadFont(&g_fontRegular, g_basePath, "images/fonts/regular", '?', 8.f)))
-        return err;
-
-    return 0;
+    glGenSamplers(1, &g_borderSampler);
+    glSamplerParameteri(g_borderSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glSamplerParameteri(g_borderSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glSamplerParameteri(g_borderSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glSamplerParameteri(g_borderSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glSamplerParameterfv(g_borderSampler, GL_TEXTURE_BORDER_COLOR, (GLfloat[]) {0.f, 0.f, 0.f, 0.f});
+
+    // The variant is tuned once the shader constants are final (see
+    // runGame in loop.c), until then the reference one is used.
+    selectQTurnVariant(QTURN_TERNARY);
+
+    TRACE_GPU_BEGIN("tuneLIP");
+    err = tuneLIP();
+    TRACE_GPU_END();
+    return err;
 }
 
 void freeResources() {
+    destroyGlyphBatch();
     destroyFont(&g_fontRegular);
 
     glDeleteTextures(1, &g_colormapTexture);
@@ -339,36 +612,24 @@ void freeResources() {
     glDeleteTextures(1, &g_skyboxTexture);
     g_skyboxTexture = 0;
 
-    deleteTexturedFrameBuffer(&g_goalState);
-    deletePaddedPyramidBuffer(&g_goalPyramid);
+    glDeleteTextures(1, &g_goalState.texture);
+    g_goalState = (GoalTile) {0};
     deleteTexturedFrameBuffer(&g_dragPot);
     deletePyramidBuffer(&g_dragLIP);
     deletePaddedPyramidBuffer(&g_pdfPyramid);
+    deleteTexturedFrameBuffer(&g_surfaceBuffer);
     deleteTexturedFrameBuffer(&g_pdfBuffer);
-    deleteTexturedFrameBuffer(&g_puttBuffer);
+    deleteTexturedFrameBuffer(&g_nextWallBuffer);
+    deleteTexturedFrameBuffer(&g_nextPotentialBuffer);
     deleteTexturedFrameBuffer(&g_wallBuffer);
     deleteTexturedFrameBuffer(&g_potentialBuffer);
     for (int i = 0; i < 2; i++) deleteTexturedFrameBuffer(&g_simBuffers[i]);
+    deleteTexturedFrameBuffer(&g_simSpare);
 
-    glDeleteProgram(g_coursePotential.prog.id);
-    glDeleteProgram(g_courseWall.prog.id);
-
-    for (int i = 0; i < 2; i++) glDeleteProgram(g_integrateLIP[i].prog.id);
-    glDeleteProgram(g_LIPKiss.prog.id);
-    glDeleteProgram(g_buildLIP.prog.id);
-    glDeleteProgram(g_initLIP.prog.id);
-    glDeleteProgram(g_rgsumReduce.prog.id);
-    glDeleteProgram(g_rsumReduce.prog.id);
-    glDeleteProgram(g_planeWave.prog.id);
-    glDeleteProgram(g_clubGfx.prog.id);
-    glDeleteProgram(g_debugRenderer.prog.id);
-    glDeleteProgram(g_renderer.prog.id);
-    glDeleteProgram(g_msdfGlyph.prog.id);
-    glDeleteProgram(g_fillColor.prog.id);
-    glDeleteProgram(g_pdf.prog.id);
-    glDeleteProgram(g_cmul.prog.id);
-    glDeleteProgram(g_putt.prog.id);
-    glDeleteProgram(g_qturn.prog.id);
+    deletePrograms();
+    loadedPrograms = 0;
+    glDeleteSamplers(1, &g_borderSampler);
+    g_borderSampler = 0;
     glDeleteProgram(g_gaussian.prog.id);
     glDeleteShader(identityShader.id);
     glDeleteShader(surfaceShader.id);
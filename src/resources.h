@@ -23,14 +23,32 @@ typedef struct {
         ProgIdentity vert;
     };
 
-    GLint u_4m_dx2;
     GLint u_dt;
     GLint u_prev;
     GLint u_potential;
     GLint u_dragPot;
     GLint u_wall;
 } ProgQTurn;
+
+// Ways of getting 0 for out of bounds neighbors in qturn.frag, see the
+// comments there.  The fastest one is chosen by tuneQTurn.
+typedef enum {
+    QTURN_TERNARY,  // The reference variant, which is always available
+    QTURN_MULTIPLY,
+    QTURN_IMAGE,
+    QTURN_ROBUST,
+    QTURN_BORDER,
+    NUM_QTURN_VARIANTS
+} QTurnVariant;
+
+// g_qturn is a copy of the chosen variant from g_qturnVariants.
+// Variants which are unsupported or failed to compile have prog.id 0.
 extern ProgQTurn g_qturn;
+extern ProgQTurn g_qturnVariants[NUM_QTURN_VARIANTS];
+extern const char *g_qturnVariantNames[NUM_QTURN_VARIANTS];
+extern QTurnVariant g_qturnVariant;
+// Sampler with a zero border, needed for u_prev by QTURN_BORDER
+extern GLuint g_borderSampler;
 
 
 typedef struct {
@@ -49,22 +67,36 @@ typedef struct {
         ProgSurface vert;
     };
 
-    GLint u_cur;
-    GLint u_pdf;
-    GLint u_totalProb;
+    GLint u_surface;
     GLint u_simSize;
     GLint u_puttActive;
-    GLint u_putt;
+    GLint u_puttOrigin;
+    GLint u_puttMomentum;
+    GLint u_puttClubRadius;
+    GLint u_puttPhase;
+    GLint u_dx;
     GLint u_colormap;
     GLint u_skybox;
     GLint u_mouse;
-    GLint u_potential;
     GLint u_wall;
     GLint u_drContourThickness;
     GLint u_contourProgress;
     GLint u_contourSep;
 } ProgRenderer;
 extern ProgRenderer g_renderer;
+extern ProgRenderer g_rendererSimple;  // Built with FANCY 0
+
+typedef struct {
+    union {
+        Program prog;
+        ProgIdentity vert;
+    };
+
+    GLint u_pdf;
+    GLint u_totalProb;
+    GLint u_potential;
+} ProgSurfacePass;
+extern ProgSurfacePass g_surfacePass;
 
 typedef struct {
     union {
@@ -89,27 +121,23 @@ typedef struct {
 } ProgPDF;
 extern ProgPDF g_pdf;
 
+// Applies a putt to the sim buffers in one pass, see applyPutt
 typedef struct {
-    union {
-        Program prog;
-        ProgSurface vert;
-    };
-
+    Program prog;
+    GLint u_cur;
+    GLint u_next;
+    GLint u_prevOut;
+    GLint u_potential;
+    GLint u_dragPot;
+    GLint u_wall;
+    GLint u_dt;
+    GLint u_origin;
     GLint u_momentum;
     GLint u_clubRadius;
-    GLint u_phase;
-} ProgPutt;
-extern ProgPutt g_putt;
-
-typedef struct {
-    union {
-        Program prog;
-        ProgSurface vert;
-    };
-
-    GLint u_momentum;
-} ProgPlaneWave;
-extern ProgPlaneWave g_planeWave;
+    GLint u_planeWave;
+    GLint u_dx;
+} ProgApplyPutt;
+extern ProgApplyPutt g_applyPutt;
 
 typedef struct {
     union {
@@ -121,16 +149,14 @@ typedef struct {
 } ProgClubGraphics;
 extern ProgClubGraphics g_clubGfx;
 
+// Overlap of psi with the goal state over the goal's tile
 typedef struct {
-    union {
-        Program prog;
-        ProgIdentity vert;
-    };
-
-    GLint u_left;
-    GLint u_right;
-} ProgCMul;
-extern ProgCMul g_cmul;
+    Program prog;
+    GLint u_cur;
+    GLint u_goal;
+    GLint u_offset;
+} ProgGoalOverlap;
+extern ProgGoalOverlap g_goalOverlap;
 
 typedef struct {
     union {
@@ -141,14 +167,12 @@ typedef struct {
     GLint u_src;
 } ProgReduce;
 extern ProgReduce g_rsumReduce;
-extern ProgReduce g_rgsumReduce;
 
 typedef struct {
     Program prog;
     GLint u_cur;
     GLint u_prev;
     GLint u_lipOut;
-    GLint u_simSize;
 } ProgInitLIP;
 extern ProgInitLIP g_initLIP;
 
@@ -174,15 +198,98 @@ typedef struct {
 } ProgIntegrateLIP;
 extern ProgIntegrateLIP g_integrateLIP[2];
 
+// Compile-time sizes for the drag (LIP) compute shaders, which are
+// injected as defines when they're loaded.  Chosen per device by tuneLIP.
 typedef struct {
-    union {
-        Program prog;
-        ProgDrawGlyph base;
-    };
+    int tile;    // init_lip/build_lip workgroups are tile x tile, including a 1 texel boundary
+    int groupX;  // integrate_lip_* workgroup size
+    int groupY;
+} LIPConfig;
+extern LIPConfig g_lipConfig;
+void formatLIPDefines(char *buf, size_t size, LIPConfig config);
+void findLIPUniforms(ProgInitLIP *init, ProgBuildLIP *build, ProgIntegrateLIP integrate[2]);
+
+// Programs for batches of independent simulations (lanes), see lanes.c.
+// The drag ones are the shaders in shaders/drag compiled with LANES.
+typedef struct {
+    Program prog;
+    GLint u_dt;
+    GLint u_prev;
+    GLint u_next;
+    GLint u_dragPot;
+    GLint u_potential;
+    GLint u_wall;
+} ProgQTurnLanes;
+extern ProgQTurnLanes g_qturnLanes;
 
-    GLint u_color;
-} ProgDrawMSDFGlyph;
-extern ProgDrawMSDFGlyph g_msdfGlyph;
+typedef struct {
+    Program prog;
+    GLint u_cur;
+    GLint u_prev;
+    GLint u_goal;
+    GLint u_goalOffset;
+} ProgLaneStats;
+extern ProgLaneStats g_laneStats;
+
+typedef struct {
+    Program prog;
+    GLint u_numPartials;
+} ProgLaneStatsSum;
+extern ProgLaneStatsSum g_laneStatsSum;
+
+// Observables of the sim, see observables.h
+typedef struct {
+    Program prog;
+    GLint u_cur;
+    GLint u_prev;
+    GLint u_potential;
+    GLint u_dragPot;
+    GLint u_wall;
+} ProgObservables;
+extern ProgObservables g_observables;
+
+typedef struct {
+    Program prog;
+    GLint u_numPartials;
+    GLint u_slot;
+} ProgObservablesSum;
+extern ProgObservablesSum g_observablesSum;
+
+// Vortex detection, see vortices.h
+typedef struct {
+    Program prog;
+    GLint u_cur;
+    GLint u_prev;
+    GLint u_minDensity;
+} ProgVortices;
+extern ProgVortices g_vortices;
+
+// Range of the course potential, see controlTimestep
+typedef struct {
+    Program prog;
+    GLint u_potential;
+    GLint u_wall;
+} ProgPotentialRange;
+extern ProgPotentialRange g_potentialRange;
+
+typedef struct {
+    Program prog;
+    GLint u_psi;
+    GLint u_origin;
+    GLint u_dx;
+} ProgPuttLanes;
+extern ProgPuttLanes g_puttLanes;
+
+extern ProgInitLIP g_initLIPLanes;
+extern ProgBuildLIP g_buildLIPLanes;
+extern ProgLIPKiss g_LIPKissLanes;
+extern ProgIntegrateLIP g_integrateLIPLanes[2];
+// The config the lane drag programs were compiled with, which can differ
+// from g_lipConfig until the programs are rebuilt, since tuneLIP only
+// swaps out the single lane ones.
+extern LIPConfig g_laneLIPConfig;
+
+extern ProgDrawGlyph g_msdfGlyph;
 
 typedef struct {
     union {
@@ -191,6 +298,7 @@ typedef struct {
     };
 
     GLint u_simSize;
+    GLint u_time;  // -1 unless the course is animated
 } ProgCourse;
 extern ProgCourse g_courseWall;
 extern ProgCourse g_coursePotential;
@@ -204,16 +312,32 @@ typedef struct {
 } ProgFillColor;
 extern ProgFillColor g_fillColor;
 
-// TODO: for time-dep pots we probably want 2 buffers so we precompute
-//  the next potential while we're using the current one
+// The course is double buffered: animated courses (whose shaders use
+// u_time) are evaluated into the next buffers while the current ones are
+// in use, and swapped at turn boundaries (see doPhysics).
 extern TexturedFrameBuffer g_potentialBuffer;
 extern TexturedFrameBuffer g_wallBuffer;
+extern TexturedFrameBuffer g_nextPotentialBuffer;
+extern TexturedFrameBuffer g_nextWallBuffer;
 extern TexturedFrameBuffer g_simBuffers[2];
-extern TexturedFrameBuffer g_puttBuffer;
+// A third sim buffer which applyPutt rotates with g_simBuffers, since it
+// can't write its results in place.
+extern TexturedFrameBuffer g_simSpare;
 extern TexturedFrameBuffer g_pdfBuffer;
+// Surface computed by g_surfacePass for the renderer, at sim resolution
+extern TexturedFrameBuffer g_surfaceBuffer;
 extern PaddedPyramidBuffer g_pdfPyramid;
-extern TexturedFrameBuffer g_goalState;
-extern PaddedPyramidBuffer g_goalPyramid;
+// The goal state is only stored on a tile around the hole, since it's
+// numerically zero a few holeSigma away.  (x, y) is the sim texel at the
+// tile's origin.  With several holes, there would be a tile per hole.
+typedef struct {
+    GLuint texture;
+    GLint x;
+    GLint y;
+    GLsizei width;
+    GLsizei height;
+} GoalTile;
+extern GoalTile g_goalState;
 extern TexturedFrameBuffer g_dragPot;
 extern PyramidBuffer g_dragLIP;
 extern GLuint g_skyboxTexture;
@@ -221,6 +345,23 @@ extern GLuint g_colormapTexture;
 
 extern Font g_fontRegular;
 
+// Values which are fixed for a run are compiled into the shaders as
+// #defines rather than passed as uniforms, so that the driver can fold
+// them.  SIM_SIZE (the size of the sim buffers) is also injected.
+typedef struct {
+    float fourMDx2;  // FOUR_M_DX2: 4*m*dx^2, where dx is texel size and m is mass
+    float drag;      // DRAG: strength of the drag force
+    // V_SHIFT: constant subtracted from the potential by qturnStep.  In
+    // the continuum this only changes the global phase, but with
+    // Visscher's method it changes the accuracy and stable range of dt
+    // (see controlTimestep in loop.c)
+    float potentialShift;
+    // STENCIL_ORDER: order of accuracy of the Laplacian, 2 (9-point) or 4
+    // (17-point), see common/qturn.glsl
+    int stencilOrder;
+} ShaderConstants;
+
+int setShaderConstants(ShaderConstants constants);
 int loadResources();
 void freeResources();
 void drawQuad();
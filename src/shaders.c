@@ -5,42 +5,224 @@
 #include "utils.h"
 
 
-// Return a shader ID on successful compilation, or 0 on failure.
-// (Valid shader IDs returned by glCreateShader are always non-zero)
+// Set by initShaderCompiler if the driver can compile shaders on
+// background threads and tell us when they are done without blocking.
+static int parallelCompile = 0;
+
+// Must be called with a current GL context before any shaders are
+// submitted, as the compiler thread count only affects compiles which
+// are started after it is set.
+void initShaderCompiler() {
+    // 0xFFFFFFFF means "as many threads as the implementation wants".
+    if (GLEW_KHR_parallel_shader_compile) {
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        parallelCompile = 1;
+    } else if (GLEW_ARB_parallel_shader_compile) {
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+        parallelCompile = 1;
+    }
+
+    SDL_Log("Parallel shader compilation %s", parallelCompile? "enabled" : "not supported");
+}
+
+
+// Load and start compiling a shader, without waiting for the result.
+// Returns 0 (and sets SDL error) only if the shader could not be loaded
+// or created.  Compilation errors are not checked here, that is up to
+// checkShaderOrDelete (or to finishProgram for shaders of programs).
 // The full path used to load the shader is simply basePath + path
 // TODO: If I have in-memory shaders, maybe load with basePath = NULL
-// If compilation fails, will set SDL error
-GLuint loadShader(GLenum shaderType, const char *basePath, const char *path) {
+GLuint submitShader(GLenum shaderType, const char *basePath, const char *path) {
+    return submitShaderWithDefines(shaderType, basePath, path, NULL);
+}
+
+
+// Host defines inserted into every shader, see setShaderDefines
+static char *hostDefines = NULL;
+
+// Sets #defines (as GLSL source, one per line) to be inserted into every
+// shader submitted after this, for values that are fixed for a run.
+// Returns 1 if they're different from before, meaning any programs that
+// were already built need to be rebuilt to use them, 0 if they're the
+// same, or -1 (and sets SDL error) on failure.
+int setShaderDefines(const char *defines) {
+    if (hostDefines != NULL && SDL_strcmp(hostDefines, defines) == 0) return 0;
+    char *newDefines = SDL_strdup(defines);
+    if (SET_ERR_IF_TRUE(newDefines == NULL)) return -1;
+    SDL_free(hostDefines);
+    hostDefines = newDefines;
+    return 1;
+}
+
+
+#define MAX_INCLUDE_DEPTH 8
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} SourceBuffer;
+
+static int appendSource(SourceBuffer *buf, const char *str, size_t len) {
+    if (buf->len + len + 1 > buf->cap) {
+        size_t newCap = SDL_max(2 * buf->cap, buf->len + len + 1);
+        char *newData = SDL_realloc(buf->data, newCap);
+        if (SET_ERR_IF_TRUE(newData == NULL)) return 1;
+        buf->data = newData;
+        buf->cap = newCap;
+    }
+
+    SDL_memcpy(buf->data + buf->len, str, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+    return 0;
+}
+
+static int appendLineDirective(SourceBuffer *buf, int line, int sourceNum) {
+    char directive[64];
+    int len = SDL_snprintf(directive, sizeof directive, "#line %d %d\n", line, sourceNum);
+    return appendSource(buf, directive, (size_t)len);
+}
+
+// Appends the source of basePath + path to buf, replacing lines like
+//   #include "other.glsl"
+// with the contents of other.glsl (relative to the directory of path),
+// which may have #includes of its own.  There are no include guards, so
+// don't include the same file twice.
+// #line directives are added so that compile errors have the right line
+// numbers.  Each included file is given its own source string number,
+// in order of inclusion (so the shader itself is 0, its first include
+// is 1, and so on).
+static int appendShaderSource(SourceBuffer *buf, const char *basePath, const char *path, int depth, int *numSources) {
+    if (depth > MAX_INCLUDE_DEPTH) {
+        SDL_SetError("#include nested too deeply in %s", path);
+        return 1;
+    }
+
     char *fullPath;
     if (SET_ERR_IF_TRUE(SDL_asprintf(&fullPath, "%s%s", basePath, path) == -1))
-        return 0;
+        return 1;
 
     // Not using SDL_LoadFile for better error messages
     SDL_RWops *file = SDL_RWFromFile(fullPath, "r");
     SDL_free(fullPath);
-    if (file == NULL) return 0;
-    const char *shaderSource = SDL_LoadFile_RW(file, NULL, 1);
-    if (shaderSource == NULL) return 0;
+    if (file == NULL) return 1;
+    char *source = SDL_LoadFile_RW(file, NULL, 1);
+    if (source == NULL) return 1;
+
+    int sourceNum = (*numSources)++;
+    int err = 0;
+    const char *line = source;
+    for (int lineNum = 1; *line && !err; lineNum++) {
+        const char *next = SDL_strchr(line, '\n');
+        next = next? next + 1 : line + SDL_strlen(line);
+
+        const char *directive = line;
+        while (*directive == ' ' || *directive == '\t') directive++;
+        if (SDL_strncmp(directive, "#include", 8) != 0) {
+            err = appendSource(buf, line, next - line);
+            line = next;
+            continue;
+        }
+
+        const char *open = SDL_strchr(directive, '"');
+        const char *close = open && open < next? SDL_strchr(open + 1, '"') : NULL;
+        if (close == NULL || close >= next) {
+            SDL_SetError("%s:%d: #include expects \"file\"", path, lineNum);
+            err = 1;
+            break;
+        }
+
+        const char *slash = SDL_strrchr(path, '/');
+        size_t dirLen = slash? (size_t)(slash - path) + 1 : 0;
+        size_t nameLen = (size_t)(close - open) - 1;
+        char *includePath = SDL_malloc(dirLen + nameLen + 1);
+        if (SET_ERR_IF_TRUE(includePath == NULL)) {
+            err = 1;
+            break;
+        }
+
+        SDL_memcpy(includePath, path, dirLen);
+        SDL_memcpy(includePath + dirLen, open + 1, nameLen);
+        includePath[dirLen + nameLen] = '\0';
+
+        err = (
+            appendLineDirective(buf, 1, *numSources) ||
+            appendShaderSource(buf, basePath, includePath, depth + 1, numSources) ||
+            appendSource(buf, "\n", 1) ||
+            appendLineDirective(buf, lineNum + 1, sourceNum)
+        );
+
+        // Each level adds its own line, so the whole chain is shown.  The
+        // error is copied first since SDL_SetError formats into the same
+        // buffer.
+        char *inner = err? SDL_strdup(SDL_GetError()) : NULL;
+        if (inner) {
+            SDL_SetError("%s\n> Included from %s:%d", inner, path, lineNum);
+            SDL_free(inner);
+        }
+
+        SDL_free(includePath);
+        line = next;
+    }
+
+    SDL_free(source);
+    return err;
+}
+
+
+// Same as submitShader, but if defines is non-NULL, it is inserted into
+// the source right after the #version line (which must be the first
+// line), so that variants of a shader can be selected with #ifdef.
+// The host defines from setShaderDefines are inserted there too, and
+// #includes are resolved as described in appendShaderSource.
+GLuint submitShaderWithDefines(GLenum shaderType, const char *basePath, const char *path, const char *defines) {
+    SourceBuffer source = {0};
+    int numSources = 0;
+    if (appendShaderSource(&source, basePath, path, 0, &numSources)) {
+        SDL_free(source.data);
+        return 0;
+    }
 
     GLuint result = glCreateShader(shaderType);
     if (result == 0) {
         SDL_SetError("glCreateShader() returned %s", getGlErrorString(glGetError()));
+        SDL_free(source.data);
         return 0;
     }
 
-    glShaderSource(result, 1, &shaderSource, NULL);
-    SDL_free((void *) shaderSource);
-    return compileShaderOrDelete(result, path);
+    // Rather than copying the source again, the defines are passed as
+    // separate strings.  The #line resets the line numbers (and source
+    // string number) to what they were in the original file.
+    const char *rest = SDL_strchr(source.data, '\n');
+    rest = rest? rest + 1 : source.data + source.len;
+    const GLchar *strings[5] = {
+        source.data, hostDefines? hostDefines : "", defines? defines : "", "#line 2 0\n", rest
+    };
+    GLint lengths[5] = {(GLint)(rest - source.data), -1, -1, -1, -1};
+    glShaderSource(result, 5, strings, lengths);
+
+    SDL_free(source.data);
+    glCompileShader(result);
+    return result;
 }
 
 
-// glCompileShader but with error handling
+// Return a shader ID on successful compilation, or 0 on failure.
+// (Valid shader IDs returned by glCreateShader are always non-zero)
+// If compilation fails, will set SDL error
+GLuint loadShader(GLenum shaderType, const char *basePath, const char *path) {
+    GLuint shader = submitShader(shaderType, basePath, path);
+    if (shader == 0) return 0;
+    return checkShaderOrDelete(shader, path);
+}
+
+
+// Checks the result of a previous glCompileShader.
 // Returns back the passed shader on success.  On failure, the shader is
 // deleted and 0 is returned (the null shader).
 // Compilation errors are set as the SDL error, and shader is deleted.
-GLuint compileShaderOrDelete(GLuint shader, const char *name) {
-    glCompileShader(shader);
-
+GLuint checkShaderOrDelete(GLuint shader, const char *name) {
     GLint isCompiled = GL_FALSE;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &isCompiled);
     if(isCompiled == GL_FALSE) {
@@ -56,10 +238,15 @@ GLuint compileShaderOrDelete(GLuint shader, const char *name) {
 }
 
 
-// Same idea as compileShaderOrDelete, but for programs
-GLuint linkProgramOrDelete(GLuint program, const char *name) {
-    glLinkProgram(program);
+// glCompileShader but with error handling, see checkShaderOrDelete
+GLuint compileShaderOrDelete(GLuint shader, const char *name) {
+    glCompileShader(shader);
+    return checkShaderOrDelete(shader, name);
+}
+
 
+// Same idea as checkShaderOrDelete, but for programs
+GLuint checkProgramOrDelete(GLuint program, const char *name) {
     GLint isLinked = GL_FALSE;
     glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
     if (isLinked == GL_FALSE) {
@@ -75,6 +262,13 @@ GLuint linkProgramOrDelete(GLuint program, const char *name) {
 }
 
 
+// Same idea as compileShaderOrDelete, but for programs
+GLuint linkProgramOrDelete(GLuint program, const char *name) {
+    glLinkProgram(program);
+    return checkProgramOrDelete(program, name);
+}
+
+
 // Create a program from a vertex and fragment shader, binding required
 // attribute/fragment output variables to locations specified as reqVars
 // in the Shader struct using glBind(Attrib|FragData)Location.
@@ -105,7 +299,17 @@ GLuint linkProgramOrDelete(GLuint program, const char *name) {
 // I wish glBind(Attrib|FragData)Location reserved a slot, preventing
 // any other variables from binding to the specified location.  That at
 // least would be a little bit better...
+//
+// Building is split into submitProgramFromShaders, which starts the link
+// without waiting for it, and checkProgramFromShaders, which checks the
+// result and produces the warnings described above.
 GLuint buildProgramFromShaders(Shader *vert, Shader *frag) {
+    GLuint program = submitProgramFromShaders(vert, frag);
+    if (program == 0) return 0;
+    return checkProgramFromShaders(program, vert, frag);
+}
+
+GLuint submitProgramFromShaders(Shader *vert, Shader *frag) {
     if (SET_ERR_IF_TRUE(vert == NULL)) return 0;
     // NULL fragment shader is sensible in principle, but not worth
     // implementing for picoputt.
@@ -119,8 +323,12 @@ GLuint buildProgramFromShaders(Shader *vert, Shader *frag) {
 
     glAttachShader(program, vert->id);
     glAttachShader(program, frag->id);
+    glLinkProgram(program);
+    return program;
+}
 
-    program = linkProgramOrDelete(program, NULL);
+GLuint checkProgramFromShaders(GLuint program, Shader *vert, Shader *frag) {
+    program = checkProgramOrDelete(program, NULL);
     if (program == 0) {
         SDL_SetError(
             "%s\n> Vertex shader: %s\n> Fragment shader: %s",
@@ -154,33 +362,111 @@ GLuint buildProgramFromShaders(Shader *vert, Shader *frag) {
     return program;
 }
 
+
+// Start compiling and linking the program described by build.
+// The program's ID is not stored in build->prog until finishProgram.
+// Returns non-zero (and sets SDL error) if the shader couldn't even be
+// loaded, but compilation and linking errors are left to finishProgram.
+int submitProgram(ProgramBuild *build, const char *basePath) {
+    build->shader = submitShaderWithDefines(build->type, basePath, build->prog->name, build->defines);
+    if (build->shader == 0) return 1;
+
+    if (build->type == GL_COMPUTE_SHADER) {
+        build->prog->id = glCreateProgram();
+        glAttachShader(build->prog->id, build->shader);
+        glLinkProgram(build->prog->id);
+    } else {
+        Shader frag = {
+            .id = build->shader, .name = build->prog->name, .numReqVars = 1,
+            .reqVars = (VariableBinding[]){{build->outVar, 0}}
+        };
+
+        build->prog->id = submitProgramFromShaders(build->vert, &frag);
+    }
+
+    return build->prog->id == 0;
+}
+
+
+// Wait for all the submitted programs to finish compiling and linking.
+// Without parallel shader compilation, there's no point in waiting, as
+// the driver will simply block when finishProgram asks for the results.
+void waitForPrograms(ProgramBuild *builds, size_t numBuilds) {
+    if (!parallelCompile) return;
+    for (size_t i = 0; i < numBuilds;) {
+        GLint done = GL_TRUE;
+        if (builds[i].prog->id != 0)
+            glGetProgramiv(builds[i].prog->id, GL_COMPLETION_STATUS_KHR, &done);
+        if (done) i++;
+        else SDL_Delay(1);
+    }
+}
+
+
+// Check the results of submitProgram.  On failure, the program is
+// deleted, prog->id is set to 0, and the SDL error is set to the same
+// message that loadShader and buildProgramFromShaders would produce.
+// Returns non-zero on failure.
+int finishProgram(ProgramBuild *build) {
+    Program *prog = build->prog;
+    GLint isLinked = GL_FALSE;
+    glGetProgramiv(prog->id, GL_LINK_STATUS, &isLinked);
+    if (isLinked == GL_FALSE) {
+        // A failed compile will also fail the link, but the compile log
+        // is the one that's actually useful.
+        GLint isCompiled = GL_FALSE;
+        glGetShaderiv(build->shader, GL_COMPILE_STATUS, &isCompiled);
+        if (isCompiled == GL_FALSE) {
+            checkShaderOrDelete(build->shader, prog->name);
+            glDeleteProgram(prog->id);
+            prog->id = 0;
+            return 1;
+        }
+    }
+
+    if (build->type == GL_COMPUTE_SHADER) {
+        prog->id = checkProgramOrDelete(prog->id, prog->name);
+        if (prog->id == 0) {
+            SDL_SetError("%s\n> Compute shader: %s", SDL_GetError(), prog->name);
+        }
+    } else {
+        Shader frag = {
+            .id = build->shader, .name = prog->name, .numReqVars = 1,
+            .reqVars = (VariableBinding[]){{build->outVar, 0}}
+        };
+
+        prog->id = checkProgramFromShaders(prog->id, build->vert, &frag);
+    }
+
+    glDeleteShader(build->shader);  // Lifetime of shader is bound to program
+    build->shader = 0;
+    return prog->id == 0;
+}
+
+
 // Helper for loading simple kinds of fragment programs
 // Lifetime of loaded fragment shader will be bound to the program
 // fragOutVar will be bound to fragment data location 0
 GLuint compileAndLinkFragProgram(Shader *vert, const char *basePath, const char *fragPath, const char *fragOutVar) {
-    GLuint fragId = loadShader(GL_FRAGMENT_SHADER, basePath, fragPath);
-    if (fragId == 0) return 0;
-    Shader frag = {
-        .id = fragId, .name = fragPath, .numReqVars = 1,
-        .reqVars = (VariableBinding[]){{fragOutVar, 0}}
-    };
+    Program prog = {.name = fragPath};
+    ProgramBuild build = {&prog, vert, GL_FRAGMENT_SHADER, fragOutVar};
+    if (submitProgram(&build, basePath)) {
+        glDeleteShader(build.shader);
+        return 0;
+    }
 
-    GLuint program = buildProgramFromShaders(vert, &frag);
-    glDeleteShader(fragId);  // Lifetime of fragment shader is bound to program
-    return program;
+    finishProgram(&build);
+    return prog.id;
 }
 
 GLuint compileAndLinkCompProgram(const char *basePath, const char *compPath) {
-    GLuint compId = loadShader(GL_COMPUTE_SHADER, basePath, compPath);
-    if (compId == 0) return 0;
-
-    GLuint program = glCreateProgram();
-    glAttachShader(program, compId);
-    program = linkProgramOrDelete(program, compPath);
-    if (program == 0) {
-        SDL_SetError("%s\n> Compute shader: %s", SDL_GetError(), compPath);
+    Program prog = {.name = compPath};
+    ProgramBuild build = {&prog, NULL, GL_COMPUTE_SHADER};
+    if (submitProgram(&build, basePath)) {
+        glDeleteShader(build.shader);
         return 0;
     }
 
-    return program;
+    finishProgram(&build);
+    return prog.id;
 }
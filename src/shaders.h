@@ -36,10 +36,35 @@ typedef struct {
     VariableBinding *reqVars;
 } Shader;
 
+// Everything needed to build a program from a fragment shader (with a
+// vertex shader that is shared with other programs) or from a compute
+// shader.  Building happens in two phases (submitProgram, then
+// finishProgram) so that the driver can compile many programs in
+// parallel before we block on any of their results.
+typedef struct {
+    Program *prog;
+    Shader *vert;        // NULL for compute programs
+    GLenum type;         // GL_FRAGMENT_SHADER or GL_COMPUTE_SHADER
+    const char *outVar;  // Fragment data variable bound to location 0
+    const char *defines; // Inserted after #version, may be NULL
+    GLuint shader;       // Fragment/compute shader, deleted by finishProgram
+} ProgramBuild;
+
+void initShaderCompiler();
+int setShaderDefines(const char *defines);
+GLuint submitShader(GLenum shaderType, const char *basePath, const char *path);
+GLuint submitShaderWithDefines(GLenum shaderType, const char *basePath, const char *path, const char *defines);
 GLuint loadShader(GLenum shaderType, const char *basePath, const char *path);
+GLuint checkShaderOrDelete(GLuint shader, const char *name);
 GLuint compileShaderOrDelete(GLuint shader, const char *name);
+GLuint checkProgramOrDelete(GLuint program, const char *name);
 GLuint linkProgramOrDelete(GLuint program, const char *name);
+GLuint submitProgramFromShaders(Shader *vert, Shader *frag);
+GLuint checkProgramFromShaders(GLuint program, Shader *vert, Shader *frag);
 GLuint buildProgramFromShaders(Shader *vert, Shader *frag);
+int submitProgram(ProgramBuild *build, const char *basePath);
+void waitForPrograms(ProgramBuild *builds, size_t numBuilds);
+int finishProgram(ProgramBuild *build);
 GLuint compileAndLinkFragProgram(Shader *vert, const char *basePath, const char *fragPath, const char *fragOutVar);
 GLuint compileAndLinkCompProgram(const char *basePath, const char *compPath);
 #endif //PICOPUTT_SHADERS_H
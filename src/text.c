@@ -2,12 +2,130 @@
 #include "utils.h"
 
 
+static size_t hashCode(char32_t code) {
+    // Multiplying by an odd number permutes the low bits, so runs of
+    // consecutive code points (the common case) never collide.
+    return (size_t)((uint32_t)code * 2654435769u);
+}
+
+// Builds the code point lookup table used by findGlyph.  The table has
+// at least twice as many slots as glyphs, so probes stay short and
+// there's always an empty slot to end a search.
+static int buildGlyphLookup(Font *font) {
+    size_t size = 16;
+    while (size < 2 * font->numGlyphs) size *= 2;
+    uint32_t *lookup = calloc(size, sizeof(uint32_t));
+    if (SET_ERR_IF_TRUE(lookup == NULL)) return 1;
+
+    for (size_t i = 0; i < font->numGlyphs; i++) {
+        size_t slot = hashCode(font->glyphs[i].code) & (size - 1);
+        while (lookup[slot]) slot = (slot + 1) & (size - 1);
+        lookup[slot] = (uint32_t)(i + 1);
+    }
+
+    font->lookup = lookup;
+    font->lookupMask = size - 1;
+    return 0;
+}
+
+
+// Font pack format, as written by images/fonts/pack_font.py.
+// Everything is little-endian:
+//   FontPackHeader
+//   Glyph glyphs[numGlyphs]  (in the same layout as the Glyph struct)
+//   GL_RGB/GL_UNSIGNED_BYTE atlas pixels, tightly packed, top row first
+#define FONT_PACK_MAGIC "PPFT"
+#define FONT_PACK_VERSION 1
+#define FONT_PACK_MAX_ATLAS 16384
+typedef struct {
+    char magic[4];
+    Uint32 version;
+    float pxrange;
+    float lineHeight;  // In em units
+    Uint32 numGlyphs;
+    Uint32 missingIndex;
+    Uint32 atlasWidth;
+    Uint32 atlasHeight;
+} FontPackHeader;
+
+_Static_assert(sizeof(FontPackHeader) == 32, "FontPackHeader must match pack_font.py");
+_Static_assert(sizeof(Glyph) == 40, "Glyph must match pack_font.py");
+
+
+// Loads a font pack, which needs no parsing: the glyph table is copied
+// as is and the atlas is uploaded straight from the mapped file.
+static int loadFontPack(Font *result, const char *path) {
+    if (SET_ERR_IF_TRUE(SDL_BYTEORDER != SDL_LIL_ENDIAN)) return 2;
+
+    size_t size;
+    const unsigned char *data = mapFile(path, &size);
+    if (data == NULL) return 1;
+
+    FontPackHeader header;
+    if (SET_ERR_IF_TRUE(size < sizeof header)) {
+        unmapFile(data, size);
+        return 2;
+    }
+
+    SDL_memcpy(&header, data, sizeof header);
+    if (SET_ERR_IF_TRUE(SDL_memcmp(header.magic, FONT_PACK_MAGIC, 4) != 0) ||
+        SET_ERR_IF_TRUE(header.version != FONT_PACK_VERSION) ||
+        SET_ERR_IF_TRUE(header.missingIndex >= header.numGlyphs) ||
+        SET_ERR_IF_TRUE(header.atlasWidth > FONT_PACK_MAX_ATLAS) ||
+        SET_ERR_IF_TRUE(header.atlasHeight > FONT_PACK_MAX_ATLAS)) {
+        unmapFile(data, size);
+        return 2;
+    }
+
+    size_t glyphsSize = (size_t)header.numGlyphs * sizeof(Glyph);
+    size_t atlasSize = 3 * (size_t)header.atlasWidth * (size_t)header.atlasHeight;
+    if (SET_ERR_IF_TRUE(size != sizeof header + glyphsSize + atlasSize)) {
+        unmapFile(data, size);
+        return 2;
+    }
+
+    Glyph *glyphs = malloc(glyphsSize);
+    if (SET_ERR_IF_TRUE(glyphs == NULL)) {
+        unmapFile(data, size);
+        return -1;
+    }
+    SDL_memcpy(glyphs, data + sizeof header, glyphsSize);
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(
+        GL_TEXTURE_2D, 0, GL_RGB, (GLsizei)header.atlasWidth, (GLsizei)header.atlasHeight, 0,
+        GL_RGB, GL_UNSIGNED_BYTE, data + sizeof header + glyphsSize
+    );
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    unmapFile(data, size);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    result->glyphs = glyphs;
+    result->numGlyphs = header.numGlyphs;
+    result->atlas = texture;
+    result->missing = glyphs[header.missingIndex];
+    result->pxrange = header.pxrange;
+    result->lineHeight = header.lineHeight;
+    return 0;
+}
+
+
+// Loads a font from the BMP atlas and CSV metadata produced by
+// msdf-atlas-gen.  This is only the fallback for when there's no font
+// pack, since parsing the CSV is comparatively slow.
 // TODO: I should consider using the JSON metadata files that can be
 //  produced by msdf-atlas-gen rather than CSV.  The JSON files have
 //  pxrange and other useful global metadata (eg lineHeight, which I'm
 //  currently hard-coding) stored in them so I don't have to awkwardly
 //  pass them to loadFont.
-int loadFont(Font *result, const char *basePath, const char *fontPath, char32_t missing, float pxrange) {
+static int loadFontCSV(Font *result, const char *basePath, const char *fontPath, char32_t missing, float pxrange) {
     char *filePath;
     if (SET_ERR_IF_TRUE(SDL_asprintf(&filePath, "%s%s.bmp", basePath, fontPath) == -1)) {
         return -1;
@@ -106,6 +224,35 @@ int loadFont(Font *result, const char *basePath, const char *fontPath, char32_t
     result->atlas = texture;
     result->missing = glyphs[missingIndex];
     result->pxrange = pxrange;
+    result->lineHeight = 1.22f;
+
+    return 0;
+}
+
+
+// Loads fontPath.font if possible, and otherwise fontPath.bmp and
+// fontPath.csv (in which case missing and pxrange are used, since the
+// CSV doesn't include them).
+int loadFont(Font *result, const char *basePath, const char *fontPath, char32_t missing, float pxrange) {
+    char *packPath;
+    if (SET_ERR_IF_TRUE(SDL_asprintf(&packPath, "%s%s.font", basePath, fontPath) == -1)) {
+        return -1;
+    }
+
+    int err = loadFontPack(result, packPath);
+    if (err) {
+        SDL_Log("Couldn't load font pack %s, falling back to BMP+CSV: %s", packPath, SDL_GetError());
+        err = loadFontCSV(result, basePath, fontPath, missing, pxrange);
+    }
+
+    SDL_free(packPath);
+    if (err) return err;
+
+    result->lookup = NULL;
+    if (buildGlyphLookup(result)) {
+        destroyFont(result);
+        return -1;
+    }
 
     return 0;
 }
@@ -114,61 +261,187 @@ int loadFont(Font *result, const char *basePath, const char *fontPath, char32_t
 void destroyFont(Font *font) {
     font->numGlyphs = 0;
     if (font->glyphs) free(font->glyphs);
+    font->glyphs = NULL;
+    free(font->lookup);
+    font->lookup = NULL;
     glDeleteTextures(1, &font->atlas);
     font->atlas = 0;
 }
 
 
-Glyph *findGlyph(char32_t code, size_t numGlyphs, Glyph *glyphs) {
-    // Since I expect most characters to be in the large contiguous
-    // ASCII section at the beginning, for my purposes it seems most
-    // sensible to first try a direct lookup from the beginning of the
-    // array and then linear search starting from the end if that fails.
+Glyph *findGlyph(Font *font, char32_t code) {
+    if (font->lookup == NULL) return NULL;
+    for (size_t slot = hashCode(code) & font->lookupMask;; slot = (slot + 1) & font->lookupMask) {
+        uint32_t index = font->lookup[slot];
+        if (index == 0) return NULL;
+        if (font->glyphs[index - 1].code == code) return &font->glyphs[index - 1];
+    }
+}
+
+
+static GLuint batchVAO = 0;
+static GLuint batchVBO = 0;
+static GlyphBuffer batch = {0};
+// Glyphs go here instead of the batch while a text block is laid out
+static GlyphBuffer *recording = NULL;
+static GLfloat textColor[4] = {0.f, 0.f, 0.f, 1.f};
 
-    if (!numGlyphs) return NULL;
-    uint32_t guess = code - glyphs->code;
-    if (guess < numGlyphs && glyphs[guess].code == code) {
-        return &glyphs[guess];
+static ProgDrawGlyph *activeRenderer = NULL;
+static Font *activeFont = NULL;
+static GLint activeTexUnit = 0;
+
+
+void initGlyphBatch() {
+    if (batchVAO) return;
+    glGenBuffers(1, &batchVBO);
+    glGenVertexArrays(1, &batchVAO);
+    glBindVertexArray(batchVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, batchVBO);
+
+    // The quad corners come from gl_VertexID, so these are the only
+    // attributes.
+    GLsizei stride = sizeof(GlyphInstance);
+    GLint indices[] = {ATTR_IDX_GLYPH_NDC, ATTR_IDX_GLYPH_ATLAS, ATTR_IDX_GLYPH_COLOR};
+    size_t offsets[] = {
+        offsetof(GlyphInstance, ndcRect),
+        offsetof(GlyphInstance, atlasRect),
+        offsetof(GlyphInstance, color)
+    };
+    for (int i = 0; i < 3; i++) {
+        glVertexAttribPointer(indices[i], 4, GL_FLOAT, GL_FALSE, stride, (void *) offsets[i]);
+        glVertexAttribDivisor(indices[i], 1);
+        glEnableVertexAttribArray(indices[i]);
     }
 
-    for (size_t i = numGlyphs; i--;) {
-        if (glyphs[i].code == code) return &glyphs[i];
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void destroyGlyphBatch() {
+    glDeleteVertexArrays(1, &batchVAO);
+    glDeleteBuffers(1, &batchVBO);
+    batchVAO = batchVBO = 0;
+    free(batch.instances);
+    batch = (GlyphBuffer) {0};
+    recording = NULL;
+    activeRenderer = NULL;
+    activeFont = NULL;
+}
+
+
+static GlyphInstance *appendGlyphs(GlyphBuffer *buf, size_t count) {
+    if (buf->size + count > buf->capacity) {
+        size_t newCapacity = buf->capacity? buf->capacity : 256;
+        while (newCapacity < buf->size + count) newCapacity *= 2;
+        GlyphInstance *newInstances = realloc(buf->instances, newCapacity * sizeof(GlyphInstance));
+        if (newInstances == NULL) return NULL;
+        buf->instances = newInstances;
+        buf->capacity = newCapacity;
     }
 
-    return NULL;
+    GlyphInstance *result = &buf->instances[buf->size];
+    buf->size += count;
+    return result;
+}
+
+
+void flushGlyphs() {
+    if (batch.size == 0) return;
+    if (activeRenderer == NULL || activeFont == NULL || batchVAO == 0) {
+        batch.size = 0;
+        return;
+    }
+
+    glUseProgram(activeRenderer->prog.id);
+    glActiveTexture(GL_TEXTURE0 + activeTexUnit);
+    glBindTexture(GL_TEXTURE_2D, activeFont->atlas);
+    glUniform1i(activeRenderer->u_atlas, activeTexUnit);
+    glUniform1f(activeRenderer->u_pxrange, activeFont->pxrange);
+
+    // Orphaning the buffer each flush means we never wait on the GPU to
+    // finish with the previous batch.
+    glBindBuffer(GL_ARRAY_BUFFER, batchVBO);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(batch.capacity * sizeof(GlyphInstance)), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, (GLsizeiptr)(batch.size * sizeof(GlyphInstance)), batch.instances);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindVertexArray(batchVAO);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, (GLsizei)batch.size);
+    batch.size = 0;
+}
+
+
+int beginTextBlock(TextBlock *block, const int key[TEXT_BLOCK_KEY_SIZE]) {
+    if (block->valid && SDL_memcmp(block->key, key, sizeof block->key) == 0) return 0;
+    SDL_memcpy(block->key, key, sizeof block->key);
+    block->valid = 1;
+    block->glyphs.size = 0;
+    recording = &block->glyphs;
+    return 1;
+}
+
+void endTextBlock() {
+    recording = NULL;
+}
+
+void drawTextBlock(TextBlock *block) {
+    if (!block->valid || block->glyphs.size == 0) return;
+    GlyphInstance *dst = appendGlyphs(&batch, block->glyphs.size);
+    if (dst == NULL) return;
+    SDL_memcpy(dst, block->glyphs.instances, block->glyphs.size * sizeof(GlyphInstance));
+}
+
+void destroyTextBlock(TextBlock *block) {
+    if (recording == &block->glyphs) recording = NULL;
+    free(block->glyphs.instances);
+    *block = (TextBlock) {0};
 }
 
 
-static ProgDrawGlyph *activeRenderer = NULL;
-static Font *activeFont = NULL;
 void useFont(Font *font, ProgDrawGlyph *renderer, GLint atlasTexUnit) {
-    glUseProgram(renderer->prog.id);
-    glActiveTexture(GL_TEXTURE0 + atlasTexUnit);
-    glBindTexture(GL_TEXTURE_2D, font->atlas);
-    glUniform1i(renderer->u_atlas, atlasTexUnit);
-    glUniform1f(renderer->u_pxrange, font->pxrange);
+    if (font != activeFont || renderer != activeRenderer || atlasTexUnit != activeTexUnit) {
+        flushGlyphs();
+    }
 
     activeRenderer = renderer;
     activeFont = font;
+    activeTexUnit = atlasTexUnit;
+}
+
+
+void setTextColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a) {
+    textColor[0] = r;
+    textColor[1] = g;
+    textColor[2] = b;
+    textColor[3] = a;
+}
+
+void setTextColorv(const GLfloat color[4]) {
+    setTextColor(color[0], color[1], color[2], color[3]);
 }
 
 
 void drawGlyph(Cursor *cursor, Glyph *glyph) {
     if (activeRenderer == NULL || activeFont == NULL) return;
     if (glyph == NULL) glyph = &activeFont->missing;
+    GlyphInstance *instance = appendGlyphs(recording? recording : &batch, 1);
+    if (instance == NULL) return;
 
     double x = (cursor->x + cursor->size * glyph->bbox.x)/cursor->viewWidth;
     double y = (cursor->y + cursor->size * glyph->bbox.y)/cursor->viewHeight;
     double w = cursor->size * glyph->bbox.w / cursor->viewWidth;
     double h = cursor->size * glyph->bbox.h / cursor->viewHeight;
 
-    glUniform2f(activeRenderer->u_ndcPos, (GLfloat)(2. * x - 1.), (GLfloat)(2. * y - 1.));
-    glUniform2f(activeRenderer->u_ndcSize, (GLfloat)(2. * w), (GLfloat)(2. * h));
-
-    glUniform2f(activeRenderer->u_atlasPos, (GLfloat)glyph->uv.x, glyph->uv.y);
-    glUniform2f(activeRenderer->u_atlasSize, (GLfloat)glyph->uv.w, glyph->uv.h);
+    instance->ndcRect[0] = (GLfloat)(2. * x - 1.);
+    instance->ndcRect[1] = (GLfloat)(2. * y - 1.);
+    instance->ndcRect[2] = (GLfloat)(2. * w);
+    instance->ndcRect[3] = (GLfloat)(2. * h);
+    instance->atlasRect[0] = glyph->uv.x;
+    instance->atlasRect[1] = glyph->uv.y;
+    instance->atlasRect[2] = glyph->uv.w;
+    instance->atlasRect[3] = glyph->uv.h;
+    SDL_memcpy(instance->color, textColor, sizeof textColor);
 
-    drawQuad();
     cursor->x += glyph->advance * cursor->size;
 }
 
@@ -179,7 +452,7 @@ void drawChar(Cursor *cursor, char32_t code) {
     float space = 1.f;
     switch (code) {
         case '\n':
-            cursor->y -= 1.22f * cursor->size;  // TODO: depend on font
+            cursor->y -= activeFont->lineHeight * cursor->size;
         case '\r':
             cursor->x = cursor->left;
             break;
@@ -187,14 +460,14 @@ void drawChar(Cursor *cursor, char32_t code) {
         case '\t':
             space = 4.f;  // tab = 4 spaces, would be nicer to do tabstops though
         case ' ':
-            glyph = findGlyph(' ', activeFont->numGlyphs, activeFont->glyphs);
+            glyph = findGlyph(activeFont, ' ');
             if (glyph == NULL) space *= 0.5f * cursor->size;
             else space *= glyph->advance * cursor->size;
             cursor->x += space;
             break;
 
         default:
-            glyph = findGlyph(code, activeFont->numGlyphs, activeFont->glyphs);
+            glyph = findGlyph(activeFont, code);
             drawGlyph(cursor, glyph);  // drawGlyph handles NULL
     }
 }
@@ -211,7 +484,7 @@ void drawString(Cursor *cursor, const char *str) {
 // TODO: This is a bit silly, maybe would be better to have a function
 //  to create a fixed-num variant of the font itself?
 void drawStringFixedNum(Cursor *cursor, const char *str) {
-    Glyph *zero = findGlyph('0', activeFont->numGlyphs, activeFont->glyphs);
+    Glyph *zero = findGlyph(activeFont, '0');
     if (!zero) {
         drawString(cursor, str);
         return;
@@ -220,7 +493,7 @@ void drawStringFixedNum(Cursor *cursor, const char *str) {
     for (int i = 0; str[i]; i++) {
         char code = str[i];
         if (isdigit(code)) {
-            Glyph *digit = findGlyph(code, activeFont->numGlyphs, activeFont->glyphs);
+            Glyph *digit = findGlyph(activeFont, code);
             if (digit) {
                 float pad = (zero->bbox.w - digit->bbox.w) / 2.f;
                 Glyph fixed = {
@@ -257,7 +530,7 @@ float emWidth(Font *font, const char *str) {
             mul = 4.f;
         }
 
-        Glyph *glyph = findGlyph(code, font->numGlyphs, font->glyphs);
+        Glyph *glyph = findGlyph(font, code);
         if (!glyph) glyph = &font->missing;
         width += mul * glyph->advance;
     }
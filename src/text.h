@@ -1,6 +1,7 @@
 #ifndef PICOPUTT_TEXT_H
 #define PICOPUTT_TEXT_H
 #include <stddef.h>
+#include <stdint.h>
 #include <uchar.h>
 #include <GL/glew.h>
 #include <SDL.h>
@@ -18,29 +19,59 @@ typedef struct {
     size_t numGlyphs;
     Glyph *glyphs;
     Glyph missing;
+    // Open addressing hash table of code point -> (index in glyphs) + 1,
+    // with 0 for empty slots.  Built by loadFont for findGlyph.
+    uint32_t *lookup;
+    size_t lookupMask;
     GLuint atlas;
     // TODO: pxrange wouldn't be meaningful for non-SDF fonts.
     //  If I want to support non-SDF fonts I may want to rethink this
-    //  structure.  Likewise for ProgDrawGlyph I justified NOT including
-    //  u_color to myself based on the idea that some "fonts" could be
-    //  spritesheets with predetermined color, but including u_pxrange
-    //  ruins that justification.  The real reason is that u_pxrange is
-    //  set by useFont, but u_color (and other style uniforms) are
-    //  intended to be manually managed by the caller.
+    //  structure.
     float pxrange;
+    float lineHeight;  // In em units
 } Font;
 
 
+// Glyphs are drawn as instanced quads, with everything that varies
+// per glyph (including color) in per-instance attributes.
+#define ATTR_IDX_GLYPH_NDC 2    // vec4: NDC position (xy) and size (zw)
+#define VAR_BIND_GLYPH_NDC {"a_ndcRect", ATTR_IDX_GLYPH_NDC}
+#define ATTR_IDX_GLYPH_ATLAS 3  // vec4: atlas position (xy) and size (zw)
+#define VAR_BIND_GLYPH_ATLAS {"a_atlasRect", ATTR_IDX_GLYPH_ATLAS}
+#define ATTR_IDX_GLYPH_COLOR 4  // vec4: RGBA
+#define VAR_BIND_GLYPH_COLOR {"a_color", ATTR_IDX_GLYPH_COLOR}
+
 typedef struct {
     Program prog;
     GLint u_atlas;
-    GLint u_ndcPos;
-    GLint u_ndcSize;
-    GLint u_atlasPos;
-    GLint u_atlasSize;
     GLint u_pxrange;
 } ProgDrawGlyph;
 
+// Matches the per-instance attributes of shaders/text/glyph.vert
+typedef struct {
+    GLfloat ndcRect[4];
+    GLfloat atlasRect[4];
+    GLfloat color[4];
+} GlyphInstance;
+
+typedef struct {
+    size_t size;
+    size_t capacity;
+    GlyphInstance *instances;
+} GlyphBuffer;
+
+// A laid out piece of text which is kept between frames, so that text
+// which rarely changes doesn't need to be formatted and laid out every
+// frame.  key holds everything the layout depends on (the displayed
+// values, screen size, etc), and the block is only laid out again when
+// it changes.  Unused entries of key should be 0.
+#define TEXT_BLOCK_KEY_SIZE 10
+typedef struct {
+    int valid;
+    int key[TEXT_BLOCK_KEY_SIZE];
+    GlyphBuffer glyphs;
+} TextBlock;
+
 
 typedef struct {
     float left;
@@ -56,11 +87,36 @@ typedef struct {
 
 int loadFont(Font *result, const char *basePath, const char *fontPath, char32_t missing, float pxrange);
 void destroyFont(Font *font);
+
+// The draw* functions don't draw immediately, they append glyphs to a
+// batch which is drawn in a single call by flushGlyphs.  Since the
+// glyph positions are relative to the viewport, the batch must be
+// flushed before the viewport changes (and before drawing anything
+// which should go on top of the text).  useFont flushes automatically
+// if the font or renderer changes.
+void initGlyphBatch();
+void destroyGlyphBatch();
+void flushGlyphs();
+void setTextColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a);
+void setTextColorv(const GLfloat color[4]);
+
+// If block's key has changed, returns 1 and records the draw* calls
+// into block (rather than the batch) until endTextBlock.  Otherwise
+// returns 0, and the cached glyphs can be reused.  Either way,
+// drawTextBlock adds the glyphs to the batch, and should be called with
+// the same font, renderer and viewport that the block was laid out for.
+// Usage:
+// if (beginTextBlock(&block, key)) { draw stuff; endTextBlock(); }
+// drawTextBlock(&block);
+int beginTextBlock(TextBlock *block, const int key[TEXT_BLOCK_KEY_SIZE]);
+void endTextBlock();
+void drawTextBlock(TextBlock *block);
+void destroyTextBlock(TextBlock *block);
 void drawGlyph(Cursor *cursor, Glyph *glyph);
 void drawChar(Cursor *cursor, char32_t code);
 void drawString(Cursor *cursor, const char *str);
 void useFont(Font *font, ProgDrawGlyph *renderer, GLint atlasTexUnit);
-Glyph *findGlyph(char32_t code, size_t numGlyphs, Glyph *glyphs);
+Glyph *findGlyph(Font *font, char32_t code);
 float emWidth(Font *font, const char *str);
 void drawStringFixedNum(Cursor *cursor, const char *str);
 
@@ -0,0 +1,250 @@
+#include "trace.h"
+#include <GL/glew.h>
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Once this many events have been recorded, further events are dropped
+// (about 32 MiB of events, or many minutes of frames)
+#define MAX_TRACE_EVENTS (1 << 20)
+#define MAX_TRACE_DEPTH 32
+// Number of GPU scopes which can be waiting on their query results.
+// If the GPU falls further behind than this, GPU scopes are dropped.
+#define GPU_SCOPE_POOL 1024
+
+typedef struct {
+    const char *name;
+    double start;     // Microseconds since initTracing
+    double duration;  // Microseconds
+    int onGpu;
+} TraceEvent;
+
+typedef struct {
+    const char *name;
+    GLuint queries[2];  // Begin and end timestamps
+    double gpuOffset;   // gpuOffset at the time the scope began
+    int ended;
+} GpuScope;
+
+int g_tracing = 0;
+static char *tracePath = NULL;
+static Uint64 startCounter;
+static double usPerCount;
+
+static TraceEvent *events = NULL;
+static size_t numEvents = 0;
+static size_t maxEvents = 0;
+static size_t droppedEvents = 0;
+
+static const char *cpuNames[MAX_TRACE_DEPTH];
+static Uint64 cpuStarts[MAX_TRACE_DEPTH];
+static int cpuDepth = 0;
+
+static int gpuTracing = 0;
+// Microseconds to add to a GPU timestamp to put it on the CPU timeline
+static double gpuOffset;
+static double lastGpuSync;
+// gpuScopes is a ring buffer with in-flight scopes from gpuHead to gpuTail
+static GpuScope gpuScopes[GPU_SCOPE_POOL];
+static size_t gpuHead = 0;
+static size_t gpuTail = 0;
+static size_t gpuStack[MAX_TRACE_DEPTH];
+static int gpuDepth = 0;
+
+
+static double nowUs() {
+    return (double)(SDL_GetPerformanceCounter() - startCounter) * usPerCount;
+}
+
+static void addEvent(const char *name, double start, double duration, int onGpu) {
+    if (numEvents == maxEvents) {
+        size_t newMax = maxEvents? 2 * maxEvents : 4096;
+        TraceEvent *newEvents;
+        if (newMax > MAX_TRACE_EVENTS ||
+            (newEvents = realloc(events, newMax * sizeof(TraceEvent))) == NULL) {
+            droppedEvents++;
+            return;
+        }
+
+        events = newEvents;
+        maxEvents = newMax;
+    }
+
+    events[numEvents++] = (TraceEvent) {
+        .name = name, .start = start, .duration = duration, .onGpu = onGpu
+    };
+}
+
+
+// Can be called before SDL_Init, so that SDL_Init itself can be traced.
+void initTracing() {
+    char *path = getenv("PICOPUTT_TRACE");
+    if (path == NULL || path[0] == '\0') return;
+    if ((tracePath = SDL_strdup(path)) == NULL) return;
+
+    startCounter = SDL_GetPerformanceCounter();
+    usPerCount = 1e6 / (double)SDL_GetPerformanceFrequency();
+    g_tracing = 1;
+    SDL_Log("Tracing to %s set by $PICOPUTT_TRACE", tracePath);
+}
+
+
+static void syncGpuClock() {
+    GLint64 gpuNs;
+    glGetInteger64v(GL_TIMESTAMP, &gpuNs);
+    lastGpuSync = nowUs();
+    gpuOffset = lastGpuSync - 1e-3 * (double)gpuNs;
+}
+
+// Requires a GL context, GPU scopes are ignored until this is called.
+void initGpuTracing() {
+    if (!g_tracing) return;
+    for (size_t i = 0; i < GPU_SCOPE_POOL; i++) {
+        glGenQueries(2, gpuScopes[i].queries);
+    }
+
+    syncGpuClock();
+    gpuTracing = 1;
+}
+
+
+void traceBegin(const char *name) {
+    if (cpuDepth < MAX_TRACE_DEPTH) {
+        cpuNames[cpuDepth] = name;
+        cpuStarts[cpuDepth] = SDL_GetPerformanceCounter();
+    }
+
+    cpuDepth++;
+}
+
+void traceEnd() {
+    if (cpuDepth == 0) return;
+    if (--cpuDepth >= MAX_TRACE_DEPTH) {
+        droppedEvents++;
+        return;
+    }
+
+    double start = (double)(cpuStarts[cpuDepth] - startCounter) * usPerCount;
+    addEvent(cpuNames[cpuDepth], start, nowUs() - start, 0);
+}
+
+
+void traceGpuBegin(const char *name) {
+    if (!gpuTracing) return;
+    if (gpuTail - gpuHead == GPU_SCOPE_POOL || gpuDepth >= MAX_TRACE_DEPTH) {
+        // Mark the scope as dropped so that traceGpuEnd stays balanced
+        if (gpuDepth < MAX_TRACE_DEPTH) gpuStack[gpuDepth] = (size_t) -1;
+        gpuDepth++;
+        droppedEvents++;
+        return;
+    }
+
+    GpuScope *scope = &gpuScopes[gpuTail % GPU_SCOPE_POOL];
+    scope->name = name;
+    scope->gpuOffset = gpuOffset;
+    scope->ended = 0;
+    glQueryCounter(scope->queries[0], GL_TIMESTAMP);
+    gpuStack[gpuDepth++] = gpuTail++;
+}
+
+void traceGpuEnd() {
+    if (!gpuTracing || gpuDepth == 0) return;
+    if (--gpuDepth >= MAX_TRACE_DEPTH || gpuStack[gpuDepth] == (size_t) -1) return;
+
+    GpuScope *scope = &gpuScopes[gpuStack[gpuDepth] % GPU_SCOPE_POOL];
+    glQueryCounter(scope->queries[1], GL_TIMESTAMP);
+    scope->ended = 1;
+}
+
+
+// Record GPU scopes whose results are available.  Scopes are collected
+// in the order they began, so an open outer scope holds back the scopes
+// nested inside it, which is fine since it's called between frames.
+static void collectGpuScopes(int wait) {
+    while (gpuHead != gpuTail) {
+        GpuScope *scope = &gpuScopes[gpuHead % GPU_SCOPE_POOL];
+        if (!scope->ended) break;
+        if (!wait) {
+            GLint available;
+            glGetQueryObjectiv(scope->queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) break;
+        }
+
+        GLuint64 begin, end;
+        glGetQueryObjectui64v(scope->queries[0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(scope->queries[1], GL_QUERY_RESULT, &end);
+        addEvent(
+            scope->name, 1e-3 * (double)begin + scope->gpuOffset,
+            1e-3 * (double)(end - begin), 1
+        );
+        gpuHead++;
+    }
+}
+
+// Called once per frame to collect GPU results without stalling.
+void traceFrame() {
+    if (!gpuTracing) return;
+    collectGpuScopes(0);
+
+    // The GPU and CPU clocks may drift apart, so we resynchronize them
+    // every so often.
+    if (nowUs() - lastGpuSync > 1e6) syncGpuClock();
+}
+
+
+static void writeJsonString(FILE *file, const char *str) {
+    fputc('"', file);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') fputc('\\', file);
+        if ((unsigned char)*str >= 0x20) fputc(*str, file);
+    }
+    fputc('"', file);
+}
+
+// Writes the trace file.  If GPU tracing was initialized, this must be
+// called while the GL context still exists, and will wait for any
+// remaining GPU scopes to finish.
+void finishTracing() {
+    if (!g_tracing) return;
+    g_tracing = 0;
+
+    if (gpuTracing) {
+        collectGpuScopes(1);
+        for (size_t i = 0; i < GPU_SCOPE_POOL; i++) {
+            glDeleteQueries(2, gpuScopes[i].queries);
+        }
+        gpuTracing = 0;
+    }
+
+    FILE *file = fopen(tracePath, "w");
+    if (file == NULL) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to write trace file %s", tracePath);
+    } else {
+        fprintf(
+            file,
+            "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+            "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"CPU\"}},\n"
+            "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \"GPU\"}}"
+        );
+
+        for (size_t i = 0; i < numEvents; i++) {
+            fprintf(file, ",\n{\"name\": ");
+            writeJsonString(file, events[i].name);
+            fprintf(
+                file, ", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                events[i].onGpu? 2 : 1, events[i].start, events[i].duration
+            );
+        }
+
+        fprintf(file, "\n]}\n");
+        fclose(file);
+        SDL_Log("Wrote %lu trace events to %s", (unsigned long)numEvents, tracePath);
+    }
+
+    if (droppedEvents) SDL_Log("Dropped %lu trace events", (unsigned long)droppedEvents);
+    free(events);
+    events = NULL;
+    numEvents = maxEvents = droppedEvents = 0;
+    SDL_free(tracePath);
+    tracePath = NULL;
+}
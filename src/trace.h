@@ -0,0 +1,39 @@
+#ifndef PICOPUTT_TRACE_H
+#define PICOPUTT_TRACE_H
+#include <GL/glew.h>
+#include <SDL.h>
+
+// A tiny tracing system which records CPU and GPU scopes and writes them
+// out as a Chrome trace (JSON trace event format), which can be viewed
+// with https://ui.perfetto.dev or chrome://tracing.
+//
+// Tracing is enabled by setting $PICOPUTT_TRACE to the path of the trace
+// file to write.  When it is disabled, the TRACE_* macros cost a single
+// branch on g_tracing.
+//
+// Scope names must be string literals (or otherwise outlive the trace),
+// as only the pointer is recorded.
+//
+// GPU scopes are timed with GL_TIMESTAMP queries, which are collected
+// (without stalling) in traceFrame.  They appear on a separate "GPU"
+// track, aligned with the CPU timeline using glGetInteger64v(GL_TIMESTAMP).
+
+extern int g_tracing;
+
+void initTracing();
+void initGpuTracing();
+void traceBegin(const char *name);
+void traceEnd();
+void traceGpuBegin(const char *name);
+void traceGpuEnd();
+void traceFrame();
+void finishTracing();
+
+#define TRACE_BEGIN(name) ((void) (g_tracing && (traceBegin(name), 1)))
+#define TRACE_END() ((void) (g_tracing && (traceEnd(), 1)))
+
+// Traces both the CPU time spent issuing commands and the GPU time spent
+// executing them.
+#define TRACE_GPU_BEGIN(name) ((void) (g_tracing && (traceBegin(name), traceGpuBegin(name), 1)))
+#define TRACE_GPU_END() ((void) (g_tracing && (traceGpuEnd(), traceEnd(), 1)))
+#endif //PICOPUTT_TRACE_H
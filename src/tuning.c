@@ -0,0 +1,684 @@
+#include "tuning.h"
+#include <GL/glew.h>
+#include <SDL.h>
+#include <math.h>
+#include <stdlib.h>
+#include "game.h"
+#include "loop.h"
+#include "utils.h"
+
+#define MAX_TUNINGS 64
+
+static int loadedTunings = 0;
+static int numTunings = 0;
+static char *tuningKeys[MAX_TUNINGS];
+static char *tuningValues[MAX_TUNINGS];
+static char *tuningPath = NULL;
+
+
+static int loadTunings() {
+    if (loadedTunings) return 0;
+    loadedTunings = 1;
+
+    char *prefPath = SDL_GetPrefPath(NULL, "picoputt");
+    if (prefPath == NULL) return 1;
+    int err = SET_ERR_IF_TRUE(SDL_asprintf(&tuningPath, "%stuning.txt", prefPath) == -1);
+    SDL_free(prefPath);
+    if (err) {
+        tuningPath = NULL;
+        return 1;
+    }
+
+    // A missing file just means nothing has been tuned yet
+    char *contents = SDL_LoadFile(tuningPath, NULL);
+    if (contents == NULL) return 0;
+
+    char *line = contents;
+    while (*line && numTunings < MAX_TUNINGS) {
+        char *end = SDL_strchr(line, '\n');
+        if (end != NULL) *end = '\0';
+        if (end != NULL && end > line && end[-1] == '\r') end[-1] = '\0';
+
+        // Keys may contain '=' (GL_RENDERER could be anything), values can't
+        char *sep = SDL_strrchr(line, '=');
+        if (sep != NULL) {
+            *sep = '\0';
+            tuningKeys[numTunings] = SDL_strdup(line);
+            tuningValues[numTunings] = SDL_strdup(sep + 1);
+            if (tuningKeys[numTunings] && tuningValues[numTunings]) numTunings++;
+            else {
+                SDL_free(tuningKeys[numTunings]);
+                SDL_free(tuningValues[numTunings]);
+            }
+        }
+
+        if (end == NULL) break;
+        line = end + 1;
+    }
+
+    SDL_free(contents);
+    return 0;
+}
+
+
+static int findTuning(const char *key) {
+    for (int i = 0; i < numTunings; i++) {
+        if (SDL_strcmp(tuningKeys[i], key) == 0) return i;
+    }
+
+    return -1;
+}
+
+
+// Returns NULL if the key has not been tuned (or $PICOPUTT_RETUNE is set)
+const char *getTuning(const char *key) {
+    if (getenv("PICOPUTT_RETUNE") != NULL) return NULL;
+    loadTunings();
+    int i = findTuning(key);
+    return i == -1? NULL : tuningValues[i];
+}
+
+
+// Sets the key and writes all the tunings back to the file.
+// Returns non-zero (and sets SDL error) if that failed.
+int setTuning(const char *key, const char *value) {
+    loadTunings();
+    int i = findTuning(key);
+    if (i == -1) {
+        if (SET_ERR_IF_TRUE(numTunings == MAX_TUNINGS)) return 1;
+        char *newKey = SDL_strdup(key);
+        if (SET_ERR_IF_TRUE(newKey == NULL)) return 1;
+        i = numTunings++;
+        tuningKeys[i] = newKey;
+        tuningValues[i] = NULL;
+    }
+
+    char *newValue = SDL_strdup(value);
+    if (SET_ERR_IF_TRUE(newValue == NULL)) return 1;
+    SDL_free(tuningValues[i]);
+    tuningValues[i] = newValue;
+
+    if (SET_ERR_IF_TRUE(tuningPath == NULL)) return 1;
+    SDL_RWops *file = SDL_RWFromFile(tuningPath, "w");
+    if (file == NULL) return 1;
+    int err = 0;
+    for (int j = 0; j < numTunings && !err; j++) {
+        char *line;
+        if (SET_ERR_IF_TRUE(SDL_asprintf(&line, "%s=%s\n", tuningKeys[j], tuningValues[j]) == -1)) {
+            err = 1;
+            break;
+        }
+
+        size_t len = SDL_strlen(line);
+        err = SDL_RWwrite(file, line, 1, len) != len;
+        SDL_free(line);
+    }
+
+    if (SDL_RWclose(file) != 0) err = 1;
+    return err;
+}
+
+
+void freeTuning() {
+    for (int i = 0; i < numTunings; i++) {
+        SDL_free(tuningKeys[i]);
+        SDL_free(tuningValues[i]);
+    }
+
+    numTunings = 0;
+    SDL_free(tuningPath);
+    tuningPath = NULL;
+    loadedTunings = 0;
+}
+
+
+// The qturn autotuner times each available variant of qturn.frag on the
+// actual grid, and picks the fastest one whose results match the
+// reference variant (QTURN_TERNARY).
+// This is just a representative value, it only needs to be in the
+// stable range to give meaningful results.
+#define TUNE_DT 0.2f
+// Amplitude of the noise the variants are compared on
+#define TUNE_NOISE_AMPLITUDE 1.f
+// Number of qturns to compare against the reference variant
+#define CHECK_QTURNS 16
+// Number of qturns per timing, and how many timings to take the best of
+#define TIMED_QTURNS 64
+#define TIMED_REPEATS 3
+
+static void bindQTurnInputs(QTurnVariant variant) {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, g_simBuffers[0].texture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, g_simBuffers[1].texture);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, g_potentialBuffer.texture);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, g_dragPot.texture);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, g_wallBuffer.texture);
+    glBindImageTexture(0, g_simBuffers[0].texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
+    glBindImageTexture(1, g_simBuffers[1].texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
+
+    GLuint sampler = variant == QTURN_BORDER? g_borderSampler : 0;
+    glBindSampler(0, sampler);
+    glBindSampler(1, sampler);
+}
+
+static void clearDragPot() {
+    glBindFramebuffer(GL_FRAMEBUFFER, g_dragPot.fbo);
+    glViewport(0, 0, g_dragPot.width, g_dragPot.height);
+    glClearColor(0.f, 0.f, 0.f, 1.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+// Resets the simulation to an arbitrary (but always the same) state.
+// This is noise with the same amplitude everywhere, rather than
+// something smooth like a wavepacket, so that the edges and corners
+// (where the variants differ) matter as much as anywhere else.
+static void resetTuningState(QTurnVariant variant) {
+    GLsizei width = g_simBuffers[0].width;
+    GLsizei height = g_simBuffers[0].height;
+    size_t numFloats = 2 * (size_t)width * (size_t)height;
+    float *noise = SDL_malloc(numFloats * sizeof(float));
+    if (noise != NULL) {
+        Uint32 state = 0x9e3779b9u;
+        for (size_t i = 0; i < numFloats; i++) {
+            // xorshift32
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            noise[i] = TUNE_NOISE_AMPLITUDE * (2.f * (float)(state >> 8) / (float)(1u << 24) - 1.f);
+        }
+
+        glBindTexture(GL_TEXTURE_2D, g_simBuffers[0].texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RG, GL_FLOAT, noise);
+        SDL_free(noise);
+    } else {
+        setGaussianWavepacket(&g_simBuffers[0], 0.3f * (float)width, 0.5f * (float)height, 0.1f * (float)height, 1.f);
+    }
+    clearDragPot();
+
+    ProgQTurn *qturn = &g_qturnVariants[variant];
+    glUseProgram(qturn->prog.id);
+    glUniform1f(qturn->u_dt, TUNE_DT);
+    glUniform1i(qturn->u_potential, 2);
+    glUniform1i(qturn->u_dragPot, 3);
+    glUniform1i(qturn->u_wall, 4);
+    bindQTurnInputs(variant);
+}
+
+// Returns the index of the sim buffer with the result
+static int runQTurns(QTurnVariant variant, int numQTurns) {
+    ProgQTurn *qturn = &g_qturnVariants[variant];
+    glUseProgram(qturn->prog.id);
+    glViewport(0, 0, g_simBuffers[0].width, g_simBuffers[0].height);
+    int cur = 0;
+    for (int i = 0; i < numQTurns; i++) {
+        glUniform1i(qturn->u_prev, cur);
+        cur = 1 - cur;
+        glBindFramebuffer(GL_FRAMEBUFFER, g_simBuffers[cur].fbo);
+        drawQuad();
+    }
+
+    return cur;
+}
+
+static void readSimBuffer(int buf, float *out) {
+    glBindFramebuffer(GL_FRAMEBUFFER, g_simBuffers[buf].fbo);
+    glReadPixels(0, 0, g_simBuffers[buf].width, g_simBuffers[buf].height, GL_RG, GL_FLOAT, out);
+}
+
+// Best of TIMED_REPEATS timings of the variant, in ns per qturn
+static double timeQTurns(QTurnVariant variant, GLuint query) {
+    resetTuningState(variant);
+    runQTurns(variant, CHECK_QTURNS);  // Warm up
+    double ns = INFINITY;
+    for (int i = 0; i < TIMED_REPEATS; i++) {
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        runQTurns(variant, TIMED_QTURNS);
+        glEndQuery(GL_TIME_ELAPSED);
+        GLuint64 elapsed;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+        ns = SDL_min(ns, (double)elapsed / TIMED_QTURNS);
+    }
+
+    return ns;
+}
+
+static QTurnVariant measureQTurnVariants() {
+    size_t numFloats = 2 * (size_t)g_simBuffers[0].width * (size_t)g_simBuffers[0].height;
+    float *reference = SDL_malloc(numFloats * sizeof(float));
+    float *result = SDL_malloc(numFloats * sizeof(float));
+    if (reference == NULL || result == NULL) {
+        SDL_free(reference);
+        SDL_free(result);
+        return QTURN_TERNARY;
+    }
+
+    resetTuningState(QTURN_TERNARY);
+    readSimBuffer(runQTurns(QTURN_TERNARY, CHECK_QTURNS), reference);
+
+    GLuint query;
+    glGenQueries(1, &query);
+    QTurnVariant best = QTURN_TERNARY;
+    double bestNs = INFINITY;
+    for (int v = 0; v < NUM_QTURN_VARIANTS; v++) {
+        if (g_qturnVariants[v].prog.id == 0) continue;
+        if (v != QTURN_TERNARY) {
+            resetTuningState(v);
+            readSimBuffer(runQTurns(v, CHECK_QTURNS), result);
+            // Each texel is checked on its own, relative to its reference
+            // value.  QTURN_BORDER does the arithmetic in a different
+            // order, so it won't match exactly, but variants which read
+            // anything but 0 outside the grid are off by about the noise
+            // amplitude at the edges.
+            size_t bad = numFloats;
+            float badDiff = 0.f;
+            for (size_t i = 0; i < numFloats && bad == numFloats; i++) {
+                float diff = fabsf(result[i] - reference[i]);
+                float tolerance = 1e-4f * (fabsf(reference[i]) + TUNE_NOISE_AMPLITUDE);
+                // Written so that NaN counts as a mismatch
+                if (!(diff <= tolerance)) {
+                    bad = i;
+                    badDiff = diff;
+                }
+            }
+
+            if (bad != numFloats) {
+                size_t texel = bad / 2;
+                SDL_Log(
+                    "qturn variant %s: incorrect (error %g at texel %d, %d)", g_qturnVariantNames[v], badDiff,
+                    (int)(texel % (size_t)g_simBuffers[0].width), (int)(texel / (size_t)g_simBuffers[0].width)
+                );
+                continue;
+            }
+        }
+
+        double ns = timeQTurns(v, query);
+        SDL_Log("qturn variant %s: %.1f us/qturn", g_qturnVariantNames[v], 1e-3 * ns);
+        if (ns < bestNs) {
+            bestNs = ns;
+            best = v;
+        }
+    }
+
+    glDeleteQueries(1, &query);
+    glBindSampler(0, 0);
+    glBindSampler(1, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    SDL_free(reference);
+    SDL_free(result);
+    return best;
+}
+
+
+void selectQTurnVariant(QTurnVariant variant) {
+    g_qturnVariant = variant;
+    g_qturn = g_qturnVariants[variant];
+}
+
+
+// Chooses the qturn variant to use, either from the cache or by timing
+// all of them.  Expects resources to be loaded, and the programs to be
+// built with constants.  Leaves the simulation buffers in an arbitrary
+// state.
+int tuneQTurn(ShaderConstants constants) {
+    char *key;
+    if (SET_ERR_IF_TRUE(SDL_asprintf(
+        &key, "qturn %s %dx%d order %d", (const char *)glGetString(GL_RENDERER),
+        g_simBuffers[0].width, g_simBuffers[0].height, constants.stencilOrder
+    ) == -1)) return 1;
+
+    QTurnVariant variant = NUM_QTURN_VARIANTS;
+    const char *cached = getTuning(key);
+    for (int v = 0; cached != NULL && v < NUM_QTURN_VARIANTS; v++) {
+        if (SDL_strcmp(cached, g_qturnVariantNames[v]) == 0 && g_qturnVariants[v].prog.id != 0) {
+            variant = v;
+        }
+    }
+
+    if (variant == NUM_QTURN_VARIANTS) {
+        variant = measureQTurnVariants();
+        if (setTuning(key, g_qturnVariantNames[variant])) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Failed to save tuning: %s", SDL_GetError());
+        }
+    }
+
+    SDL_free(key);
+    SDL_Log("Using qturn variant %s", g_qturnVariantNames[variant]);
+    selectQTurnVariant(variant);
+    return 0;
+}
+
+
+// The stencil benchmark ($PICOPUTT_STENCIL_BENCHMARK) weighs the accuracy
+// of each stencil order (see common/qturn.glsl) against its cost.  The
+// cost per texel is measured, and the accuracy is the phase velocity
+// error of a free plane wave, from the exact dispersion relation of the
+// scheme: the stencil's kinetic energy K(k) for wave vector k, and
+// Visscher's time stepping, which turns it into a frequency of
+// 2/dt*asin(K*dt/2) rather than K.  That only depends on k*dx and
+// dt/(m*dx^2), so for a given error, each stencil resolves waves up to
+// some k*dx, and resolving the same momentum with a coarser grid needs
+// (k*dx)^-2 times the texels and, keeping dt/(m*dx^2) fixed, (k*dx)^-2
+// times the turns.
+static const double benchErrors[] = {1e-3, 3e-3, 1e-2, 3e-2, 1e-1};
+#define NUM_BENCH_ERRORS (sizeof benchErrors / sizeof benchErrors[0])
+// Step in k*dx of the search for the largest resolved k*dx
+#define BENCH_THETA_STEP 1e-3
+
+// The kinetic energy of the 9-point stencil for a plane wave advancing
+// the phase by tx and ty per texel, in units of 1/(m*dx^2)
+static double kinetic9(double tx, double ty) {
+    return 0.5 * (3. - cos(tx) - cos(ty) - cos(tx) * cos(ty));
+}
+
+// Relative phase velocity error of a plane wave advancing the phase by
+// theta per texel diagonally, which is the worst direction for both
+// stencils.  dtScaled is dt/(m*dx^2).  Infinite if it's unstable.
+static double phaseError(int order, double theta, double dtScaled) {
+    double t = theta / sqrt(2.);
+    double K = kinetic9(t, t);
+    if (order == 4) K = (4. * K - kinetic9(2. * t, 2. * t) / 4.) / 3.;
+    double x = 0.5 * K * dtScaled;
+    if (x > 1.) return INFINITY;
+    double omega = 2. / dtScaled * asin(x);
+    return omega / (0.5 * theta * theta) - 1.;
+}
+
+// The largest k*dx with a phase velocity error within maxError (or 0 if
+// even the longest waves aren't)
+static double resolvedTheta(int order, double maxError, double dtScaled) {
+    double theta = 0.;
+    while (theta + BENCH_THETA_STEP < M_PI) {
+        if (!(fabs(phaseError(order, theta + BENCH_THETA_STEP, dtScaled)) <= maxError)) break;
+        theta += BENCH_THETA_STEP;
+    }
+
+    return theta;
+}
+
+int benchmarkStencils(ShaderConstants constants) {
+    const char *env = getenv("PICOPUTT_STENCIL_BENCHMARK");
+    if (env == NULL || env[0] == '\0') return 0;
+
+    GLuint query;
+    glGenQueries(1, &query);
+    double ns[2];
+    int err = 0;
+    for (int i = 0; i < 2 && !err; i++) {
+        ShaderConstants c = constants;
+        c.stencilOrder = 2 + 2 * i;
+        if (!(err = setShaderConstants(c))) ns[i] = timeQTurns(g_qturnVariant, query);
+    }
+
+    glDeleteQueries(1, &query);
+    glBindSampler(0, 0);
+    glBindSampler(1, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (setShaderConstants(constants) || err) return 1;
+
+    double texels = (double)g_simBuffers[0].width * (double)g_simBuffers[0].height;
+    double dtScaled = g_dt / (g_mass * g_dx * g_dx);
+    SDL_Log("Stencil benchmark (qturn variant %s, dt/(m*dx^2)=%g):", g_qturnVariantNames[g_qturnVariant], dtScaled);
+    for (int i = 0; i < 2; i++) {
+        SDL_Log("  order %d: %.1f us/qturn, %.3f ns/texel", 2 + 2 * i, 1e-3 * ns[i], ns[i] / texels);
+    }
+
+    for (size_t i = 0; i < NUM_BENCH_ERRORS; i++) {
+        double theta2 = resolvedTheta(2, benchErrors[i], dtScaled);
+        double theta4 = resolvedTheta(4, benchErrors[i], dtScaled);
+        if (theta2 == 0. || theta4 == 0.) {
+            SDL_Log("  %g%% error: not reached at this dt", 100. * benchErrors[i]);
+            continue;
+        }
+
+        double texelRatio = (theta2 / theta4) * (theta2 / theta4);
+        SDL_Log(
+            "  %g%% error: k*dx up to %.3f (order 2), %.3f (order 4), so order 4 needs %.3gx the texels and %.3gx the GPU time",
+            100. * benchErrors[i], theta2, theta4, texelRatio, texelRatio * texelRatio * ns[1] / ns[0]
+        );
+    }
+
+    return 0;
+}
+
+
+// The LIP tuner times the whole drag update for every combination of
+// these, and picks the fastest one whose drag potential matches the
+// configuration the programs were loaded with.
+static const int lipTiles[] = {8, 16, 32};
+static const int lipGroups[][2] = {{8, 8}, {16, 16}, {32, 8}};
+#define NUM_LIP_TILES (sizeof lipTiles / sizeof lipTiles[0])
+#define NUM_LIP_GROUPS (sizeof lipGroups / sizeof lipGroups[0])
+#define NUM_LIP_CANDIDATES (NUM_LIP_TILES * NUM_LIP_GROUPS)
+#define NUM_LIP_PROGRAMS 4
+// Number of drag updates per timing
+#define TIMED_LIP_PASSES 8
+
+typedef struct {
+    LIPConfig config;
+    char defines[128];
+    ProgInitLIP init;
+    ProgBuildLIP build;
+    ProgIntegrateLIP integrate[2];
+    ProgramBuild builds[NUM_LIP_PROGRAMS];
+    int ok;
+} LIPCandidate;
+
+static int lipTuned = 0;  // Set if g_lipConfig was loaded from the cache
+
+static char *getLIPKey(int simWidth, int simHeight) {
+    char *key;
+    if (SET_ERR_IF_TRUE(SDL_asprintf(
+        &key, "lip %s %dx%d", (const char *)glGetString(GL_RENDERER), simWidth, simHeight
+    ) == -1)) return NULL;
+    return key;
+}
+
+
+// Sets g_lipConfig from the cache, must be called before the LIP
+// programs are loaded.  If there's nothing cached, the defaults are
+// kept and tuneLIP will find the best configuration later.
+void loadLIPConfig(int simWidth, int simHeight) {
+    char *key = getLIPKey(simWidth, simHeight);
+    if (key == NULL) return;
+
+    LIPConfig config;
+    const char *cached = getTuning(key);
+    if (cached != NULL && SDL_sscanf(
+        cached, "%d %d %d", &config.tile, &config.groupX, &config.groupY
+    ) == 3 && config.tile > 2 && config.groupX > 0 && config.groupY > 0) {
+        g_lipConfig = config;
+        lipTuned = 1;
+    }
+
+    SDL_free(key);
+}
+
+
+static void useLIPCandidate(LIPCandidate *c) {
+    g_lipConfig = c->config;
+    g_initLIP = c->init;
+    g_buildLIP = c->build;
+    g_integrateLIP[0] = c->integrate[0];
+    g_integrateLIP[1] = c->integrate[1];
+}
+
+static void readDragPot(float *out) {
+    glBindFramebuffer(GL_FRAMEBUFFER, g_dragPot.fbo);
+    glReadPixels(0, 0, g_dragPot.width, g_dragPot.height, GL_RED, GL_FLOAT, out);
+}
+
+static void compileLIPCandidates(LIPCandidate *candidates) {
+    for (size_t i = 0; i < NUM_LIP_CANDIDATES; i++) {
+        LIPCandidate *c = &candidates[i];
+        c->config = (LIPConfig) {
+            .tile = lipTiles[i / NUM_LIP_GROUPS],
+            .groupX = lipGroups[i % NUM_LIP_GROUPS][0],
+            .groupY = lipGroups[i % NUM_LIP_GROUPS][1]
+        };
+        formatLIPDefines(c->defines, sizeof c->defines, c->config);
+        c->init.prog.name = g_initLIP.prog.name;
+        c->build.prog.name = g_buildLIP.prog.name;
+        c->integrate[0].prog.name = g_integrateLIP[0].prog.name;
+        c->integrate[1].prog.name = g_integrateLIP[1].prog.name;
+        Program *progs[NUM_LIP_PROGRAMS] = {
+            &c->init.prog, &c->build.prog, &c->integrate[0].prog, &c->integrate[1].prog
+        };
+
+        c->ok = 1;
+        for (int j = 0; j < NUM_LIP_PROGRAMS; j++) {
+            c->builds[j] = (ProgramBuild) {progs[j], NULL, GL_COMPUTE_SHADER, NULL, c->defines};
+            if (submitProgram(&c->builds[j], g_basePath)) c->ok = 0;
+        }
+    }
+
+    for (size_t i = 0; i < NUM_LIP_CANDIDATES; i++) {
+        waitForPrograms(candidates[i].builds, NUM_LIP_PROGRAMS);
+    }
+
+    // Configurations can legitimately fail to link on devices with
+    // smaller workgroup limits, so those are just skipped.
+    for (size_t i = 0; i < NUM_LIP_CANDIDATES; i++) {
+        LIPCandidate *c = &candidates[i];
+        for (int j = 0; j < NUM_LIP_PROGRAMS; j++) {
+            if (c->builds[j].prog->id == 0) {
+                glDeleteShader(c->builds[j].shader);
+                c->ok = 0;
+            } else if (finishProgram(&c->builds[j])) {
+                c->ok = 0;
+            }
+        }
+
+        if (c->ok) findLIPUniforms(&c->init, &c->build, c->integrate);
+    }
+}
+
+static void deleteLIPCandidate(LIPCandidate *c) {
+    for (int j = 0; j < NUM_LIP_PROGRAMS; j++) {
+        glDeleteProgram(c->builds[j].prog->id);
+        c->builds[j].prog->id = 0;
+    }
+}
+
+
+// Finds the fastest LIPConfig, unless one was loaded from the cache.
+// Like tuneQTurn, leaves the simulation buffers in an arbitrary state.
+int tuneLIP() {
+    if (lipTuned) return 0;
+    char *key = getLIPKey(g_simBuffers[0].width, g_simBuffers[0].height);
+    if (key == NULL) return 1;
+
+    size_t numTexels = (size_t)g_dragPot.width * (size_t)g_dragPot.height;
+    LIPCandidate *candidates = SDL_calloc(NUM_LIP_CANDIDATES, sizeof(LIPCandidate));
+    float *reference = SDL_malloc(numTexels * sizeof(float));
+    float *result = SDL_malloc(numTexels * sizeof(float));
+    if (SET_ERR_IF_TRUE(candidates == NULL || reference == NULL || result == NULL)) {
+        SDL_free(key);
+        SDL_free(candidates);
+        SDL_free(reference);
+        SDL_free(result);
+        return 1;
+    }
+
+    compileLIPCandidates(candidates);
+
+    // Any evolved state with some phase gradients will do
+    resetTuningState(QTURN_TERNARY);
+    int cur = runQTurns(QTURN_TERNARY, CHECK_QTURNS);
+    updateDragPotential(cur);
+    readDragPot(reference);
+    float maxRef = 0.f;
+    for (size_t i = 0; i < numTexels; i++) maxRef = SDL_max(maxRef, fabsf(reference[i]));
+    float tolerance = 1e-5f * maxRef;
+
+    LIPCandidate original = {
+        .config = g_lipConfig, .init = g_initLIP, .build = g_buildLIP,
+        .integrate = {g_integrateLIP[0], g_integrateLIP[1]}
+    };
+
+    GLuint query;
+    glGenQueries(1, &query);
+    LIPCandidate *best = NULL;
+    double bestNs = INFINITY;
+    for (size_t i = 0; i < NUM_LIP_CANDIDATES; i++) {
+        LIPCandidate *c = &candidates[i];
+        if (!c->ok) continue;
+        useLIPCandidate(c);
+
+        clearDragPot();
+        updateDragPotential(cur);
+        readDragPot(result);
+        float maxDiff = 0.f;
+        for (size_t j = 0; j < numTexels; j++) {
+            float diff = fabsf(result[j] - reference[j]);
+            if (!(diff <= maxDiff)) maxDiff = isnan(diff)? INFINITY : diff;
+        }
+
+        if (!(maxDiff <= tolerance)) {
+            SDL_Log(
+                "LIP config %d/%dx%d: incorrect (max error %g)",
+                c->config.tile, c->config.groupX, c->config.groupY, maxDiff
+            );
+            continue;
+        }
+
+        double ns = INFINITY;
+        for (int r = 0; r < TIMED_REPEATS; r++) {
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            for (int p = 0; p < TIMED_LIP_PASSES; p++) updateDragPotential(cur);
+            glEndQuery(GL_TIME_ELAPSED);
+            GLuint64 elapsed;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+            ns = SDL_min(ns, (double)elapsed / TIMED_LIP_PASSES);
+        }
+
+        SDL_Log(
+            "LIP config %d/%dx%d: %.1f us/turn",
+            c->config.tile, c->config.groupX, c->config.groupY, 1e-3 * ns
+        );
+        if (ns < bestNs) {
+            bestNs = ns;
+            best = c;
+        }
+    }
+
+    glDeleteQueries(1, &query);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    for (size_t i = 0; i < NUM_LIP_CANDIDATES; i++) {
+        if (&candidates[i] != best) deleteLIPCandidate(&candidates[i]);
+    }
+
+    if (best == NULL) {
+        // Shouldn't happen, since the original config is a candidate
+        useLIPCandidate(&original);
+    } else {
+        // The programs compiled with the original config are replaced
+        Program *progs[NUM_LIP_PROGRAMS] = {
+            &original.init.prog, &original.build.prog,
+            &original.integrate[0].prog, &original.integrate[1].prog
+        };
+        for (int j = 0; j < NUM_LIP_PROGRAMS; j++) glDeleteProgram(progs[j]->id);
+        useLIPCandidate(best);
+
+        char value[64];
+        SDL_snprintf(value, sizeof value, "%d %d %d", best->config.tile, best->config.groupX, best->config.groupY);
+        if (setTuning(key, value)) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Failed to save tuning: %s", SDL_GetError());
+        }
+    }
+
+    SDL_Log(
+        "Using LIP config %d/%dx%d (tile/integrate workgroup)",
+        g_lipConfig.tile, g_lipConfig.groupX, g_lipConfig.groupY
+    );
+    lipTuned = 1;
+    SDL_free(key);
+    SDL_free(candidates);
+    SDL_free(reference);
+    SDL_free(result);
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef PICOPUTT_TUNING_H
+#define PICOPUTT_TUNING_H
+#include <GL/glew.h>
+#include <SDL.h>
+#include "resources.h"
+
+// Autotuning results are cached in tuning.txt in the SDL pref path as
+// lines of key=value, so they only need to be measured once per device.
+// Keys should identify everything the result depends on (eg the
+// GL_RENDERER and grid size), and values can't contain '=' or newlines.
+// Setting $PICOPUTT_RETUNE ignores the cached results (but still
+// replaces them with the new ones).
+const char *getTuning(const char *key);
+int setTuning(const char *key, const char *value);
+void freeTuning();
+
+// Times (and checks) the qturn variants as built with constants, which
+// should be the ones the game runs with.
+int tuneQTurn(ShaderConstants constants);
+void selectQTurnVariant(QTurnVariant variant);
+// Logs the accuracy against cost of each stencil order, if
+// $PICOPUTT_STENCIL_BENCHMARK is set.  Rebuilds the programs (leaving
+// them built with constants), and leaves the simulation buffers in an
+// arbitrary state.
+int benchmarkStencils(ShaderConstants constants);
+
+void loadLIPConfig(int simWidth, int simHeight);
+int tuneLIP();
+#endif //PICOPUTT_TUNING_H
@@ -3,6 +3,14 @@
 #include <GL/glew.h>
 #include <SDL.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_MMAP
+#endif
+
 
 // Get a directory from an environment variable.
 // This is meant to return paths like SDL_GetBasePath/SDL_GetPrefPath, so for consistency:
@@ -103,8 +111,10 @@ void logGlErrors() {
 }
 
 
-static GLuint quadVAO = 0;
-static GLuint quadVBO = 0;
+// VAOs aren't shared between GL contexts, so each thread with its own
+// context (ie the physics thread) needs to call initQuad itself.
+static _Thread_local GLuint quadVAO = 0;
+static _Thread_local GLuint quadVBO = 0;
 
 void drawQuad() {
     glBindVertexArray(quadVAO);
@@ -152,3 +162,42 @@ void destroyQuad() {
     glDeleteBuffers(1, &quadVBO);
     quadVAO = 0;
 }
+
+
+// Maps a whole file into memory read-only, so that it can be used
+// without copying it.  Where mmap isn't available, it's just read
+// into memory instead.  Returns NULL (and sets SDL error) on failure.
+// The result must be freed with unmapFile.
+const void *mapFile(const char *path, size_t *size) {
+#ifdef HAVE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        SDL_SetError("Couldn't open %s", path);
+        return NULL;
+    }
+
+    struct stat info;
+    if (SET_ERR_IF_TRUE(fstat(fd, &info) == -1) || SET_ERR_IF_TRUE(info.st_size == 0)) {
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (SET_ERR_IF_TRUE(data == MAP_FAILED)) return NULL;
+    *size = (size_t)info.st_size;
+    return data;
+#else
+    return SDL_LoadFile(path, size);
+#endif
+}
+
+void unmapFile(const void *data, size_t size) {
+    if (data == NULL) return;
+#ifdef HAVE_MMAP
+    munmap((void *)data, size);
+#else
+    (void)size;
+    SDL_free((void *)data);
+#endif
+}
@@ -7,6 +7,8 @@ char *getEnvDir(const char *var);
 char *getGlErrorString(GLenum errCode);
 int processGlErrors(const char *info);
 void logGlErrors();
+const void *mapFile(const char *path, size_t *size);
+void unmapFile(const void *data, size_t size);
 
 // TODO: restructure things better, this is nasty
 #define ATTR_IDX_NDC 0
@@ -0,0 +1,186 @@
+#include "vortices.h"
+#include <GL/glew.h>
+#include <SDL.h>
+#include "loop.h"
+#include "resources.h"
+#include "utils.h"
+
+// Must match vortices.comp
+#define VORTEX_GROUP 16
+// The count is padded to a vec4 by std430
+#define VORTEX_HEADER_SIZE (4 * sizeof(float))
+// Scans which can be in flight at once
+#define VORTEX_SLOTS 4
+// Slots which stats scans leave free for a measurement's pair of scans,
+// since stats scans are begun every frame and would otherwise crowd them
+// out
+#define VORTEX_RESERVED_SLOTS 2
+// How long a measurement scan waits for a slot to free up, in ns
+#define VORTEX_SLOT_TIMEOUT 1000000000u
+// Plaquettes are only checked where the density is at least this
+// fraction of the density psi would have if it were spread evenly over
+// the whole sim.
+#define VORTEX_MIN_DENSITY_FRACTION 0.1f
+
+typedef struct {
+    GLuint buffer;
+    GLsync fence;
+    VortexScanKind kind;
+    unsigned epoch;
+} ScanSlot;
+
+static int initialized = 0;
+static ScanSlot slots[VORTEX_SLOTS];
+static unsigned slotHead, slotTail;
+static VortexScan latest;
+static int haveLatest = 0;
+static int haveBefore = 0;  // Whether latest is a VORTEX_SCAN_BEFORE_MEASUREMENT
+static unsigned long measurements, removedByMeasurements;
+// Bumped by anything other than evolution which changes psi, so that
+// scans in the same epoch only differ by what drag (and vortices
+// annihilating by themselves) did.
+static unsigned epoch, latestEpoch;
+static unsigned long removedWhileEvolving;
+
+
+void initVortices() {
+    for (int i = 0; i < VORTEX_SLOTS; i++) {
+        glGenBuffers(1, &slots[i].buffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, slots[i].buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, VORTEX_HEADER_SIZE + MAX_VORTICES * 4 * sizeof(float), NULL, GL_DYNAMIC_READ);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    initialized = 1;
+}
+
+static int collectScan(GLuint64 timeout);
+
+void beginVortexScan(int cur, VortexScanKind kind) {
+    if (!initialized) return;
+    if (kind == VORTEX_SCAN_STATS) {
+        if (slotTail - slotHead >= VORTEX_SLOTS - VORTEX_RESERVED_SLOTS) return;
+    } else if (slotTail - slotHead == VORTEX_SLOTS && !collectScan(VORTEX_SLOT_TIMEOUT)) {
+        // Only after a burst of measurements; a lost scan just goes unlogged
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Skipped a measurement's vortex scan: all slots are busy");
+        return;
+    }
+    if (kind == VORTEX_SCAN_AFTER_MEASUREMENT) epoch++;
+    ScanSlot *slot = &slots[slotTail++ % VORTEX_SLOTS];
+    slot->kind = kind;
+    slot->epoch = epoch;
+
+    GLsizei width = g_simBuffers[0].width;
+    GLsizei height = g_simBuffers[0].height;
+    GLuint zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot->buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof zero, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, slot->buffer);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, g_simBuffers[0].texture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, g_simBuffers[1].texture);
+    glUseProgram(g_vortices.prog.id);
+    glUniform1i(g_vortices.u_cur, 0 + cur);
+    glUniform1i(g_vortices.u_prev, 0 + 1 - cur);
+    glUniform1f(g_vortices.u_minDensity, VORTEX_MIN_DENSITY_FRACTION / ((float)width * (float)height * g_dx * g_dx));
+    glDispatchCompute(
+        (GLuint)(width + VORTEX_GROUP - 2) / VORTEX_GROUP,
+        (GLuint)(height + VORTEX_GROUP - 2) / VORTEX_GROUP, 1
+    );
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// Logs what a measurement did, given the scans from either side of it
+static void logMeasurement(const VortexScan *before, const VortexScan *after) {
+    measurements++;
+    if (after->count < before->count) removedByMeasurements += (unsigned long)(before->count - after->count);
+    SDL_Log(
+        "Measurement: %d -> %d vortices (%lu removed by %lu measurements, %lu while evolving so far)",
+        before->count, after->count, removedByMeasurements, measurements, removedWhileEvolving
+    );
+}
+
+void disturbVortices() {
+    epoch++;
+}
+
+// Collects the oldest scan in flight, waiting up to timeout ns for it.
+// Returns 0 if it isn't done yet.
+static int collectScan(GLuint64 timeout) {
+    ScanSlot *slot = &slots[slotHead % VORTEX_SLOTS];
+    GLenum status = glClientWaitSync(slot->fence, timeout? GL_SYNC_FLUSH_COMMANDS_BIT : 0, timeout);
+    if (status == GL_TIMEOUT_EXPIRED) return 0;
+    glDeleteSync(slot->fence);
+    slotHead++;
+    if (status == GL_WAIT_FAILED) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Waiting for vortex scan failed: %s", getGlErrorString(glGetError()));
+        haveBefore = 0;
+        return 1;
+    }
+
+    // Only the measurement's "before" scan needs to outlive the next, and
+    // only the count of the others
+    VortexScan before;
+    if (haveBefore) before = latest;
+    int prevCount = latest.count;
+    // Nothing but evolution happened between the two scans
+    int sameEpoch = haveLatest && latestEpoch == slot->epoch;
+
+    GLuint count;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot->buffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof count, &count);
+    latest.kind = slot->kind;
+    latest.count = (int)SDL_min(count, (GLuint)SDL_MAX_SINT32);
+    latest.stored = (int)SDL_min(count, MAX_VORTICES);
+    latest.net = 0;
+
+    float data[MAX_VORTICES * 4];
+    if (latest.stored) {
+        glGetBufferSubData(
+            GL_SHADER_STORAGE_BUFFER, VORTEX_HEADER_SIZE,
+            (GLsizeiptr)latest.stored * 4 * sizeof(float), data
+        );
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    for (int i = 0; i < latest.stored; i++) {
+        const float *v = &data[4*i];
+        latest.vortices[i] = (Vortex) {
+            .pos = {.x = v[0], .y = v[1]},
+            .sign = v[2] > 0.f? 1 : -1,
+            .density = v[3]
+        };
+        latest.net += latest.vortices[i].sign;
+    }
+    haveLatest = 1;
+    latestEpoch = slot->epoch;
+
+    if (sameEpoch && latest.count < prevCount) removedWhileEvolving += (unsigned long)(prevCount - latest.count);
+    if (latest.kind == VORTEX_SCAN_AFTER_MEASUREMENT && haveBefore) logMeasurement(&before, &latest);
+    haveBefore = latest.kind == VORTEX_SCAN_BEFORE_MEASUREMENT;
+    return 1;
+}
+
+void collectVortexScans() {
+    while (slotHead != slotTail && collectScan(0));
+}
+
+const VortexScan *latestVortexScan() {
+    return haveLatest? &latest : NULL;
+}
+
+void finishVortices() {
+    if (!initialized) return;
+    SDL_Log(
+        "Vortices removed: %lu by %lu measurements, %lu while evolving",
+        removedByMeasurements, measurements, removedWhileEvolving
+    );
+    while (slotHead != slotTail) glDeleteSync(slots[slotHead++ % VORTEX_SLOTS].fence);
+    for (int i = 0; i < VORTEX_SLOTS; i++) glDeleteBuffers(1, &slots[i].buffer);
+    initialized = 0;
+}
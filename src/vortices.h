@@ -0,0 +1,53 @@
+#ifndef PICOPUTT_VORTICES_H
+#define PICOPUTT_VORTICES_H
+#include <GL/glew.h>
+#include <SDL.h>
+
+// Detects quantum vortices in psi on the GPU (see vortices.comp), which
+// the drag force can't remove (see the README), so that the HUD can hint
+// at them and we can see what removes them.  Scans only read back the
+// vortices found (up to MAX_VORTICES), asynchronously, so they're cheap
+// enough to run with the stats every frame.
+
+// Vortices stored per scan (more are still counted)
+#define MAX_VORTICES 256
+
+typedef struct {
+    SDL_FPoint pos;  // Center of the plaquette, in sim grid units
+    int sign;        // +1 for counterclockwise phase winding
+    float density;   // Mean probability density around the vortex
+} Vortex;
+
+typedef enum {
+    VORTEX_SCAN_STATS,               // With the stats (see beginComputingStats)
+    VORTEX_SCAN_BEFORE_MEASUREMENT,  // Paired with the next one, which is
+    VORTEX_SCAN_AFTER_MEASUREMENT    //  logged as the measurement's effect
+} VortexScanKind;
+
+typedef struct {
+    VortexScanKind kind;
+    int count;     // Including those which weren't stored
+    int net;       // Sum of the signs of the stored vortices
+    int stored;
+    Vortex vortices[MAX_VORTICES];
+} VortexScan;
+
+// Must be called on the main thread with the GL context current, after
+// the resources are loaded.
+void initVortices();
+// Starts scanning the sim buffers, with cur as curBuf.  Stats scans are
+// skipped if too many are still in flight, while measurement scans wait
+// for a slot.  Binds the sim buffers to texture units 0 and 1.
+void beginVortexScan(int cur, VortexScanKind kind);
+// Must be called whenever psi is changed other than by evolving it (or
+// measuring it, which the scans already bracket), so that differences
+// between the scans on either side aren't put down to drag.
+void disturbVortices();
+// Collects finished scans, without waiting.  Must be called on the same
+// thread as beginVortexScan.
+void collectVortexScans();
+// The latest scan collected, or NULL if there hasn't been one
+const VortexScan *latestVortexScan();
+// Must be called on the main thread, once physics has stopped.
+void finishVortices();
+#endif //PICOPUTT_VORTICES_H